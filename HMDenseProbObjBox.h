@@ -0,0 +1,300 @@
+#pragma once
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include <type_traits>
+#include <vector>
+#include "HMProbObjBoxIndex.h"
+
+//////////////////////////////////////////////////////////////////////////////////////
+// CHMDenseProbObjBox is a variant of CHMProbObjBox for integral or enum objects with a
+// known key range [tMin, tMax], such as item type ids. The counts are kept in an array
+// indexed by key, so GetCount and Modify are O(1) instead of a scan of the pool, and a
+// draw uses a prefix or alias index over the keys with a count, rebuilt lazily after a
+// Modify.
+//
+// Keys are laid out in increasing order, so with linear or prefix sampling a given
+// nRand draws the same object as from a CHMProbObjBox holding the same entries in key
+// order. The array costs 4 bytes per key of the range whatever the number of objects.
+template <typename T1, T1 tMin, T1 tMax>
+class CHMDenseProbObjBox
+{
+	static_assert(std::is_integral<T1>::value || std::is_enum<T1>::value, "CHMDenseProbObjBox needs an integral or enum type.");
+
+	typedef typename std::conditional<std::is_enum<T1>::value, std::underlying_type<T1>, std::common_type<T1>>::type::type TKey;
+	static_assert((TKey)tMin <= (TKey)tMax, "CHMDenseProbObjBox needs tMin <= tMax.");
+	static_assert((unsigned long long)(TKey)tMax - (unsigned long long)(TKey)tMin < (1ULL << 24),
+		"CHMDenseProbObjBox is meant for ranges of up to 16M keys, use CHMProbObjBox instead.");
+
+public:
+	CHMDenseProbObjBox() : m_unCurrentProbObjCount(0), m_unProbObjNum(0), m_eSampling(eHMProbObjBoxSamplingPrefix), m_bIndexDirty(false) {};
+	~CHMDenseProbObjBox() {};
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Draw a probability object from this box. Rebuilds the sampling index
+	//				first if a Modify left it out of date.
+	// t1ProbObj:	If this call succeed, the drawn probability object will be put into
+	//				t1ProbObj.
+	// nRand:		It decides which probability object will be drawn. It should be a positive
+	//				random int value(recommended), or -1.
+	// Return:		Return true if succeed, false if failed.
+	bool Draw(T1& t1ProbObj, const int nRand = -1)
+	{
+		if (0 == m_unCurrentProbObjCount) return false;
+		if (nRand < 0 && -1 != nRand) return false;
+		if (m_bIndexDirty) RebuildIndex();
+
+		unsigned int unRand = (0 > nRand) ? rand() : nRand;
+		unsigned int unKeyNum = unRand % m_unCurrentProbObjCount;
+
+		unsigned int unPos = UINT_MAX;
+		if (eHMProbObjBoxSamplingLinear != m_stIndex.GetSampling())
+		{
+			const unsigned int unIndexPos = m_stIndex.Find(unKeyNum);
+			if (unIndexPos < m_vecIndexPos.size()) unPos = m_vecIndexPos[unIndexPos];
+		}
+		else
+		{
+			for (unsigned int i = 0; i < m_vecProbObjCount.size(); i++)
+			{
+				if (unKeyNum < m_vecProbObjCount[i])
+				{
+					unPos = i;
+					break;
+				}
+				unKeyNum -= m_vecProbObjCount[i];
+			}
+		}
+		if (unPos >= m_vecProbObjCount.size()) return false;
+
+		t1ProbObj = GetProbObj(unPos);
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Modify probability objects of this box. Objects out of the key range
+	//				are ignored.
+	// t1ProbObj:	A pointer to the storage of object that you want to modify.
+	// pCount:		A pointer to the storage of every object's new count.
+	// unLen:		The length of storage.
+	// Return:		None.
+	void Modify(const T1* const t1ProbObj, const unsigned int* const pCount, const unsigned int unLen = 1)
+	{
+		if (NULL == t1ProbObj || NULL == pCount || 0 == unLen) return;
+
+		for (unsigned int i = 0; i < unLen; i++)
+		{
+			ModifyProbObjPool(t1ProbObj[i], pCount[i]);
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Modify probability objects of this box. Objects out of the key range
+	//				are ignored.
+	// t2ProbObj:	A user-defined container which contains the probability objects and
+	//				their counts we want.
+	// Return:		None.
+	template <typename T2>
+	void Modify(const T2& t2ProbObj)
+	{
+		for (auto it = t2ProbObj.cbegin(); it != t2ProbObj.cend(); it++)
+		{
+			ModifyProbObjPool(it->first, it->second);
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Clear this box to make it empty.
+	// Return:		None.
+	void Clear()
+	{
+		m_unCurrentProbObjCount = 0;
+		m_unProbObjNum = 0;
+		std::vector<unsigned int>().swap(m_vecProbObjCount);
+		m_stIndex.Clear();
+		std::vector<unsigned int>().swap(m_vecIndexPos);
+		m_bIndexDirty = false;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Choose how this box draws, see EHMProbObjBoxSampling. The index is
+	//				rebuilt by the next Draw or Commit.
+	// eSampling:	The sampling strategy, default eHMProbObjBoxSamplingPrefix.
+	// Return:		None.
+	void SetSampling(const EHMProbObjBoxSampling eSampling)
+	{
+		if (eSampling == m_eSampling) return;
+
+		m_eSampling = eSampling;
+		m_bIndexDirty = true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the sampling strategy of this box.
+	// Return:		The sampling strategy.
+	EHMProbObjBoxSampling GetSampling() const { return m_eSampling; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Rebuild the sampling index now if it is out of date, see
+	//				CHMProbObjBox::Commit.
+	// Return:		None.
+	void Commit()
+	{
+		if (m_bIndexDirty) RebuildIndex();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get particular or total probability objects counts, depend on pProbObj.
+	// pProbObj:	A pointer of the specific probability object, if it == NULL, get the
+	//				total count.
+	// Return:		The count.
+	unsigned int GetCount(const T1* const pProbObj = NULL) const
+	{
+		if (NULL == pProbObj) return m_unCurrentProbObjCount;
+
+		const unsigned int unPos = GetPos(*pProbObj);
+		return (unPos < m_vecProbObjCount.size()) ? m_vecProbObjCount[unPos] : 0;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the number of probability objects in this box.
+	// Return:		The number of keys with a count.
+	unsigned int GetSize() const { return m_unProbObjNum; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the number of keys of the range.
+	static constexpr unsigned int Range() { return m_scunRange; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the heap memory held by this box, in bytes.
+	size_t GetMemoryUsage() const
+	{
+		return (m_vecProbObjCount.capacity() + m_vecIndexPos.capacity()) * sizeof(unsigned int) + m_stIndex.GetMemoryUsage();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Dump the details of this box to std::cout.
+	// Return:		None.
+	void Dump() const
+	{
+		Dump(std::cout);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Dump the details of this box to a stream, which is flushed once at the
+	//				end.
+	// os:			The output stream.
+	// Return:		None.
+	void Dump(std::ostream& os) const
+	{
+		os << "Current total probability object count " << m_unCurrentProbObjCount << ".\n";
+		os << "Dense probability object box range " << +(TKey)tMin << " to " << +(TKey)tMax << "\n";
+
+		for (unsigned int i = 0; i < m_vecProbObjCount.size(); i++)
+		{
+			if (0 == m_vecProbObjCount[i]) continue;
+			os << "Probability object key " << +(TKey)GetProbObj(i) << ", count " << m_vecProbObjCount[i] << ".\n";
+		}
+		os.flush();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the version of CHMDenseProbObjBox.
+	// Return:		A unsigned int stands for the version.
+	unsigned int Version() const { return m_scunCHMDenseProbObjBoxVersion; }
+
+private:
+	// Lets CHMProbObjBoxIndex build over the keys with a count as over a pool of pairs.
+	// Keys without a count are left out, as the alias table needs every column to hold
+	// at least one key.
+	struct SHMDenseProbObjEntry
+	{
+		unsigned int second;
+	};
+	struct SHMDenseProbObjPool
+	{
+		const std::vector<unsigned int>& vecProbObjCount;
+		const std::vector<unsigned int>& vecIndexPos;
+		size_t size() const { return vecIndexPos.size(); }
+		SHMDenseProbObjEntry operator[](const size_t i) const { return { vecProbObjCount[vecIndexPos[i]] }; }
+	};
+
+	std::vector<unsigned int> m_vecProbObjCount;	// Allocated with the first object.
+	unsigned int m_unCurrentProbObjCount;
+	unsigned int m_unProbObjNum;
+	EHMProbObjBoxSampling m_eSampling;
+	bool m_bIndexDirty;
+	CHMProbObjBoxIndex m_stIndex;
+	std::vector<unsigned int> m_vecIndexPos;		// The keys with a count, as indexed.
+	static const unsigned int m_scunProbObjBoxCapacity = UINT_MAX;
+	static const unsigned int m_scunRange = (unsigned int)((unsigned long long)(TKey)tMax - (unsigned long long)(TKey)tMin + 1);
+	static const unsigned int m_scunCHMDenseProbObjBoxVersion = 1;
+
+	static unsigned int GetPos(const T1& t1ProbObj)
+	{
+		const TKey tKey = (TKey)t1ProbObj;
+		if (!((TKey)tMin <= tKey && tKey <= (TKey)tMax)) return UINT_MAX;
+		return (unsigned int)((unsigned long long)tKey - (unsigned long long)(TKey)tMin);
+	}
+
+	static T1 GetProbObj(const unsigned int unPos)
+	{
+		return (T1)(TKey)((unsigned long long)(TKey)tMin + unPos);
+	}
+
+	void ModifyProbObjPool(const T1& t1ProbObj, const unsigned int unCount)
+	{
+		const unsigned int unPos = GetPos(t1ProbObj);
+		if (UINT_MAX == unPos) return;
+
+		const unsigned int unOldCount = (unPos < m_vecProbObjCount.size()) ? m_vecProbObjCount[unPos] : 0;
+		if (unCount == unOldCount) return;
+		if (m_scunProbObjBoxCapacity - unCount < m_unCurrentProbObjCount - unOldCount) return;
+
+		if (m_vecProbObjCount.empty())
+		{
+			try
+			{
+				m_vecProbObjCount.resize(m_scunRange, 0);
+			}
+			catch (const std::exception& e)
+			{
+				std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+				return;
+			}
+		}
+
+		m_vecProbObjCount[unPos] = unCount;
+		m_unCurrentProbObjCount = m_unCurrentProbObjCount - unOldCount + unCount;
+		if (0 == unOldCount) m_unProbObjNum++;
+		else if (0 == unCount) m_unProbObjNum--;
+		m_bIndexDirty = true;
+	}
+
+	void RebuildIndex()
+	{
+		m_bIndexDirty = false;
+		m_stIndex.Clear();
+		std::vector<unsigned int>().swap(m_vecIndexPos);
+		if (eHMProbObjBoxSamplingLinear == m_eSampling) return;
+
+		// If the index can not be built, draws fall back to a linear scan.
+		try
+		{
+			m_vecIndexPos.reserve(m_unProbObjNum);
+			for (unsigned int i = 0; i < m_vecProbObjCount.size(); i++)
+			{
+				if (0 != m_vecProbObjCount[i]) m_vecIndexPos.push_back(i);
+			}
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			std::vector<unsigned int>().swap(m_vecIndexPos);
+			return;
+		}
+
+		const SHMDenseProbObjPool stPool = { m_vecProbObjCount, m_vecIndexPos };
+		if (!m_stIndex.Build(stPool, m_unCurrentProbObjCount, m_eSampling)) m_stIndex.Clear();
+	}
+};
@@ -0,0 +1,199 @@
+#pragma once
+#include <climits>
+#include <cstdlib>
+#include <cstddef>
+#include <utility>
+#include <iostream>
+#include <string>
+
+//////////////////////////////////////////////////////////////////////////////////////
+// CHMFixedProbObjBox is a fixed-capacity variant of CHMProbObjBox for small boxes
+// (rarity tiers etc.). All entries are stored inline, so the box never touches the
+// heap, and a draw is an unrolled, branchless compare-and-sum over unCapacity slots.
+// Entries keep their insertion order, so a given nRand draws the same object as it
+// would from a CHMProbObjBox holding the same entries.
+template <typename T1, std::size_t unCapacity>
+class CHMFixedProbObjBox
+{
+	static_assert(unCapacity > 0, "CHMFixedProbObjBox needs a capacity of at least 1.");
+	static_assert(unCapacity <= 64, "CHMFixedProbObjBox is meant for small boxes, use CHMProbObjBox instead.");
+
+public:
+	CHMFixedProbObjBox() : m_unCurrentProbObjCount(0), m_unProbObjNum(0)
+	{
+		for (std::size_t i = 0; i < unCapacity; i++) m_arrProbObjCount[i] = 0;
+	}
+	~CHMFixedProbObjBox() {};
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Draw a probability object from this box.
+	// t1ProbObj:	If this call succeed, the drawn probability object will be put into
+	//				t1ProbObj.
+	// nRand:		It decides which probability object will be drawn. It should be a positive
+	//				random int value(recommended), or -1.
+	// Return:		Return true if succeed, false if failed.
+	bool Draw(T1& t1ProbObj, const int nRand = -1) const
+	{
+		if (0 == m_unCurrentProbObjCount) return false;
+		if (nRand < 0 && -1 != nRand) return false;
+
+		unsigned int unRand = (0 > nRand) ? rand() : nRand;
+		unsigned int unKeyNum = unRand % m_unCurrentProbObjCount;
+
+		t1ProbObj = m_arrProbObjKey[SelectIndex(unKeyNum, std::make_index_sequence<unCapacity>())];
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Modify probability objects of this box. New objects beyond the capacity
+	//				of this box are ignored.
+	// t1ProbObj:	A pointer to the storage of object that you want to modify.
+	// pCount:		A pointer to the storage of every object's new count.
+	// unLen:		The length of storage.
+	// Return:		None.
+	void Modify(const T1* const t1ProbObj, const unsigned int* const pCount, const unsigned int unLen = 1)
+	{
+		if (NULL == t1ProbObj || NULL == pCount || 0 == unLen) return;
+
+		for (unsigned int i = 0; i < unLen; i++)
+		{
+			ModifyProbObjPool(t1ProbObj[i], pCount[i]);
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Modify probability objects of this box. New objects beyond the capacity
+	//				of this box are ignored.
+	// t2ProbObj:	A user-defined container which contains the probability objects and
+	//				their counts we want.
+	// Return:		None.
+	template <typename T2>
+	void Modify(const T2& t2ProbObj)
+	{
+		for (auto it = t2ProbObj.cbegin(); it != t2ProbObj.cend(); it++)
+		{
+			ModifyProbObjPool(it->first, it->second);
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Clear this box to make it empty.
+	// Return:		None.
+	void Clear()
+	{
+		m_unCurrentProbObjCount = 0;
+		m_unProbObjNum = 0;
+		for (std::size_t i = 0; i < unCapacity; i++) m_arrProbObjCount[i] = 0;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get particular or total probability objects counts, depend on pProbObj.
+	// pProbObj:	A pointer of the specific probability object, if it == NULL, get the
+	//				total count.
+	// Return:		The count.
+	unsigned int GetCount(const T1* const pProbObj = NULL) const
+	{
+		if (NULL == pProbObj) return m_unCurrentProbObjCount;
+
+		for (unsigned int i = 0; i < m_unProbObjNum; i++)
+		{
+			if (*pProbObj == m_arrProbObjKey[i]) return m_arrProbObjCount[i];
+		}
+		return 0;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the number of probability objects in this box.
+	// Return:		The number of probability objects.
+	unsigned int GetSize() const { return m_unProbObjNum; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the capacity of this box.
+	// Return:		The maximum number of probability objects this box can hold.
+	static constexpr std::size_t Capacity() { return unCapacity; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Dump the details of this box to std::cout.
+	// Return:		None.
+	void Dump() const
+	{
+		Dump(std::cout);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Dump the details of this box to a stream, as one block flushed once.
+	// os:			The output stream.
+	// Return:		None.
+	void Dump(std::ostream& os) const
+	{
+		std::string strBuffer;
+		strBuffer += "Current total probability object count " + std::to_string(m_unCurrentProbObjCount) + ".\n";
+		strBuffer += "Fixed probability object box capacity " + std::to_string(unCapacity) + "\n";
+
+		for (unsigned int i = 0; i < m_unProbObjNum; i++)
+		{
+			strBuffer += "Probability object index " + std::to_string(i + 1) + ", count " + std::to_string(m_arrProbObjCount[i]) + ".\n";
+		}
+		os.write(strBuffer.data(), strBuffer.size());
+		os.flush();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the version of CHMFixedProbObjBox.
+	// Return:		A unsigned int stands for the version.
+	unsigned int Version() const { return m_scunCHMFixedProbObjBoxVersion; }
+
+private:
+	unsigned int m_unCurrentProbObjCount;
+	unsigned int m_unProbObjNum;
+	T1 m_arrProbObjKey[unCapacity];
+	unsigned int m_arrProbObjCount[unCapacity];
+	static const unsigned int m_scunProbObjBoxCapacity = UINT_MAX;
+	static const unsigned int m_scunCHMFixedProbObjBoxVersion = 1;
+
+	void ModifyProbObjPool(const T1& t1ProbObj, const unsigned int unCount)
+	{
+		for (unsigned int i = 0; i < m_unProbObjNum; i++)
+		{
+			if (t1ProbObj == m_arrProbObjKey[i])
+			{
+				if (0 == unCount)
+				{
+					m_unCurrentProbObjCount -= m_arrProbObjCount[i];
+					for (unsigned int j = i + 1; j < m_unProbObjNum; j++)
+					{
+						m_arrProbObjKey[j - 1] = m_arrProbObjKey[j];
+						m_arrProbObjCount[j - 1] = m_arrProbObjCount[j];
+					}
+					m_unProbObjNum--;
+					m_arrProbObjCount[m_unProbObjNum] = 0;
+				}
+				else if (m_scunProbObjBoxCapacity - unCount >= m_unCurrentProbObjCount - m_arrProbObjCount[i])
+				{
+					m_unCurrentProbObjCount = m_unCurrentProbObjCount - m_arrProbObjCount[i] + unCount;
+					m_arrProbObjCount[i] = unCount;
+				}
+				return;
+			}
+		}
+
+		if (0 != unCount && unCapacity > m_unProbObjNum && m_scunProbObjBoxCapacity - unCount > m_unCurrentProbObjCount)
+		{
+			m_arrProbObjKey[m_unProbObjNum] = t1ProbObj;
+			m_arrProbObjCount[m_unProbObjNum] = unCount;
+			m_unProbObjNum++;
+			m_unCurrentProbObjCount += unCount;
+		}
+	}
+
+	// Unused slots hold a count of 0, so their running sum equals the total count and
+	// never satisfies unRandKey >= unSum. The index is the number of prefix sums not
+	// greater than unRandKey, which is the slot whose range contains unRandKey.
+	template <std::size_t... unSlot>
+	unsigned int SelectIndex(const unsigned int unRandKey, std::index_sequence<unSlot...>) const
+	{
+		unsigned int unSum = 0, unIndex = 0;
+		((unSum += m_arrProbObjCount[unSlot], unIndex += (unRandKey >= unSum)), ...);
+		return unIndex;
+	}
+};
@@ -1,17 +1,343 @@
 #pragma once
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <functional>
 #include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include "HMProbObjBoxIndex.h"
+#include "HMProbObjBoxUtil.h"
+#if __cplusplus >= 202002L
+#include <random>
+#include <ranges>
+#endif
+#ifdef HM_PROB_OBJ_BOX_STATS
+#include <atomic>
+#include <chrono>
+#endif
 
+//////////////////////////////////////////////////////////////////////////////////////
+// Statistics of a CHMProbObjBox, see CHMProbObjBox::GetStats. They are only collected
+// when HM_PROB_OBJ_BOX_STATS is defined before this header is included, otherwise all
+// of them stay 0 and the box carries no counters at all.
+struct SHMProbObjBoxStats
+{
+	static const unsigned int m_scunLatencyBucketNum = 32;
+
+	unsigned long long ullDrawNum;					// Draw calls.
+	unsigned long long ullDrawFailNum;				// Draw calls which returned false.
+	unsigned long long ullModifyNum;				// Probability objects passed to Modify or Append.
+	unsigned long long ullRebuildNum;				// Rebuilds of the sampling index.
+	// Sampled latencies, bucket i counts the calls which took [2^i, 2^(i+1)) ns, bucket 0
+	// also counts anything faster. One call in 2^HM_PROB_OBJ_BOX_STATS_SAMPLE_SHIFT is timed.
+	unsigned long long arrDrawLatency[m_scunLatencyBucketNum];
+	unsigned long long arrModifyLatency[m_scunLatencyBucketNum];
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+// Output formats of CHMProbObjBox::Dump.
+enum EHMProbObjBoxDumpFormat
+{
+	eHMProbObjBoxDumpText,			// The human-readable lines of Dump().
+	eHMProbObjBoxDumpJsonLines,		// One JSON object for the box, then one per probability object.
+	eHMProbObjBoxDumpSummary,		// One JSON object with the total, the entropy and the top-k objects.
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+// When CHMProbObjBox rebuilds its sampling index after a modification.
+enum EHMProbObjBoxRebuildPolicy
+{
+	eHMProbObjBoxRebuildEager,		// At the end of every Modify, Load or Clear call.
+	eHMProbObjBoxRebuildLazy,		// At the next Draw or Commit, so a burst of updates rebuilds once.
+	eHMProbObjBoxRebuildBackground,	// On a worker thread of the box, while draws keep using the last
+									// published copy of the pool and its index, see SetRebuildPolicy.
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+// CHMProbObjBoxWorker runs the background rebuild job of a CHMProbObjBox on its own
+// thread. Notifications are coalesced, so a burst of updates runs the job once or
+// twice. A copied or assigned worker is not running, the box starts it again when
+// needed, so a job never outlives or changes hands with the box it was started for.
+class CHMProbObjBoxWorker
+{
+public:
+	CHMProbObjBoxWorker() {};
+	CHMProbObjBoxWorker(const CHMProbObjBoxWorker&) {};
+	CHMProbObjBoxWorker& operator=(const CHMProbObjBoxWorker&)
+	{
+		Stop();
+		return *this;
+	}
+	~CHMProbObjBoxWorker() { Stop(); }
+
+	bool IsRunning() const { return NULL != m_pImpl; }
+
+	// Guards the pool of the box against the job while the worker is running.
+	std::mutex& GetPoolMutex() const { return m_pImpl->m_mtxPool; }
+
+	bool Start(const std::function<void()>& fnJob)
+	{
+		if (IsRunning()) return true;
+
+		try
+		{
+			m_pImpl.reset(new SHMWorkerImpl);
+			m_pImpl->m_fnJob = fnJob;
+			m_pImpl->m_thread = std::thread(&CHMProbObjBoxWorker::Run, m_pImpl.get());
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			m_pImpl.reset();
+			return false;
+		}
+		return true;
+	}
+
+	void Stop()
+	{
+		if (!IsRunning()) return;
+
+		{
+			std::lock_guard<std::mutex> lock(m_pImpl->m_mtxSignal);
+			m_pImpl->m_bStop = true;
+		}
+		m_pImpl->m_cvSignal.notify_one();
+		m_pImpl->m_thread.join();
+		m_pImpl.reset();
+	}
+
+	void Notify()
+	{
+		if (!IsRunning()) return;
+
+		{
+			std::lock_guard<std::mutex> lock(m_pImpl->m_mtxSignal);
+			m_pImpl->m_bPending = true;
+		}
+		m_pImpl->m_cvSignal.notify_one();
+	}
+
+	// Runs the job on the calling thread, never at the same time as the worker.
+	void RunNow()
+	{
+		if (!IsRunning()) return;
+
+		std::lock_guard<std::mutex> lock(m_pImpl->m_mtxJob);
+		m_pImpl->m_fnJob();
+	}
+
+private:
+	struct SHMWorkerImpl
+	{
+		SHMWorkerImpl() : m_bPending(false), m_bStop(false) {};
+
+		std::thread m_thread;
+		std::function<void()> m_fnJob;
+		std::mutex m_mtxPool;
+		std::mutex m_mtxJob;
+		std::mutex m_mtxSignal;
+		std::condition_variable m_cvSignal;
+		bool m_bPending;
+		bool m_bStop;
+	};
+	std::unique_ptr<SHMWorkerImpl> m_pImpl;
+
+	static void Run(SHMWorkerImpl* const pImpl)
+	{
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(pImpl->m_mtxSignal);
+				pImpl->m_cvSignal.wait(lock, [pImpl] { return pImpl->m_bPending || pImpl->m_bStop; });
+				if (pImpl->m_bStop) return;
+				pImpl->m_bPending = false;
+			}
+
+			std::lock_guard<std::mutex> lock(pImpl->m_mtxJob);
+			pImpl->m_fnJob();
+		}
+	}
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+// Tells whether a T1 can be written to a std::ostream, so that Dump can print keys.
+template <typename T1, typename = void>
+struct CHMProbObjIsStreamable : std::false_type {};
+template <typename T1>
+struct CHMProbObjIsStreamable<T1, decltype(void(std::declval<std::ostream&>() << std::declval<const T1&>()))> : std::true_type {};
+
+//////////////////////////////////////////////////////////////////////////////////////
+// Tells whether std::hash<T1> is enabled, so that probability queries can use a hash
+// index of the objects.
+template <typename T1, typename = void>
+struct CHMProbObjIsHashable : std::false_type {};
 template <typename T1>
+struct CHMProbObjIsHashable<T1, decltype(void(std::declval<const std::hash<T1>&>()(std::declval<const T1&>())))> : std::true_type {};
+
+//////////////////////////////////////////////////////////////////////////////////////
+// Tells whether T1 has operator<, so that CDF can order the objects.
+template <typename T1, typename = void>
+struct CHMProbObjIsLessComparable : std::false_type {};
+template <typename T1>
+struct CHMProbObjIsLessComparable<T1, decltype(void(std::declval<const T1&>() < std::declval<const T1&>()))> : std::true_type {};
+
+#ifdef HM_PROB_OBJ_BOX_STATS
+#ifndef HM_PROB_OBJ_BOX_STATS_SAMPLE_SHIFT
+#define HM_PROB_OBJ_BOX_STATS_SAMPLE_SHIFT 6
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////
+// Counters behind SHMProbObjBoxStats. They are relaxed atomics, so draws take no lock,
+// but every draw increments the same draw counter: threads drawing from one box share
+// its cache line and pay for it. Copying a box copies a snapshot of them.
+class CHMProbObjBoxStatsCollector
+{
+public:
+	CHMProbObjBoxStatsCollector() { Reset(); }
+	CHMProbObjBoxStatsCollector(const CHMProbObjBoxStatsCollector& other) { CopyFrom(other); }
+	CHMProbObjBoxStatsCollector& operator=(const CHMProbObjBoxStatsCollector& other)
+	{
+		if (this != &other) CopyFrom(other);
+		return *this;
+	}
+
+	// Returns the start time in ns if this call is sampled, or 0.
+	unsigned long long BeginDraw()
+	{
+		return Begin(m_ullDrawNum.fetch_add(1, std::memory_order_relaxed));
+	}
+
+	void EndDraw(const unsigned long long ullBegin, const bool bSucceed)
+	{
+		if (!bSucceed) m_ullDrawFailNum.fetch_add(1, std::memory_order_relaxed);
+		End(ullBegin, m_arrDrawLatency);
+	}
+
+	unsigned long long BeginModify(const unsigned int unLen)
+	{
+		return Begin(m_ullModifyNum.fetch_add(unLen, std::memory_order_relaxed));
+	}
+
+	void EndModify(const unsigned long long ullBegin)
+	{
+		End(ullBegin, m_arrModifyLatency);
+	}
+
+	void AddRebuild()
+	{
+		m_ullRebuildNum.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void Get(SHMProbObjBoxStats& stStats) const
+	{
+		stStats.ullDrawNum = m_ullDrawNum.load(std::memory_order_relaxed);
+		stStats.ullDrawFailNum = m_ullDrawFailNum.load(std::memory_order_relaxed);
+		stStats.ullModifyNum = m_ullModifyNum.load(std::memory_order_relaxed);
+		stStats.ullRebuildNum = m_ullRebuildNum.load(std::memory_order_relaxed);
+		for (unsigned int i = 0; i < SHMProbObjBoxStats::m_scunLatencyBucketNum; i++)
+		{
+			stStats.arrDrawLatency[i] = m_arrDrawLatency[i].load(std::memory_order_relaxed);
+			stStats.arrModifyLatency[i] = m_arrModifyLatency[i].load(std::memory_order_relaxed);
+		}
+	}
+
+	void Reset()
+	{
+		SHMProbObjBoxStats stStats = SHMProbObjBoxStats();
+		Set(stStats);
+	}
+
+private:
+	std::atomic<unsigned long long> m_ullDrawNum;
+	std::atomic<unsigned long long> m_ullDrawFailNum;
+	std::atomic<unsigned long long> m_ullModifyNum;
+	std::atomic<unsigned long long> m_ullRebuildNum;
+	std::atomic<unsigned long long> m_arrDrawLatency[SHMProbObjBoxStats::m_scunLatencyBucketNum];
+	std::atomic<unsigned long long> m_arrModifyLatency[SHMProbObjBoxStats::m_scunLatencyBucketNum];
+
+	static unsigned long long NowNs()
+	{
+		return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count() + 1;
+	}
+
+	static unsigned long long Begin(const unsigned long long ullSeq)
+	{
+		const unsigned long long ullMask = (1ull << HM_PROB_OBJ_BOX_STATS_SAMPLE_SHIFT) - 1;
+		return (0 == (ullSeq & ullMask)) ? NowNs() : 0;
+	}
+
+	static void End(const unsigned long long ullBegin, std::atomic<unsigned long long>* const pLatency)
+	{
+		if (0 == ullBegin) return;
+
+		unsigned long long ullNs = NowNs() - ullBegin;
+		unsigned int unBucket = 0;
+		while (ullNs > 1 && unBucket + 1 < SHMProbObjBoxStats::m_scunLatencyBucketNum)
+		{
+			ullNs >>= 1;
+			unBucket++;
+		}
+		pLatency[unBucket].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void CopyFrom(const CHMProbObjBoxStatsCollector& other)
+	{
+		SHMProbObjBoxStats stStats;
+		other.Get(stStats);
+		Set(stStats);
+	}
+
+	void Set(const SHMProbObjBoxStats& stStats)
+	{
+		m_ullDrawNum.store(stStats.ullDrawNum, std::memory_order_relaxed);
+		m_ullDrawFailNum.store(stStats.ullDrawFailNum, std::memory_order_relaxed);
+		m_ullModifyNum.store(stStats.ullModifyNum, std::memory_order_relaxed);
+		m_ullRebuildNum.store(stStats.ullRebuildNum, std::memory_order_relaxed);
+		for (unsigned int i = 0; i < SHMProbObjBoxStats::m_scunLatencyBucketNum; i++)
+		{
+			m_arrDrawLatency[i].store(stStats.arrDrawLatency[i], std::memory_order_relaxed);
+			m_arrModifyLatency[i].store(stStats.arrModifyLatency[i], std::memory_order_relaxed);
+		}
+	}
+};
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////
+// TWeight is the type the counts are kept in, an unsigned integral type of at most 32
+// bits. A narrower one shrinks the pool entries where the layout of std::pair allows,
+// such as 4 instead of 8 bytes for a T1 and a TWeight of 16 bits. Counts it can not
+// hold are ignored by Modify and Append. The counts of the interface and the total
+// stay unsigned int.
+template <typename T1, typename TWeight = unsigned int>
 class CHMProbObjBox
 {
+	static_assert(std::is_integral<TWeight>::value && std::is_unsigned<TWeight>::value && sizeof(TWeight) <= sizeof(unsigned int),
+		"CHMProbObjBox needs an unsigned integral TWeight of at most 32 bits.");
+
+	struct SHMProbObjBoxTable;
+
 public:
-	CHMProbObjBox() : m_unCurrentProbObjCount(0)
+	CHMProbObjBox() : m_unCurrentProbObjCount(0), m_eSampling(eHMProbObjBoxSamplingLinear),
+		m_eRebuildPolicy(eHMProbObjBoxRebuildLazy), m_bIndexDirty(false), m_unBuildThreadNum(1)
 	{
-		std::vector<std::pair<T1, unsigned int>>().swap(m_vecProbObjPool);
+		std::vector<std::pair<T1, TWeight>>().swap(m_vecProbObjPool);
 	}
-	~CHMProbObjBox() {};
+	~CHMProbObjBox() { m_stWorker.Stop(); };
 
 	//////////////////////////////////////////////////////////////////////////////////////
 	// Describe:	Draw a probability object from this box.
@@ -22,13 +348,178 @@ public:
 	// Return:		Return true if succeed, false if failed.
 	bool Draw(T1& t1ProbObj, const int nRand = -1)
 	{
-		if (0 == m_unCurrentProbObjCount) return false;
+#ifdef HM_PROB_OBJ_BOX_STATS
+		const unsigned long long ullBegin = m_stStatsCollector.BeginDraw();
+		const bool bSucceed = DrawProbObj(t1ProbObj, nRand);
+		m_stStatsCollector.EndDraw(ullBegin, bSucceed);
+		return bSucceed;
+#else
+		return DrawProbObj(t1ProbObj, nRand);
+#endif
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Draw a probability object from the objects of this box a predicate
+	//				accepts, with their counts, without changing the box. Draws are first
+	//				taken from the whole box until one is accepted; after a few rejections
+	//				the accepted objects are scanned for an exact draw. Either way the result
+	//				follows the counts of the accepted objects. The first draw tried is the
+	//				one Draw would return for the same nRand.
+	// t1ProbObj:	If this call succeed, the drawn probability object will be put into
+	//				t1ProbObj.
+	// fnPred:		A callable bool(const T1&), true if the object may be drawn. It may be
+	//				called several times for an object.
+	// nRand:		The same as Draw.
+	// Return:		Return true if succeed, false if failed or no object is accepted.
+	template <typename TPred>
+	bool DrawIf(T1& t1ProbObj, const TPred& fnPred, const int nRand = -1)
+	{
+#ifdef HM_PROB_OBJ_BOX_STATS
+		const unsigned long long ullBegin = m_stStatsCollector.BeginDraw();
+		const bool bSucceed = DrawProbObjIf(t1ProbObj, fnPred, nRand);
+		m_stStatsCollector.EndDraw(ullBegin, bSucceed);
+		return bSucceed;
+#else
+		return DrawProbObjIf(t1ProbObj, fnPred, nRand);
+#endif
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Draw a probability object which is not in a set, see DrawIf.
+	// t1ProbObj:	If this call succeed, the drawn probability object will be put into
+	//				t1ProbObj.
+	// t2Excluded:	A set of objects which may not be drawn, with a member 'count', such as
+	//				std::set or std::unordered_set.
+	// nRand:		The same as Draw.
+	// Return:		Return true if succeed, false if failed or every object is excluded.
+	template <typename T2>
+	bool DrawExcluding(T1& t1ProbObj, const T2& t2Excluded, const int nRand = -1)
+	{
+		if (t2Excluded.empty()) return Draw(t1ProbObj, nRand);
+		return DrawIf(t1ProbObj, [&t2Excluded](const T1& t1Obj) { return 0 == t2Excluded.count(t1Obj); }, nRand);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Draw unK distinct probability objects, as if drawing one and taking it
+	//				out of the box unK times, without changing or copying the box. Every
+	//				object gets the key -ln(u) / count for a uniform u, and the unK smallest
+	//				keys are drawn in increasing order (Efraimidis-Spirakis), kept in a
+	//				bounded heap, in O(n + unK * log(unK) * log(n / unK)) expected time.
+	// unK:			The number of objects to draw. If the box holds fewer, all are drawn; 0
+	//				draws none and succeeds, even from an empty box.
+	// vecOut:		If this call succeed, the drawn objects in draw order will be put into
+	//				it, its old content is dropped.
+	// nRand:		The seed of the draw, the same nRand draws the same objects. It should be
+	//				a positive random int value(recommended), or -1.
+	// Return:		Return true if succeed, false if failed.
+	bool SampleDistinct(const unsigned int unK, std::vector<T1>& vecOut, const int nRand = -1) const
+	{
+		vecOut.clear();
 		if (nRand < 0 && -1 != nRand) return false;
+		if (0 == unK) return true;
 
-		unsigned int unRand = (0 > nRand) ? rand() : nRand;
-		unsigned int unKeyNum = unRand % m_unCurrentProbObjCount;
+		std::shared_ptr<const SHMProbObjBoxTable> spTable;
+		const std::vector<std::pair<T1, TWeight>>& vecProbObjPool = GetDrawPool(spTable);
+		if (vecProbObjPool.empty()) return false;
+
+		CHMProbObjSplitMix stRand((0 > nRand) ? rand() : nRand);
+		try
+		{
+			// A max-heap of the unK smallest (key, position) pairs seen so far.
+			std::vector<std::pair<double, unsigned int>> vecHeap;
+			vecHeap.reserve(std::min<size_t>(unK, vecProbObjPool.size()));
+			for (unsigned int i = 0; i < vecProbObjPool.size(); i++)
+			{
+				const std::pair<double, unsigned int> stKey(-std::log(stRand.NextOpen()) / vecProbObjPool[i].second, i);
+				if (vecHeap.size() < unK)
+				{
+					vecHeap.push_back(stKey);
+					std::push_heap(vecHeap.begin(), vecHeap.end());
+				}
+				else if (stKey < vecHeap.front())
+				{
+					std::pop_heap(vecHeap.begin(), vecHeap.end());
+					vecHeap.back() = stKey;
+					std::push_heap(vecHeap.begin(), vecHeap.end());
+				}
+			}
+
+			std::sort_heap(vecHeap.begin(), vecHeap.end());
+			vecOut.reserve(vecHeap.size());
+			for (auto it = vecHeap.cbegin(); it != vecHeap.cend(); it++) vecOut.push_back(vecProbObjPool[it->second].first);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			vecOut.clear();
+			return false;
+		}
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Order all probability objects by weighted random priority, as if drawing
+	//				and taking them out of the box one by one, without changing the box. The
+	//				objects are sorted by the keys of SampleDistinct, so its unK objects for
+	//				an nRand are the first unK here. Big pools are keyed and sorted in blocks
+	//				of at least 64K objects on several threads, then merged; the order does
+	//				not depend on the number of threads.
+	// vecOut:		If this call succeed, all objects in order will be put into it, its old
+	//				content is dropped.
+	// nRand:		The same as SampleDistinct.
+	// unThreadNum:	The most threads to use, 0 means one per hardware thread, default 1.
+	// Return:		Return true if succeed, false if failed.
+	bool WeightedShuffle(std::vector<T1>& vecOut, const int nRand = -1, const unsigned int unThreadNum = 1) const
+	{
+		vecOut.clear();
+		if (nRand < 0 && -1 != nRand) return false;
 
-		return FindProbObjByRandKey(t1ProbObj, unKeyNum);
+		std::shared_ptr<const SHMProbObjBoxTable> spTable;
+		const std::vector<std::pair<T1, TWeight>>& vecProbObjPool = GetDrawPool(spTable);
+		if (vecProbObjPool.empty()) return false;
+
+		const unsigned int unRand = (0 > nRand) ? rand() : nRand;
+		const unsigned int unProbObjNum = (unsigned int)vecProbObjPool.size();
+		const unsigned int unBlockNum = CHMProbObjParallel::GetBlockNum(unThreadNum, unProbObjNum, m_scunShuffleBlockMin);
+		try
+		{
+			std::vector<std::pair<double, unsigned int>> vecKey(unProbObjNum);
+			CHMProbObjParallel::Run(unBlockNum, [&](const unsigned int unBlock)
+				{
+					const unsigned int unBegin = CHMProbObjParallel::GetBlockBegin(unProbObjNum, unBlockNum, unBlock);
+					const unsigned int unEnd = CHMProbObjParallel::GetBlockBegin(unProbObjNum, unBlockNum, unBlock + 1);
+					CHMProbObjSplitMix stRand(unRand);
+					stRand.Discard(unBegin);
+					for (unsigned int i = unBegin; i < unEnd; i++)
+					{
+						vecKey[i] = std::make_pair(-std::log(stRand.NextOpen()) / vecProbObjPool[i].second, i);
+					}
+					std::sort(vecKey.begin() + unBegin, vecKey.begin() + unEnd);
+				});
+
+			// Merge sorted runs pairwise, each round on its own threads.
+			for (unsigned int unStep = 1; unStep < unBlockNum; unStep *= 2)
+			{
+				CHMProbObjParallel::Run((unBlockNum + 2 * unStep - 1) / (2 * unStep), [&](const unsigned int unPair)
+					{
+						const unsigned int unFirst = unPair * 2 * unStep;
+						if (unFirst + unStep >= unBlockNum) return;
+						std::inplace_merge(vecKey.begin() + CHMProbObjParallel::GetBlockBegin(unProbObjNum, unBlockNum, unFirst),
+							vecKey.begin() + CHMProbObjParallel::GetBlockBegin(unProbObjNum, unBlockNum, unFirst + unStep),
+							vecKey.begin() + CHMProbObjParallel::GetBlockBegin(unProbObjNum, unBlockNum, std::min(unFirst + 2 * unStep, unBlockNum)));
+					});
+			}
+
+			vecOut.reserve(unProbObjNum);
+			for (auto it = vecKey.cbegin(); it != vecKey.cend(); it++) vecOut.push_back(vecProbObjPool[it->second].first);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			vecOut.clear();
+			return false;
+		}
+		return true;
 	}
 
 	//////////////////////////////////////////////////////////////////////////////////////
@@ -42,10 +533,21 @@ public:
 	{
 		if (NULL == t1ProbObj || NULL == pCount || 0 == unLen) return;
 
-		for (unsigned int i = 0; i < unLen; i++)
+#ifdef HM_PROB_OBJ_BOX_STATS
+		const unsigned long long ullBegin = m_stStatsCollector.BeginModify(unLen);
+#endif
 		{
-			ModifyProbObjPool(t1ProbObj[i], pCount[i]);
+			std::unique_lock<std::mutex> lock = LockPool();
+			for (unsigned int i = 0; i < unLen; i++)
+			{
+				ModifyProbObjPool(t1ProbObj[i], pCount[i]);
+			}
 		}
+		InvalidateQuery();
+		ScheduleRebuild();
+#ifdef HM_PROB_OBJ_BOX_STATS
+		m_stStatsCollector.EndModify(ullBegin);
+#endif
 	}
 
 	//////////////////////////////////////////////////////////////////////////////////////
@@ -57,9 +559,75 @@ public:
 	template <typename T2>
 	void Modify(const T2& t2ProbObj)
 	{
-		for (auto it = t2ProbObj.cbegin(); it != t2ProbObj.cend(); it++)
+#ifdef HM_PROB_OBJ_BOX_STATS
+		const unsigned long long ullBegin = m_stStatsCollector.BeginModify((unsigned int)std::distance(t2ProbObj.cbegin(), t2ProbObj.cend()));
+#endif
+		{
+			std::unique_lock<std::mutex> lock = LockPool();
+			for (auto it = t2ProbObj.cbegin(); it != t2ProbObj.cend(); it++)
+			{
+				ModifyProbObjPool(it->first, it->second);
+			}
+		}
+		InvalidateQuery();
+		ScheduleRebuild();
+#ifdef HM_PROB_OBJ_BOX_STATS
+		m_stStatsCollector.EndModify(ullBegin);
+#endif
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Append a new probability object to the end of the pool without looking
+	//				for an existing one, for bulk loading of tables with unique objects.
+	//				The caller must make sure t1ProbObj is not in this box yet. Whatever the
+	//				rebuild policy, Append only marks the index out of date, so call Commit
+	//				once after the load.
+	// t1ProbObj:	The new probability object.
+	// unCount:		Its count, it should be greater than 0 and fit in TWeight.
+	// Return:		Return true if succeed, false if failed.
+	bool Append(const T1& t1ProbObj, const unsigned int unCount)
+	{
+		if (0 == unCount || unCount > m_scunWeightMax || m_scunProbObjBoxCapacity - unCount <= m_unCurrentProbObjCount) return false;
+
+#ifdef HM_PROB_OBJ_BOX_STATS
+		const unsigned long long ullBegin = m_stStatsCollector.BeginModify(1);
+#endif
+		bool bSucceed = true;
+		{
+			std::unique_lock<std::mutex> lock = LockPool();
+			try
+			{
+				m_vecProbObjPool.push_back(std::make_pair(t1ProbObj, (TWeight)unCount));
+				m_unCurrentProbObjCount += unCount;
+				m_bIndexDirty = true;
+			}
+			catch (const std::exception& e)
+			{
+				std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+				bSucceed = false;
+			}
+		}
+		if (bSucceed) InvalidateQuery();
+#ifdef HM_PROB_OBJ_BOX_STATS
+		m_stStatsCollector.EndModify(ullBegin);
+#endif
+		return bSucceed;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Reserve storage for probability objects before a bulk load.
+	// unLen:		The number of probability objects expected.
+	// Return:		None.
+	void Reserve(const unsigned int unLen)
+	{
+		std::unique_lock<std::mutex> lock = LockPool();
+		try
 		{
-			ModifyProbObjPool(it->first, it->second);
+			m_vecProbObjPool.reserve(unLen);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
 		}
 	}
 
@@ -68,100 +636,1017 @@ public:
 	// Return:		None.
 	void Clear()
 	{
-		m_unCurrentProbObjCount = 0;
-		std::vector<std::pair<T1, unsigned int>>().swap(m_vecProbObjPool);
+		{
+			std::unique_lock<std::mutex> lock = LockPool();
+			m_unCurrentProbObjCount = 0;
+			std::vector<std::pair<T1, TWeight>>().swap(m_vecProbObjPool);
+			m_stIndex.Clear();
+			m_bIndexDirty = (eHMProbObjBoxSamplingLinear != m_eSampling || eHMProbObjBoxRebuildBackground == m_eRebuildPolicy);
+		}
+		InvalidateQuery();
+		ScheduleRebuild();
 	}
 
 	//////////////////////////////////////////////////////////////////////////////////////
-	// Describe:	Get particular or total probability objects counts, depend on pProbObj.
-	// pProbObj:	A pointer of the specific probability object, if it == NULL, get the
-	//				total count.
-	// Return:		The count.
-	unsigned int GetCount(const T1* const pProbObj = NULL) const
+	// Describe:	Choose how this box draws, see EHMProbObjBoxSampling. The index is
+	//				rebuilt according to the rebuild policy.
+	// eSampling:	The sampling strategy, default eHMProbObjBoxSamplingLinear.
+	// Return:		None.
+	void SetSampling(const EHMProbObjBoxSampling eSampling)
 	{
-		if (NULL == pProbObj) return m_unCurrentProbObjCount;
+		if (eSampling == m_eSampling) return;
 
-		for (auto it = m_vecProbObjPool.cbegin(); it != m_vecProbObjPool.cend(); it++)
 		{
-			if (*pProbObj == it->first) return it->second;
+			std::unique_lock<std::mutex> lock = LockPool();
+			m_eSampling = eSampling;
+			m_bIndexDirty = true;
 		}
-		return 0;
+		ScheduleRebuild();
 	}
 
 	//////////////////////////////////////////////////////////////////////////////////////
-	// Describe:	Get the probability objects pool.
-	// Return:		The probability objects pool.
-	const auto& GetPool() const{ return m_vecProbObjPool; }
+	// Describe:	Get the sampling strategy of this box.
+	// Return:		The sampling strategy.
+	EHMProbObjBoxSampling GetSampling() const { return m_eSampling; }
 
 	//////////////////////////////////////////////////////////////////////////////////////
-	// Describe:	Dump the details of this box.
+	// Describe:	Choose when the sampling index is rebuilt after a modification.
+	//				With eHMProbObjBoxRebuildBackground the box keeps a published copy of the
+	//				pool and its index, built on a worker thread and swapped in atomically.
+	//				Draw only reads the published copy, so it never waits for a rebuild and
+	//				may run on other threads while this one modifies the box, but it sees a
+	//				modification only once the rebuild is published (or after Commit). This
+	//				doubles the memory of the box. Switching to it builds the first copy
+	//				before returning.
+	// eRebuildPolicy:The policy, default eHMProbObjBoxRebuildLazy.
 	// Return:		None.
-	void Dump() const
+	void SetRebuildPolicy(const EHMProbObjBoxRebuildPolicy eRebuildPolicy)
 	{
-		std::cout << "Current total probability object count " << m_unCurrentProbObjCount << "." << std::endl;
-		std::cout << "Probability object box capacity " << m_scunProbObjBoxCapacity << std::endl;
+		if (eRebuildPolicy == m_eRebuildPolicy) return;
 
-		int nIndex = 0;
-		for (auto it = m_vecProbObjPool.cbegin(); it != m_vecProbObjPool.cend(); it++)
+		if (eHMProbObjBoxRebuildBackground == m_eRebuildPolicy)
 		{
-			nIndex++;
-			std::cout << "Probability object index " << nIndex << ", count " << it->second << "." << std::endl;
+			m_stWorker.Stop();
+			std::atomic_store(&m_spTable, std::shared_ptr<const SHMProbObjBoxTable>());
 		}
+		m_eRebuildPolicy = eRebuildPolicy;
+		m_bIndexDirty = true;
+		if (eHMProbObjBoxRebuildLazy != m_eRebuildPolicy) Commit();
 	}
 
 	//////////////////////////////////////////////////////////////////////////////////////
-	// Describe:	Get the version of CHMProbObjBox.
-	// Return:		A unsigned int stands for the version.
-	unsigned int Version() const { return m_scunCHMProbObjBoxVersion; }
+	// Describe:	Get the rebuild policy of this box.
+	// Return:		The rebuild policy.
+	EHMProbObjBoxRebuildPolicy GetRebuildPolicy() const { return m_eRebuildPolicy; }
 
-private:
-	unsigned int m_unCurrentProbObjCount;
-	std::vector<std::pair<T1, unsigned int>> m_vecProbObjPool;
-	static const unsigned int m_scunProbObjBoxCapacity = UINT_MAX;
-	static const unsigned int m_scunCHMProbObjBoxVersion = 2;
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Set the most threads a rebuild of the sampling index may use. Pools of
+	//				less than 64K objects per thread use fewer threads, and the index built
+	//				is the same for any number of threads.
+	// unBuildThreadNum:The number of threads, 0 means one per hardware thread, default 1.
+	// Return:		None.
+	void SetBuildThreadNum(const unsigned int unBuildThreadNum)
+	{
+		std::unique_lock<std::mutex> lock = LockPool();
+		m_unBuildThreadNum = unBuildThreadNum;
+	}
 
-	void ModifyProbObjPool(const T1& t1ProbObj, const unsigned int unCount)
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the most threads a rebuild of the sampling index may use.
+	// Return:		The number of threads, 0 means one per hardware thread.
+	unsigned int GetBuildThreadNum() const { return m_unBuildThreadNum; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Rebuild the sampling index now if it is out of date. Call it after a
+	//				burst of updates to keep the rebuild out of the next Draw, or before
+	//				drawing from several threads, as Draw is read-only on a clean box.
+	//				With background rebuild it publishes the current pool before returning.
+	// Return:		None.
+	void Commit()
 	{
-		for (auto it = m_vecProbObjPool.begin(); it != m_vecProbObjPool.end(); it++)
+		if (eHMProbObjBoxRebuildBackground == m_eRebuildPolicy)
 		{
-			if (t1ProbObj == it->first)
-			{
-				if (0 == unCount)
-				{
-					m_unCurrentProbObjCount = m_unCurrentProbObjCount - it->second + unCount;
-					m_vecProbObjPool.erase(it);
-				}
-				else if (m_scunProbObjBoxCapacity - unCount >= m_unCurrentProbObjCount - it->second)
-				{
-					it->second = unCount;
-					m_unCurrentProbObjCount = m_unCurrentProbObjCount - it->second + unCount;
-				}
-				return;
-			}
+			if (m_stWorker.Start([this] { PublishTable(); })) m_stWorker.RunNow();
+			return;
 		}
+		if (m_bIndexDirty) RebuildIndex();
+	}
 
-		if (0 != unCount && m_scunProbObjBoxCapacity - unCount > m_unCurrentProbObjCount)
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Check whether the sampling index is out of date.
+	// Return:		Return true if the next Draw or Commit will rebuild it.
+	bool IsDirty() const
+	{
+		std::unique_lock<std::mutex> lock = LockPool();
+		return m_bIndexDirty;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the heap memory held by the pool and the sampling index.
+	// Return:		The memory in bytes.
+	size_t GetMemoryUsage() const
+	{
+		size_t unMemory = m_vecProbObjPool.capacity() * sizeof(std::pair<T1, TWeight>) + m_stIndex.GetMemoryUsage();
+		std::shared_ptr<const SHMProbObjBoxTable> spTable = std::atomic_load(&m_spTable);
+		if (spTable)
 		{
-			try
-			{
-				m_vecProbObjPool.push_back(std::make_pair(t1ProbObj, unCount));
-			}
-			catch (const std::exception& e)
-			{
-				std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
-			}
-			catch (...)
-			{
-				std::cout << __FILE__ << "(" << __LINE__ << "), unknow exception" << std::endl;
-			}
-			m_unCurrentProbObjCount += unCount;
+			unMemory += spTable->vecProbObjPool.capacity() * sizeof(std::pair<T1, TWeight>) + spTable->stIndex.GetMemoryUsage();
 		}
+		return unMemory;
 	}
 
-	bool FindProbObjByRandKey(T1& t1ProbObj, const unsigned int unRandKey) const
-	{
-		unsigned int unBotton = 0, unTop = 0;
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get particular or total probability objects counts, depend on pProbObj.
+	// pProbObj:	A pointer of the specific probability object, if it == NULL, get the
+	//				total count.
+	// Return:		The count.
+	unsigned int GetCount(const T1* const pProbObj = NULL) const
+	{
+		if (NULL == pProbObj) return m_unCurrentProbObjCount;
+
 		for (auto it = m_vecProbObjPool.cbegin(); it != m_vecProbObjPool.cend(); it++)
+		{
+			if (*pProbObj == it->first) return it->second;
+		}
+		return 0;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the probability of drawing a probability object. Like the other
+	//				queries below it reads a normalized view of the pool built by the first
+	//				query after a modification and kept until the next one, with a hash
+	//				index of the objects if std::hash<T1> is enabled, so repeated queries
+	//				of a live box are O(1) or O(log n). Queries may run on several threads,
+	//				not while this box is modified.
+	// t1ProbObj:	The probability object.
+	// Return:		The probability, 0 if it is not in this box.
+	double Probability(const T1& t1ProbObj) const
+	{
+		if (0 == m_unCurrentProbObjCount) return 0;
+
+		std::shared_ptr<const SHMProbObjBoxQuery> spQuery = GetQuery();
+		if (!spQuery || !CHMProbObjIsHashable<T1>::value) return (double)GetCount(&t1ProbObj) / m_unCurrentProbObjCount;
+
+		const unsigned int unPos = FindQueryPos(*spQuery, t1ProbObj, CHMProbObjIsHashable<T1>());
+		return (UINT_MAX == unPos) ? 0 : (double)m_vecProbObjPool[unPos].second / m_unCurrentProbObjCount;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the Shannon entropy of a draw, see Probability.
+	// Return:		The entropy in bits, 0 if this box is empty.
+	double Entropy() const
+	{
+		std::shared_ptr<const SHMProbObjBoxQuery> spQuery = GetQuery();
+		return spQuery ? spQuery->dEntropy : 0;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the most probable probability objects, see Probability.
+	// unK:			The number of objects. If the box holds fewer, all are listed.
+	// vecOut:		If this call succeed, the objects and their probabilities will be put
+	//				into it, in decreasing probability and pool order among equal ones.
+	// Return:		Return true if succeed, false if failed.
+	bool TopK(const unsigned int unK, std::vector<std::pair<T1, double>>& vecOut) const
+	{
+		vecOut.clear();
+		std::shared_ptr<const SHMProbObjBoxQuery> spQuery = GetQuery();
+		if (!spQuery) return false;
+
+		try
+		{
+			const size_t unTopNum = std::min<size_t>(unK, spQuery->vecTopPos.size());
+			vecOut.reserve(unTopNum);
+			for (size_t i = 0; i < unTopNum; i++)
+			{
+				const auto& prProbObj = m_vecProbObjPool[spQuery->vecTopPos[i]];
+				vecOut.push_back(std::make_pair(prProbObj.first, (double)prProbObj.second / m_unCurrentProbObjCount));
+			}
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			vecOut.clear();
+			return false;
+		}
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the probability of drawing an object not greater than a value, by
+	//				operator< of T1, see Probability. O(log n).
+	// t1ProbObj:	The value, it need not be in this box.
+	// Return:		The probability, 0 if this box is empty.
+	double CDF(const T1& t1ProbObj) const
+	{
+		static_assert(CHMProbObjIsLessComparable<T1>::value, "CDF needs a T1 with operator<.");
+
+		std::shared_ptr<const SHMProbObjBoxQuery> spQuery = GetQuery();
+		if (!spQuery || spQuery->vecKeyPos.empty()) return 0;
+
+		auto it = std::upper_bound(spQuery->vecKeyPos.cbegin(), spQuery->vecKeyPos.cend(), t1ProbObj, [this](const T1& t1Value, const unsigned int unPos)
+			{
+				return t1Value < m_vecProbObjPool[unPos].first;
+			});
+		const size_t unNum = it - spQuery->vecKeyPos.cbegin();
+		return (0 == unNum) ? 0 : (double)spQuery->vecKeyCumulative[unNum - 1] / m_unCurrentProbObjCount;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Find the probability object a key maps to in pool order, where object i
+	//				owns the keys from the sum of the counts before it, as a linear Draw does
+	//				with the key 'nRand % GetCount()'. It is const: an up to date prefix sums
+	//				index finds the key in O(log n), otherwise the pool is scanned.
+	// t1ProbObj:	If this call succeed, the probability object will be put into t1ProbObj.
+	// unKeyNum:	The key, it must be less than GetCount().
+	// Return:		Return true if succeed, false if failed.
+	bool FindByKey(T1& t1ProbObj, const unsigned int unKeyNum) const
+	{
+		if (unKeyNum >= m_unCurrentProbObjCount) return false;
+
+		const bool bUseIndex = !m_bIndexDirty && eHMProbObjBoxRebuildBackground != m_eRebuildPolicy
+			&& eHMProbObjBoxSamplingPrefix == m_stIndex.GetSampling();
+		return FindProbObjByRandKey(m_vecProbObjPool, bUseIndex ? m_stIndex : CHMProbObjBoxIndex(), t1ProbObj, unKeyNum);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the probability objects pool.
+	// Return:		The probability objects pool.
+	const auto& GetPool() const{ return m_vecProbObjPool; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Dump the details of this box to std::cout.
+	// Return:		None.
+	void Dump() const
+	{
+		Dump(std::cout);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Dump the details of this box to a stream. The output is built in large
+	//				buffered blocks and the stream is flushed once at the end.
+	// os:			The output stream.
+	// eFormat:		The output format.
+	// unTopK:		The number of probability objects listed by eHMProbObjBoxDumpSummary.
+	// Return:		None.
+	void Dump(std::ostream& os, const EHMProbObjBoxDumpFormat eFormat = eHMProbObjBoxDumpText, const unsigned int unTopK = 10) const
+	{
+		DumpTo([&os](const char* pData, size_t unLen) { os.write(pData, unLen); }, eFormat, unTopK);
+		os.flush();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Dump the details of this box to a callback.
+	// fnWrite:		void(const char* pData, size_t unLen), receives the output block by block.
+	// eFormat:		The output format.
+	// unTopK:		The number of probability objects listed by eHMProbObjBoxDumpSummary.
+	// Return:		None.
+	template <typename TWriter>
+	void DumpTo(TWriter fnWrite, const EHMProbObjBoxDumpFormat eFormat = eHMProbObjBoxDumpText, const unsigned int unTopK = 10) const
+	{
+		std::string strBuffer;
+		strBuffer.reserve(m_scunDumpBlockSize + 256);
+
+		if (eHMProbObjBoxDumpSummary == eFormat)
+		{
+			DumpSummary(strBuffer, unTopK);
+			fnWrite(strBuffer.data(), strBuffer.size());
+			return;
+		}
+
+		if (eHMProbObjBoxDumpJsonLines == eFormat)
+		{
+			strBuffer += "{\"version\":" + std::to_string(m_scunCHMProbObjBoxVersion) + ",\"total\":" + std::to_string(m_unCurrentProbObjCount)
+				+ ",\"size\":" + std::to_string(m_vecProbObjPool.size()) + ",\"capacity\":" + std::to_string(m_scunProbObjBoxCapacity) + "}\n";
+		}
+		else
+		{
+			strBuffer += "Current total probability object count " + std::to_string(m_unCurrentProbObjCount) + ".\n";
+			strBuffer += "Probability object box capacity " + std::to_string(m_scunProbObjBoxCapacity) + "\n";
+		}
+
+		unsigned int unIndex = 0;
+		for (auto it = m_vecProbObjPool.cbegin(); it != m_vecProbObjPool.cend(); it++)
+		{
+			unIndex++;
+			if (eHMProbObjBoxDumpJsonLines == eFormat)
+			{
+				strBuffer += "{\"index\":" + std::to_string(unIndex) + ",\"count\":" + std::to_string(it->second);
+				AppendJsonKey(strBuffer, it->first);
+				strBuffer += "}\n";
+			}
+			else
+			{
+				strBuffer += "Probability object index " + std::to_string(unIndex) + ", count " + std::to_string(it->second) + ".\n";
+			}
+
+			if (strBuffer.size() >= m_scunDumpBlockSize)
+			{
+				fnWrite(strBuffer.data(), strBuffer.size());
+				strBuffer.clear();
+			}
+		}
+		if (!strBuffer.empty()) fnWrite(strBuffer.data(), strBuffer.size());
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the version of CHMProbObjBox.
+	// Return:		A unsigned int stands for the version.
+	unsigned int Version() const { return m_scunCHMProbObjBoxVersion; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the statistics of this box. They are all 0 unless
+	//				HM_PROB_OBJ_BOX_STATS is defined.
+	// Return:		The statistics.
+	SHMProbObjBoxStats GetStats() const
+	{
+		SHMProbObjBoxStats stStats = SHMProbObjBoxStats();
+#ifdef HM_PROB_OBJ_BOX_STATS
+		m_stStatsCollector.Get(stStats);
+#endif
+		return stStats;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Reset the statistics of this box to 0.
+	// Return:		None.
+	void ResetStats()
+	{
+#ifdef HM_PROB_OBJ_BOX_STATS
+		m_stStatsCollector.Reset();
+#endif
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Save a binary snapshot of this box. The snapshot is tagged with Version()
+	//				and stores the pool as it is in memory, plus the sampling index if it is
+	//				up to date, so T1 must be trivially copyable and the snapshot can only be
+	//				loaded on a platform with the same layout.
+	// os:			The binary output stream.
+	// Return:		Return true if succeed, false if failed.
+	bool Save(std::ostream& os) const
+	{
+		static_assert(std::is_trivially_copyable<T1>::value, "Save needs a trivially copyable T1.");
+
+		const bool bHasIndex = eHMProbObjBoxRebuildBackground != m_eRebuildPolicy && eHMProbObjBoxSamplingLinear != m_eSampling && !m_bIndexDirty;
+		const unsigned int arrHeader[m_scunSnapshotHeaderLen] = { m_scunSnapshotMagic, m_scunCHMProbObjBoxVersion,
+			GetKeySizeTag(), (unsigned int)sizeof(m_vecProbObjPool[0]), (unsigned int)m_vecProbObjPool.size(), m_unCurrentProbObjCount,
+			(unsigned int)m_eSampling, bHasIndex ? 1u : 0u };
+
+		os.write(reinterpret_cast<const char*>(arrHeader), sizeof(arrHeader));
+		if (!m_vecProbObjPool.empty())
+		{
+			os.write(reinterpret_cast<const char*>(m_vecProbObjPool.data()), m_vecProbObjPool.size() * sizeof(m_vecProbObjPool[0]));
+		}
+		if (bHasIndex) m_stIndex.Save(os);
+		return os.good();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Save a binary snapshot of this box into a file.
+	// szFileName:	The file to write, it will be truncated.
+	// Return:		Return true if succeed, false if failed.
+	bool Save(const char* const szFileName) const
+	{
+		if (NULL == szFileName) return false;
+
+		std::ofstream ofs(szFileName, std::ios::binary | std::ios::trunc);
+		return ofs.is_open() && Save(ofs);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Load a binary snapshot written by Save, replacing the content of this box.
+	//				The pool and the sampling index are read in bulk, nothing is rebuilt
+	//				entry by entry. A snapshot whose total is not the sum of its counts, or
+	//				whose index does not match its pool, is rejected.
+	// is:			The binary input stream.
+	// Return:		Return true if succeed. If failed, this box is left unchanged.
+	bool Load(std::istream& is)
+	{
+		static_assert(std::is_trivially_copyable<T1>::value, "Load needs a trivially copyable T1.");
+
+		unsigned int arrHeader[m_scunSnapshotHeaderLen] = { 0 };
+		if (!is.read(reinterpret_cast<char*>(arrHeader), sizeof(arrHeader))) return false;
+		if (m_scunSnapshotMagic != arrHeader[0] || m_scunCHMProbObjBoxVersion != arrHeader[1]) return false;
+		if (GetKeySizeTag() != arrHeader[2] || sizeof(m_vecProbObjPool[0]) != arrHeader[3]) return false;
+		if (arrHeader[6] > (unsigned int)eHMProbObjBoxSamplingAliasCompact) return false;
+
+		std::vector<std::pair<T1, TWeight>> vecProbObjPool;
+		try
+		{
+			vecProbObjPool.resize(arrHeader[4]);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			return false;
+		}
+		if (!vecProbObjPool.empty())
+		{
+			if (!is.read(reinterpret_cast<char*>(vecProbObjPool.data()), vecProbObjPool.size() * sizeof(vecProbObjPool[0]))) return false;
+		}
+
+		// The header total must be the sum of the counts, none of which is 0.
+		unsigned long long ullTotal = 0;
+		for (auto it = vecProbObjPool.cbegin(); it != vecProbObjPool.cend(); it++)
+		{
+			if (0 == it->second) return false;
+			ullTotal += it->second;
+		}
+		if (ullTotal != arrHeader[5] || ullTotal > m_scunProbObjBoxCapacity) return false;
+
+		CHMProbObjBoxIndex stIndex;
+		if (0 != arrHeader[7] && (!stIndex.Load(is, vecProbObjPool, arrHeader[5]) || (unsigned int)stIndex.GetSampling() != arrHeader[6])) return false;
+
+		{
+			std::unique_lock<std::mutex> lock = LockPool();
+			m_vecProbObjPool.swap(vecProbObjPool);
+			m_unCurrentProbObjCount = arrHeader[5];
+			m_eSampling = (EHMProbObjBoxSampling)arrHeader[6];
+			std::swap(m_stIndex, stIndex);
+			m_bIndexDirty = (0 == arrHeader[7] && eHMProbObjBoxSamplingLinear != m_eSampling) || eHMProbObjBoxRebuildBackground == m_eRebuildPolicy;
+		}
+		InvalidateQuery();
+		ScheduleRebuild();
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Load a binary snapshot file written by Save.
+	// szFileName:	The file to read.
+	// Return:		Return true if succeed. If failed, this box is left unchanged.
+	bool Load(const char* const szFileName)
+	{
+		if (NULL == szFileName) return false;
+
+		std::ifstream ifs(szFileName, std::ios::binary);
+		return ifs.is_open() && Load(ifs);
+	}
+
+#if __cplusplus >= 202002L
+	//////////////////////////////////////////////////////////////////////////////////////
+	// CHMDrawView is the endless input range of Draws. It holds a snapshot of the pool and
+	// its index, shared with the box under background rebuild and copied otherwise, so
+	// the box may be modified while the view is used. Draws are made a batch at a time
+	// into a buffer the iterator walks. Like std::ranges::istream_view, the view keeps the
+	// state and its iterator only points to it, so begin is called once.
+	template <typename TRng>
+	class CHMDrawView : public std::ranges::view_interface<CHMDrawView<TRng>>
+	{
+	public:
+		class CHMIterator
+		{
+		public:
+			typedef std::input_iterator_tag iterator_concept;
+			typedef T1 value_type;
+			typedef std::ptrdiff_t difference_type;
+
+			CHMIterator() : m_pView(NULL) {};
+			explicit CHMIterator(CHMDrawView* const pView) : m_pView(pView) {};
+
+			const T1& operator*() const { return m_pView->m_vecBuffer[m_pView->m_unBufferPos]; }
+			CHMIterator& operator++()
+			{
+				if (++m_pView->m_unBufferPos >= m_pView->m_vecBuffer.size()) m_pView->FillBuffer();
+				return *this;
+			}
+			void operator++(int) { ++*this; }
+			friend bool operator==(const CHMIterator& it, std::default_sentinel_t) { return it.IsEnd(); }
+
+		private:
+			CHMDrawView* m_pView;
+
+			bool IsEnd() const { return m_pView->m_vecBuffer.empty(); }
+		};
+
+		CHMDrawView() : m_pRng(NULL), m_unBatch(0), m_unBufferPos(0) {};
+		CHMDrawView(std::shared_ptr<const SHMProbObjBoxTable> spTable, TRng& tRng, const unsigned int unBatch)
+			: m_spTable(std::move(spTable)), m_pRng(&tRng), m_unBatch(std::max(1u, unBatch)), m_unBufferPos(0) {};
+
+		CHMIterator begin()
+		{
+			FillBuffer();
+			return CHMIterator(this);
+		}
+		std::default_sentinel_t end() const { return std::default_sentinel; }
+
+	private:
+		std::shared_ptr<const SHMProbObjBoxTable> m_spTable;
+		TRng* m_pRng;
+		unsigned int m_unBatch;
+		std::vector<T1> m_vecBuffer;	// Empty once nothing can be drawn, which ends the range.
+		size_t m_unBufferPos;
+
+		void FillBuffer()
+		{
+			m_unBufferPos = 0;
+			if (!m_spTable || 0 == m_spTable->unTotal || NULL == m_pRng)
+			{
+				m_vecBuffer.clear();
+				return;
+			}
+
+			try
+			{
+				m_vecBuffer.resize(m_unBatch);
+			}
+			catch (const std::exception& e)
+			{
+				std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+				m_vecBuffer.clear();
+				return;
+			}
+
+			for (auto it = m_vecBuffer.begin(); it != m_vecBuffer.end(); it++)
+			{
+				if (!FindProbObjByRandKey(m_spTable->vecProbObjPool, m_spTable->stIndex, *it, NextKey(m_spTable->unTotal)))
+				{
+					m_vecBuffer.clear();
+					return;
+				}
+			}
+		}
+
+		// A uniform key in [0, unTotal). Generators of 32 bits or more take the high word of
+		// a 32 x 32-bit product, rejecting the few values that would bias it (Lemire).
+		unsigned int NextKey(const unsigned int unTotal)
+		{
+			if constexpr (TRng::max() - TRng::min() >= 0xFFFFFFFFull)
+			{
+				unsigned long long ullProduct = (unsigned long long)(unsigned int)((*m_pRng)() - TRng::min()) * unTotal;
+				if ((unsigned int)ullProduct < unTotal)
+				{
+					const unsigned int unReject = (0u - unTotal) % unTotal;
+					while ((unsigned int)ullProduct < unReject) ullProduct = (unsigned long long)(unsigned int)((*m_pRng)() - TRng::min()) * unTotal;
+				}
+				return (unsigned int)(ullProduct >> 32);
+			}
+			else
+			{
+				return std::uniform_int_distribution<unsigned int>(0, unTotal - 1)(*m_pRng);
+			}
+		}
+	};
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get an endless range of draws from this box, for pipelines such as
+	//				'box.Draws(rng) | std::views::take(n)'. The range draws from a snapshot
+	//				taken now, see CHMDrawView, keys are uniform in [0, GetCount()) from rng
+	//				and map to objects as in Draw. Only with C++20.
+	// tRng:		A uniform random bit generator, such as std::mt19937. It must outlive
+	//				the range, and is only used by it.
+	// unBatch:		The number of objects drawn at a time, default 256.
+	// Return:		The range. It is empty if this box is empty or the snapshot failed.
+	template <typename TRng>
+	CHMDrawView<TRng> Draws(TRng& tRng, const unsigned int unBatch = m_scunDrawBatchSize) const
+	{
+		if (eHMProbObjBoxRebuildBackground == m_eRebuildPolicy) return CHMDrawView<TRng>(std::atomic_load(&m_spTable), tRng, unBatch);
+
+		std::shared_ptr<SHMProbObjBoxTable> spTable;
+		try
+		{
+			spTable = std::make_shared<SHMProbObjBoxTable>();
+			std::unique_lock<std::mutex> lock = LockPool();
+			spTable->vecProbObjPool = m_vecProbObjPool;
+			spTable->unTotal = m_unCurrentProbObjCount;
+			if (!m_bIndexDirty) spTable->stIndex = m_stIndex;
+			else if (eHMProbObjBoxSamplingLinear != m_eSampling && !spTable->stIndex.Build(spTable->vecProbObjPool, spTable->unTotal, m_eSampling, m_unBuildThreadNum))
+			{
+				spTable->stIndex.Clear();
+			}
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			spTable.reset();
+		}
+		return CHMDrawView<TRng>(spTable, tRng, unBatch);
+	}
+#endif
+
+private:
+	// A published copy of the pool with its index, drawn from under background rebuild.
+	struct SHMProbObjBoxTable
+	{
+		std::vector<std::pair<T1, TWeight>> vecProbObjPool;
+		unsigned int unTotal;
+		CHMProbObjBoxIndex stIndex;
+	};
+
+	// The normalized view of the pool behind Probability, Entropy, TopK and CDF. It holds
+	// pool positions, so it is dropped by every modification.
+	struct SHMProbObjBoxQuery
+	{
+		double dEntropy;
+		std::vector<unsigned int> vecTopPos;			// By decreasing count, then position.
+		std::vector<unsigned int> vecKeyPos;			// By increasing object, if T1 has operator<.
+		std::vector<unsigned int> vecKeyCumulative;		// The counts up to every entry of vecKeyPos.
+		typename std::conditional<CHMProbObjIsHashable<T1>::value, std::unordered_map<T1, unsigned int>, char>::type mapPos;
+	};
+
+	// First member, so assigning a box stops its worker before anything else changes.
+	CHMProbObjBoxWorker m_stWorker;
+	unsigned int m_unCurrentProbObjCount;
+	std::vector<std::pair<T1, TWeight>> m_vecProbObjPool;
+	EHMProbObjBoxSampling m_eSampling;
+	EHMProbObjBoxRebuildPolicy m_eRebuildPolicy;
+	bool m_bIndexDirty;
+	unsigned int m_unBuildThreadNum;
+	CHMProbObjBoxIndex m_stIndex;
+	std::shared_ptr<const SHMProbObjBoxTable> m_spTable;
+	mutable std::shared_ptr<const SHMProbObjBoxQuery> m_spQuery;
+	static const unsigned int m_scunProbObjBoxCapacity = UINT_MAX;
+	static const unsigned int m_scunWeightMax = std::numeric_limits<TWeight>::max();
+	static const unsigned int m_scunCHMProbObjBoxVersion = 3;
+	static const unsigned int m_scunSnapshotMagic = 0x42504D48;	// "HMPB"
+	static const unsigned int m_scunSnapshotHeaderLen = 8;
+	static const unsigned int m_scunDumpBlockSize = 64 * 1024;
+	static const unsigned int m_scunDrawIfTryNum = 16;
+	static const unsigned int m_scunShuffleBlockMin = 64 * 1024;
+	static const unsigned int m_scunDrawBatchSize = 256;
+#ifdef HM_PROB_OBJ_BOX_STATS
+	CHMProbObjBoxStatsCollector m_stStatsCollector;
+#endif
+
+	void DumpSummary(std::string& strBuffer, const unsigned int unTopK) const
+	{
+		// Reads the normalized view if a query built it, and does not build it otherwise: a
+		// partial sort of the positions is all the top k needs.
+		std::shared_ptr<const SHMProbObjBoxQuery> spQuery = std::atomic_load(&m_spQuery);
+		double dEntropy = 0;
+		std::vector<unsigned int> vecTop;
+		if (spQuery) dEntropy = spQuery->dEntropy;
+		else
+		{
+			for (auto it = m_vecProbObjPool.cbegin(); it != m_vecProbObjPool.cend(); it++)
+			{
+				const double dProb = (double)it->second / m_unCurrentProbObjCount;
+				dEntropy -= dProb * std::log2(dProb);
+			}
+
+			vecTop.resize(m_vecProbObjPool.size());
+			for (unsigned int i = 0; i < vecTop.size(); i++) vecTop[i] = i;
+			std::partial_sort(vecTop.begin(), vecTop.begin() + std::min<size_t>(unTopK, vecTop.size()), vecTop.end(), [this](const unsigned int unLeft, const unsigned int unRight)
+				{
+					return m_vecProbObjPool[unLeft].second > m_vecProbObjPool[unRight].second
+						|| (m_vecProbObjPool[unLeft].second == m_vecProbObjPool[unRight].second && unLeft < unRight);
+				});
+		}
+		const std::vector<unsigned int>& vecTopPos = spQuery ? spQuery->vecTopPos : vecTop;
+		const size_t unTopNum = std::min<size_t>(unTopK, vecTopPos.size());
+
+		char szNumber[64];
+		snprintf(szNumber, sizeof(szNumber), "%.6f", dEntropy);
+		strBuffer += "{\"version\":" + std::to_string(m_scunCHMProbObjBoxVersion) + ",\"total\":" + std::to_string(m_unCurrentProbObjCount)
+			+ ",\"size\":" + std::to_string(m_vecProbObjPool.size()) + ",\"entropy_bits\":" + szNumber + ",\"top\":[";
+		for (size_t i = 0; i < unTopNum; i++)
+		{
+			const auto& prProbObj = m_vecProbObjPool[vecTopPos[i]];
+			snprintf(szNumber, sizeof(szNumber), "%.9f", (double)prProbObj.second / m_unCurrentProbObjCount);
+			strBuffer += std::string((0 == i) ? "" : ",") + "{\"index\":" + std::to_string(vecTopPos[i] + 1) + ",\"count\":"
+				+ std::to_string(prProbObj.second) + ",\"probability\":" + szNumber;
+			AppendJsonKey(strBuffer, prProbObj.first);
+			strBuffer += "}";
+		}
+		strBuffer += "]}\n";
+	}
+
+	// Builds the normalized view on the first query. Threads querying at once may each
+	// build one, the last stored wins, they are the same.
+	std::shared_ptr<const SHMProbObjBoxQuery> GetQuery() const
+	{
+		std::shared_ptr<const SHMProbObjBoxQuery> spQuery = std::atomic_load(&m_spQuery);
+		if (spQuery || 0 == m_unCurrentProbObjCount) return spQuery;
+
+		try
+		{
+			std::shared_ptr<SHMProbObjBoxQuery> spNewQuery = std::make_shared<SHMProbObjBoxQuery>();
+			const unsigned int unProbObjNum = (unsigned int)m_vecProbObjPool.size();
+			spNewQuery->dEntropy = 0;
+			for (auto it = m_vecProbObjPool.cbegin(); it != m_vecProbObjPool.cend(); it++)
+			{
+				const double dProb = (double)it->second / m_unCurrentProbObjCount;
+				spNewQuery->dEntropy -= dProb * std::log2(dProb);
+			}
+
+			spNewQuery->vecTopPos.resize(unProbObjNum);
+			for (unsigned int i = 0; i < unProbObjNum; i++) spNewQuery->vecTopPos[i] = i;
+			std::sort(spNewQuery->vecTopPos.begin(), spNewQuery->vecTopPos.end(), [this](const unsigned int unLeft, const unsigned int unRight)
+				{
+					return m_vecProbObjPool[unLeft].second > m_vecProbObjPool[unRight].second
+						|| (m_vecProbObjPool[unLeft].second == m_vecProbObjPool[unRight].second && unLeft < unRight);
+				});
+
+			BuildQueryKeys(*spNewQuery, CHMProbObjIsLessComparable<T1>());
+			BuildQueryIndex(*spNewQuery, CHMProbObjIsHashable<T1>());
+			spQuery = spNewQuery;
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			return spQuery;
+		}
+		std::atomic_store(&m_spQuery, spQuery);
+		return spQuery;
+	}
+
+	void BuildQueryKeys(SHMProbObjBoxQuery& stQuery, std::true_type) const
+	{
+		stQuery.vecKeyPos = stQuery.vecTopPos;
+		std::sort(stQuery.vecKeyPos.begin(), stQuery.vecKeyPos.end(), [this](const unsigned int unLeft, const unsigned int unRight)
+			{
+				return m_vecProbObjPool[unLeft].first < m_vecProbObjPool[unRight].first;
+			});
+		stQuery.vecKeyCumulative.resize(stQuery.vecKeyPos.size());
+		unsigned int unTop = 0;
+		for (size_t i = 0; i < stQuery.vecKeyPos.size(); i++) stQuery.vecKeyCumulative[i] = (unTop += m_vecProbObjPool[stQuery.vecKeyPos[i]].second);
+	}
+
+	void BuildQueryKeys(SHMProbObjBoxQuery&, std::false_type) const {}
+
+	void BuildQueryIndex(SHMProbObjBoxQuery& stQuery, std::true_type) const
+	{
+		stQuery.mapPos.reserve(m_vecProbObjPool.size());
+		for (unsigned int i = 0; i < m_vecProbObjPool.size(); i++) stQuery.mapPos.emplace(m_vecProbObjPool[i].first, i);
+	}
+
+	void BuildQueryIndex(SHMProbObjBoxQuery&, std::false_type) const {}
+
+	static unsigned int FindQueryPos(const SHMProbObjBoxQuery& stQuery, const T1& t1ProbObj, std::true_type)
+	{
+		auto it = stQuery.mapPos.find(t1ProbObj);
+		return (stQuery.mapPos.end() == it) ? UINT_MAX : it->second;
+	}
+
+	static unsigned int FindQueryPos(const SHMProbObjBoxQuery&, const T1&, std::false_type) { return UINT_MAX; }
+
+	void InvalidateQuery()
+	{
+		std::atomic_store(&m_spQuery, std::shared_ptr<const SHMProbObjBoxQuery>());
+	}
+
+	// Keys are written as JSON numbers if T1 is arithmetic, as JSON strings if T1 can be
+	// streamed, and left out otherwise.
+	static void AppendJsonKey(std::string& strBuffer, const T1& t1ProbObj)
+	{
+		AppendJsonKey(strBuffer, t1ProbObj, std::integral_constant<int, std::is_arithmetic<T1>::value ? 2 : (CHMProbObjIsStreamable<T1>::value ? 1 : 0)>());
+	}
+
+	static void AppendJsonKey(std::string& strBuffer, const T1& t1ProbObj, std::integral_constant<int, 2>)
+	{
+		std::ostringstream oss;
+		oss << +t1ProbObj;
+		strBuffer += ",\"key\":" + oss.str();
+	}
+
+	static void AppendJsonKey(std::string& strBuffer, const T1& t1ProbObj, std::integral_constant<int, 1>)
+	{
+		std::ostringstream oss;
+		oss << t1ProbObj;
+		strBuffer += ",\"key\":\"";
+		const std::string strKey = oss.str();
+		for (auto it = strKey.cbegin(); it != strKey.cend(); it++)
+		{
+			if ('"' == *it || '\\' == *it) strBuffer += '\\';
+			if ((unsigned char)*it < 0x20)
+			{
+				char szEscape[8];
+				snprintf(szEscape, sizeof(szEscape), "\\u%04x", (unsigned int)(unsigned char)*it);
+				strBuffer += szEscape;
+				continue;
+			}
+			strBuffer += *it;
+		}
+		strBuffer += '"';
+	}
+
+	static void AppendJsonKey(std::string&, const T1&, std::integral_constant<int, 0>) {}
+
+	bool DrawProbObj(T1& t1ProbObj, const int nRand)
+	{
+		if (eHMProbObjBoxRebuildBackground == m_eRebuildPolicy) return DrawFromTable(t1ProbObj, nRand);
+
+		if (0 == m_unCurrentProbObjCount) return false;
+		if (nRand < 0 && -1 != nRand) return false;
+		if (m_bIndexDirty) RebuildIndex();
+
+		unsigned int unRand = (0 > nRand) ? rand() : nRand;
+		unsigned int unKeyNum = unRand % m_unCurrentProbObjCount;
+
+		return FindProbObjByRandKey(m_vecProbObjPool, m_stIndex, t1ProbObj, unKeyNum);
+	}
+
+	// The pool draws read: the published copy under background rebuild, which spTable
+	// keeps alive, or the pool itself.
+	const std::vector<std::pair<T1, TWeight>>& GetDrawPool(std::shared_ptr<const SHMProbObjBoxTable>& spTable) const
+	{
+		if (eHMProbObjBoxRebuildBackground != m_eRebuildPolicy) return m_vecProbObjPool;
+
+		spTable = std::atomic_load(&m_spTable);
+		if (!spTable)
+		{
+			static const std::vector<std::pair<T1, TWeight>> s_vecEmptyPool;
+			return s_vecEmptyPool;
+		}
+		return spTable->vecProbObjPool;
+	}
+
+	template <typename TPred>
+	bool DrawProbObjIf(T1& t1ProbObj, const TPred& fnPred, const int nRand)
+	{
+		if (nRand < 0 && -1 != nRand) return false;
+
+		if (eHMProbObjBoxRebuildBackground == m_eRebuildPolicy)
+		{
+			std::shared_ptr<const SHMProbObjBoxTable> spTable = std::atomic_load(&m_spTable);
+			if (!spTable || 0 == spTable->unTotal) return false;
+			return FindProbObjIf(spTable->vecProbObjPool, spTable->stIndex, spTable->unTotal, t1ProbObj, fnPred, (0 > nRand) ? rand() : nRand);
+		}
+
+		if (0 == m_unCurrentProbObjCount) return false;
+		if (m_bIndexDirty) RebuildIndex();
+		return FindProbObjIf(m_vecProbObjPool, m_stIndex, m_unCurrentProbObjCount, t1ProbObj, fnPred, (0 > nRand) ? rand() : nRand);
+	}
+
+	// Rejection draws, with the key of Draw first and then keys from a generator seeded by
+	// unRand, and an exact scan of the accepted objects if all are rejected. A linear box
+	// scans anyway, so it tries only once before the exact scan.
+	template <typename TPred>
+	static bool FindProbObjIf(const std::vector<std::pair<T1, TWeight>>& vecProbObjPool, const CHMProbObjBoxIndex& stIndex,
+		const unsigned int unTotal, T1& t1ProbObj, const TPred& fnPred, const unsigned int unRand)
+	{
+		CHMProbObjSplitMix stRand(unRand);
+		const unsigned int unTryNum = (eHMProbObjBoxSamplingLinear == stIndex.GetSampling()) ? 1 : m_scunDrawIfTryNum;
+		unsigned int unKeyNum = unRand % unTotal;
+		for (unsigned int i = 0; i < unTryNum; i++, unKeyNum = stRand.NextBelow(unTotal))
+		{
+			if (!FindProbObjByRandKey(vecProbObjPool, stIndex, t1ProbObj, unKeyNum)) return false;
+			if (fnPred(t1ProbObj)) return true;
+		}
+
+		unsigned int unAcceptedCount = 0;
+		for (auto it = vecProbObjPool.cbegin(); it != vecProbObjPool.cend(); it++)
+		{
+			if (fnPred(it->first)) unAcceptedCount += it->second;
+		}
+		if (0 == unAcceptedCount) return false;
+
+		unKeyNum = stRand.NextBelow(unAcceptedCount);
+		for (auto it = vecProbObjPool.cbegin(); it != vecProbObjPool.cend(); it++)
+		{
+			if (!fnPred(it->first)) continue;
+			if (unKeyNum < it->second)
+			{
+				t1ProbObj = it->first;
+				return true;
+			}
+			unKeyNum -= it->second;
+		}
+		return false;
+	}
+
+	bool DrawFromTable(T1& t1ProbObj, const int nRand) const
+	{
+		std::shared_ptr<const SHMProbObjBoxTable> spTable = std::atomic_load(&m_spTable);
+		if (!spTable || 0 == spTable->unTotal) return false;
+		if (nRand < 0 && -1 != nRand) return false;
+
+		unsigned int unRand = (0 > nRand) ? rand() : nRand;
+		unsigned int unKeyNum = unRand % spTable->unTotal;
+
+		return FindProbObjByRandKey(spTable->vecProbObjPool, spTable->stIndex, t1ProbObj, unKeyNum);
+	}
+
+	// The job of the background worker: copies the pool under the lock, builds the index
+	// without it, and publishes both. Draws keep the previous table until the swap.
+	void PublishTable()
+	{
+		std::shared_ptr<SHMProbObjBoxTable> spTable;
+		EHMProbObjBoxSampling eSampling;
+		unsigned int unBuildThreadNum;
+		try
+		{
+			spTable = std::make_shared<SHMProbObjBoxTable>();
+			std::lock_guard<std::mutex> lock(m_stWorker.GetPoolMutex());
+			if (!m_bIndexDirty) return;
+
+			spTable->vecProbObjPool = m_vecProbObjPool;
+			spTable->unTotal = m_unCurrentProbObjCount;
+			eSampling = m_eSampling;
+			unBuildThreadNum = m_unBuildThreadNum;
+			m_bIndexDirty = false;
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			return;
+		}
+
+		if (eHMProbObjBoxSamplingLinear != eSampling && !spTable->stIndex.Build(spTable->vecProbObjPool, spTable->unTotal, eSampling, unBuildThreadNum))
+		{
+			spTable->stIndex.Clear();
+		}
+		std::atomic_store(&m_spTable, std::shared_ptr<const SHMProbObjBoxTable>(spTable));
+#ifdef HM_PROB_OBJ_BOX_STATS
+		m_stStatsCollector.AddRebuild();
+#endif
+	}
+
+	// The size of T1 in a snapshot header, tagged with the size of TWeight if it is not
+	// the default, so snapshots of the default layout stay as they were.
+	static unsigned int GetKeySizeTag()
+	{
+		return (unsigned int)sizeof(T1) | ((sizeof(TWeight) == sizeof(unsigned int)) ? 0 : (unsigned int)sizeof(TWeight) << 24);
+	}
+
+	std::unique_lock<std::mutex> LockPool() const
+	{
+		return m_stWorker.IsRunning() ? std::unique_lock<std::mutex>(m_stWorker.GetPoolMutex()) : std::unique_lock<std::mutex>();
+	}
+
+	void ModifyProbObjPool(const T1& t1ProbObj, const unsigned int unCount)
+	{
+		if (unCount > m_scunWeightMax) return;
+
+		for (auto it = m_vecProbObjPool.begin(); it != m_vecProbObjPool.end(); it++)
+		{
+			if (t1ProbObj == it->first)
+			{
+				if (0 == unCount)
+				{
+					m_unCurrentProbObjCount = m_unCurrentProbObjCount - it->second + unCount;
+					m_vecProbObjPool.erase(it);
+					m_bIndexDirty = true;
+				}
+				else if (m_scunProbObjBoxCapacity - unCount >= m_unCurrentProbObjCount - it->second)
+				{
+					m_unCurrentProbObjCount = m_unCurrentProbObjCount - it->second + unCount;
+					it->second = (TWeight)unCount;
+					m_bIndexDirty = true;
+				}
+				return;
+			}
+		}
+
+		if (0 != unCount && m_scunProbObjBoxCapacity - unCount > m_unCurrentProbObjCount)
+		{
+			try
+			{
+				m_vecProbObjPool.push_back(std::make_pair(t1ProbObj, (TWeight)unCount));
+				m_unCurrentProbObjCount += unCount;
+				m_bIndexDirty = true;
+			}
+			catch (const std::exception& e)
+			{
+				std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			}
+			catch (...)
+			{
+				std::cout << __FILE__ << "(" << __LINE__ << "), unknow exception" << std::endl;
+			}
+		}
+	}
+
+	void ScheduleRebuild()
+	{
+		if (eHMProbObjBoxRebuildEager == m_eRebuildPolicy) Commit();
+		else if (eHMProbObjBoxRebuildBackground == m_eRebuildPolicy)
+		{
+			// A copied box has no worker yet, its first modification starts one.
+			if (m_stWorker.IsRunning()) m_stWorker.Notify();
+			else Commit();
+		}
+	}
+
+	void RebuildIndex()
+	{
+		m_bIndexDirty = false;
+		if (eHMProbObjBoxSamplingLinear == m_eSampling)
+		{
+			m_stIndex.Clear();
+			return;
+		}
+
+		// If the index can not be built, draws fall back to a linear scan.
+		if (!m_stIndex.Build(m_vecProbObjPool, m_unCurrentProbObjCount, m_eSampling, m_unBuildThreadNum)) m_stIndex.Clear();
+#ifdef HM_PROB_OBJ_BOX_STATS
+		m_stStatsCollector.AddRebuild();
+#endif
+	}
+
+	static bool FindProbObjByRandKey(const std::vector<std::pair<T1, TWeight>>& vecProbObjPool, const CHMProbObjBoxIndex& stIndex,
+		T1& t1ProbObj, const unsigned int unRandKey)
+	{
+		if (eHMProbObjBoxSamplingLinear != stIndex.GetSampling())
+		{
+			const unsigned int unPos = stIndex.Find(unRandKey);
+			if (unPos >= vecProbObjPool.size()) return false;
+
+			t1ProbObj = vecProbObjPool[unPos].first;
+			return true;
+		}
+
+		unsigned int unBotton = 0, unTop = 0;
+		for (auto it = vecProbObjPool.cbegin(); it != vecProbObjPool.cend(); it++)
 		{
 			unBotton = unTop;
 			unTop += it->second;
@@ -0,0 +1,234 @@
+//////////////////////////////////////////////////////////////////////////////////////
+// Microbenchmark of CHMProbObjBox, with no dependency but the standard library.
+// Build:	g++ -O2 -std=c++17 -pthread HMProbObjBoxBench.cpp -o HMProbObjBoxBench
+// Usage:	HMProbObjBoxBench [--sizes 2,8,1024,...] [--dists uniform,zipf,heavy]
+//			[--samplings linear,prefix,alias,alias16] [--seconds 0.2] [--build-threads 1] [--out result.jsonl]
+// Every (pool size, weight distribution, sampling) case prints one JSON line with draws/sec,
+// ns/draw percentiles, Modify and GetCount throughput and memory per entry.
+//////////////////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "HMProbObjBox.h"
+
+typedef std::chrono::steady_clock CHMBenchClock;
+
+struct SHMBenchResult
+{
+	unsigned int unPoolSize;
+	std::string strDist;
+	std::string strSampling;
+	double dBuildSec;
+	double dCommitSec;
+	double dDrawsPerSec;
+	double dDrawNsP50;
+	double dDrawNsP90;
+	double dDrawNsP99;
+	double dModifiesPerSec;
+	double dGetCountsPerSec;
+	double dBytesPerEntry;
+};
+
+static double ElapsedSec(const CHMBenchClock::time_point& tpBegin)
+{
+	return std::chrono::duration<double>(CHMBenchClock::now() - tpBegin).count();
+}
+
+static bool ParseSizes(const char* szArg, std::vector<unsigned int>& vecSize)
+{
+	vecSize.clear();
+	std::stringstream ss(szArg);
+	for (std::string strItem; std::getline(ss, strItem, ',');)
+	{
+		unsigned long ulSize = strtoul(strItem.c_str(), NULL, 10);
+		if (0 == ulSize || ulSize > UINT_MAX) return false;
+		vecSize.push_back((unsigned int)ulSize);
+	}
+	return !vecSize.empty();
+}
+
+static const char* const s_arrSamplingName[] = { "linear", "prefix", "alias", "alias16" };
+
+static bool ParseSamplings(const char* szArg, std::vector<EHMProbObjBoxSampling>& vecSampling)
+{
+	vecSampling.clear();
+	std::stringstream ss(szArg);
+	for (std::string strItem; std::getline(ss, strItem, ',');)
+	{
+		const char* const* pName = std::find(std::begin(s_arrSamplingName), std::end(s_arrSamplingName), strItem);
+		if (std::end(s_arrSamplingName) == pName) return false;
+		vecSampling.push_back((EHMProbObjBoxSampling)(pName - std::begin(s_arrSamplingName)));
+	}
+	return !vecSampling.empty();
+}
+
+static bool ParseDists(const char* szArg, std::vector<std::string>& vecDist)
+{
+	vecDist.clear();
+	std::stringstream ss(szArg);
+	for (std::string strItem; std::getline(ss, strItem, ',');)
+	{
+		if ("uniform" != strItem && "zipf" != strItem && "heavy" != strItem) return false;
+		vecDist.push_back(strItem);
+	}
+	return !vecDist.empty();
+}
+
+// Weights are chosen so that the total stays below UINT_MAX up to 10M entries:
+// uniform gives every entry 100, zipf gives entry i about 1e8 / (i + 1), heavy gives
+// entry 0 as much weight as all the others together.
+static unsigned int MakeWeight(const std::string& strDist, const unsigned int unIndex, const unsigned int unPoolSize)
+{
+	if ("zipf" == strDist) return std::max(1u, 100000000u / (unIndex + 1));
+	if ("heavy" == strDist) return (0 == unIndex) ? std::max(1u, unPoolSize - 1) : 1;
+	return 100;
+}
+
+static SHMBenchResult RunCase(const unsigned int unPoolSize, const std::string& strDist, const EHMProbObjBoxSampling eSampling,
+	const double dSeconds, const unsigned int unBuildThreadNum)
+{
+	SHMBenchResult stResult;
+	stResult.unPoolSize = unPoolSize;
+	stResult.strDist = strDist;
+	stResult.strSampling = s_arrSamplingName[eSampling];
+
+	std::mt19937 rng(unPoolSize);
+	CHMProbObjBox<unsigned int> box;
+
+	CHMBenchClock::time_point tpBegin = CHMBenchClock::now();
+	box.Reserve(unPoolSize);
+	for (unsigned int i = 0; i < unPoolSize; i++) box.Append(i, MakeWeight(strDist, i, unPoolSize));
+	stResult.dBuildSec = ElapsedSec(tpBegin);
+
+	tpBegin = CHMBenchClock::now();
+	box.SetBuildThreadNum(unBuildThreadNum);
+	box.SetSampling(eSampling);
+	box.Commit();
+	stResult.dCommitSec = ElapsedSec(tpBegin);
+	stResult.dBytesPerEntry = (double)box.GetMemoryUsage() / unPoolSize;
+
+	std::vector<int> vecRand(4096);
+	for (auto it = vecRand.begin(); it != vecRand.end(); it++) *it = (int)(rng() & 0x7FFFFFFF);
+
+	// Draws are timed in batches, the percentiles are over per-draw averages of a batch.
+	const unsigned int unBatch = 64;
+	std::vector<double> vecBatchNs;
+	unsigned long long ullDraws = 0, ullHits = 0;
+	unsigned int unDrawn = 0;
+	tpBegin = CHMBenchClock::now();
+	do
+	{
+		CHMBenchClock::time_point tpBatch = CHMBenchClock::now();
+		for (unsigned int i = 0; i < unBatch; i++, ullDraws++)
+		{
+			ullHits += box.Draw(unDrawn, vecRand[ullDraws & 4095]) ? 1 : 0;
+		}
+		vecBatchNs.push_back(std::chrono::duration<double, std::nano>(CHMBenchClock::now() - tpBatch).count() / unBatch);
+	} while (ElapsedSec(tpBegin) < dSeconds);
+	stResult.dDrawsPerSec = ullDraws / ElapsedSec(tpBegin);
+
+	std::sort(vecBatchNs.begin(), vecBatchNs.end());
+	stResult.dDrawNsP50 = vecBatchNs[vecBatchNs.size() * 50 / 100];
+	stResult.dDrawNsP90 = vecBatchNs[vecBatchNs.size() * 90 / 100];
+	stResult.dDrawNsP99 = vecBatchNs[vecBatchNs.size() * 99 / 100];
+
+	unsigned long long ullOps = 0, ullFound = 0;
+	tpBegin = CHMBenchClock::now();
+	do
+	{
+		unsigned int unKey = vecRand[ullOps & 4095] % unPoolSize;
+		ullFound += box.GetCount(&unKey);
+		ullOps++;
+	} while (ElapsedSec(tpBegin) < dSeconds);
+	stResult.dGetCountsPerSec = ullOps / ElapsedSec(tpBegin);
+
+	// Modify rewrites existing entries with their own weight, so the pool keeps its shape.
+	// Each Modify is followed by a Commit, so the index rebuild is part of its cost.
+	ullOps = 0;
+	tpBegin = CHMBenchClock::now();
+	do
+	{
+		unsigned int unKey = vecRand[ullOps & 4095] % unPoolSize;
+		unsigned int unCount = MakeWeight(strDist, unKey, unPoolSize);
+		box.Modify(&unKey, &unCount);
+		box.Commit();
+		ullOps++;
+	} while (ElapsedSec(tpBegin) < dSeconds);
+	stResult.dModifiesPerSec = ullOps / ElapsedSec(tpBegin);
+
+	// Keeps the loops above from being optimized away.
+	if (ullHits + ullFound + unDrawn == 0) fprintf(stderr, "no draw succeeded\n");
+	return stResult;
+}
+
+static std::string ToJson(const SHMBenchResult& stResult, const unsigned int unVersion)
+{
+	char szLine[512];
+	snprintf(szLine, sizeof(szLine), "{\"version\":%u,\"pool_size\":%u,\"dist\":\"%s\",\"sampling\":\"%s\",\"build_sec\":%.6f,"
+		"\"commit_sec\":%.6f,\"draws_per_sec\":%.1f,\"draw_ns_p50\":%.1f,\"draw_ns_p90\":%.1f,\"draw_ns_p99\":%.1f,"
+		"\"modifies_per_sec\":%.1f,\"getcounts_per_sec\":%.1f,\"bytes_per_entry\":%.2f}",
+		unVersion, stResult.unPoolSize, stResult.strDist.c_str(), stResult.strSampling.c_str(), stResult.dBuildSec,
+		stResult.dCommitSec, stResult.dDrawsPerSec, stResult.dDrawNsP50, stResult.dDrawNsP90, stResult.dDrawNsP99,
+		stResult.dModifiesPerSec, stResult.dGetCountsPerSec, stResult.dBytesPerEntry);
+	return szLine;
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<unsigned int> vecSize = { 2, 8, 64, 1024, 65536, 1048576, 10000000 };
+	std::vector<std::string> vecDist = { "uniform", "zipf", "heavy" };
+	std::vector<EHMProbObjBoxSampling> vecSampling = { eHMProbObjBoxSamplingLinear, eHMProbObjBoxSamplingPrefix, eHMProbObjBoxSamplingAlias };
+	double dSeconds = 0.2;
+	unsigned int unBuildThreadNum = 1;
+	const char* szOutFile = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		bool bHasValue = (i + 1 < argc);
+		if (0 == strcmp(argv[i], "--sizes") && bHasValue && ParseSizes(argv[i + 1], vecSize)) i++;
+		else if (0 == strcmp(argv[i], "--dists") && bHasValue && ParseDists(argv[i + 1], vecDist)) i++;
+		else if (0 == strcmp(argv[i], "--samplings") && bHasValue && ParseSamplings(argv[i + 1], vecSampling)) i++;
+		else if (0 == strcmp(argv[i], "--seconds") && bHasValue && 0 < (dSeconds = atof(argv[i + 1]))) i++;
+		else if (0 == strcmp(argv[i], "--build-threads") && bHasValue) unBuildThreadNum = (unsigned int)strtoul(argv[++i], NULL, 10);
+		else if (0 == strcmp(argv[i], "--out") && bHasValue) szOutFile = argv[++i];
+		else
+		{
+			fprintf(stderr, "Usage: %s [--sizes 2,8,1024] [--dists uniform,zipf,heavy] [--samplings linear,prefix,alias,alias16]"
+				" [--seconds 0.2] [--build-threads 1] [--out result.jsonl]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	std::ofstream ofs;
+	if (NULL != szOutFile)
+	{
+		ofs.open(szOutFile, std::ios::trunc);
+		if (!ofs.is_open())
+		{
+			fprintf(stderr, "Can not open %s\n", szOutFile);
+			return 1;
+		}
+	}
+
+	const unsigned int unVersion = CHMProbObjBox<unsigned int>().Version();
+	for (auto itSize = vecSize.cbegin(); itSize != vecSize.cend(); itSize++)
+	{
+		for (auto itDist = vecDist.cbegin(); itDist != vecDist.cend(); itDist++)
+		{
+			for (auto itSampling = vecSampling.cbegin(); itSampling != vecSampling.cend(); itSampling++)
+			{
+				std::string strLine = ToJson(RunCase(*itSize, *itDist, *itSampling, dSeconds, unBuildThreadNum), unVersion);
+				printf("%s\n", strLine.c_str());
+				fflush(stdout);
+				if (ofs.is_open()) ofs << strLine << '\n';
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,516 @@
+#pragma once
+#include <algorithm>
+#include <climits>
+#include <iostream>
+#include <vector>
+#include "HMProbObjBoxUtil.h"
+
+//////////////////////////////////////////////////////////////////////////////////////
+// Sampling strategies of CHMProbObjBox.
+enum EHMProbObjBoxSampling
+{
+	eHMProbObjBoxSamplingLinear,	// No index, a draw scans the pool. Nothing to rebuild.
+	eHMProbObjBoxSamplingPrefix,	// Prefix sums of the counts, a draw is a binary search.
+									// The same nRand draws the same object as a linear scan.
+	eHMProbObjBoxSamplingAlias,		// Alias table, a draw is O(1). The distribution is exact
+									// but nRand maps to other objects than a linear scan.
+	eHMProbObjBoxSamplingAliasCompact,	// Alias table with 16-bit thresholds, 6 bytes per object
+									// instead of 8. Exact while total / size < 65535, beyond
+									// that a relative error below 2^-16 per column.
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+// CHMProbObjBoxIndex is the sampling index of a CHMProbObjBox. It maps a random key in
+// [0, total count) to a pool position, and is rebuilt from the counts of the pool.
+//
+// The alias table is exact in integers: with n objects and a total count W, every
+// column holds C = W / n keys. The W / C full columns hold at most two objects each,
+// paired by a sweep over the objects padded with empty ones, and the last W % C keys
+// form a partial column owned entirely by the heaviest object.
+//
+// Both indexes can be built on several threads, each working on a block of the pool.
+// The prefix sums are a blocked scan. For the alias table the columns are split into
+// small and large ones block by block, and the sweep is cut into segments of the small
+// columns: where a segment starts in the large columns follows from the prefix sums of
+// the surplus of the large columns, so every segment is paired on its own thread. The
+// table does not depend on the number of threads.
+//
+// The compact alias table is built the same way and then keeps the thresholds in 16
+// bits. With a column size C of 65535 or more they are stored shifted right by the
+// fewest s bits that make them fit, rounded to nearest, and a key is compared by its
+// offset in the column shifted the same way, so a column moves at most 2^(s-1) of its
+// C >= 2^(15+s) keys to the other object.
+class CHMProbObjBoxIndex
+{
+public:
+	CHMProbObjBoxIndex() : m_eSampling(eHMProbObjBoxSamplingLinear), m_unTotal(0), m_unColumnSize(0), m_unTailProbObj(0), m_unThresholdShift(0) {};
+	~CHMProbObjBoxIndex() {};
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Rebuild this index from the counts of a pool.
+	// vecProbObjPool:A pool of (object, count) pairs, no count should be 0.
+	// unTotal:		The sum of all counts.
+	// eSampling:	The strategy to build for.
+	// unThreadNum:	The most threads to build with, 0 means one per hardware thread. Pools
+	//				too small to gain from it are built on the calling thread only.
+	// Return:		Return true if succeed. If failed, this index is left empty.
+	template <typename TPool>
+	bool Build(const TPool& vecProbObjPool, const unsigned int unTotal, const EHMProbObjBoxSampling eSampling,
+		const unsigned int unThreadNum = 1)
+	{
+		Clear();
+		m_eSampling = eSampling;
+		m_unTotal = unTotal;
+
+		try
+		{
+			const unsigned int unBlockNum = CHMProbObjParallel::GetBlockNum(unThreadNum, vecProbObjPool.size(), m_scunParallelBlockMin);
+			if (eHMProbObjBoxSamplingPrefix == eSampling) BuildPrefix(vecProbObjPool, unBlockNum);
+			else if (eHMProbObjBoxSamplingAlias == eSampling) BuildAlias(vecProbObjPool, unBlockNum);
+			else if (eHMProbObjBoxSamplingAliasCompact == eSampling)
+			{
+				BuildAlias(vecProbObjPool, unBlockNum);
+				CompactThreshold();
+			}
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			Clear();
+			m_eSampling = eSampling;
+			return false;
+		}
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Find the pool position of a random key.
+	// unRandKey:	The key, it must be less than the total count.
+	// Return:		The pool position, or UINT_MAX if this index is empty.
+	unsigned int Find(const unsigned int unRandKey) const
+	{
+		if (eHMProbObjBoxSamplingPrefix == m_eSampling)
+		{
+			auto it = std::upper_bound(m_vecPrefix.cbegin(), m_vecPrefix.cend(), unRandKey);
+			return (m_vecPrefix.cend() == it) ? UINT_MAX : (unsigned int)(it - m_vecPrefix.cbegin());
+		}
+		if (eHMProbObjBoxSamplingAlias == m_eSampling && 0 != m_unColumnSize)
+		{
+			const unsigned int unColumn = unRandKey / m_unColumnSize;
+			if (unColumn >= m_vecThreshold.size()) return m_unTailProbObj;
+			return (unRandKey - unColumn * m_unColumnSize < m_vecThreshold[unColumn]) ? unColumn : m_vecAlias[unColumn];
+		}
+		if (eHMProbObjBoxSamplingAliasCompact == m_eSampling && 0 != m_unColumnSize)
+		{
+			const unsigned int unColumn = unRandKey / m_unColumnSize;
+			if (unColumn >= m_vecAlias.size()) return m_unTailProbObj;
+			return ((unRandKey - unColumn * m_unColumnSize) >> m_unThresholdShift < m_vecCompactThreshold[unColumn]) ? unColumn : m_vecAlias[unColumn];
+		}
+		return UINT_MAX;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Clear this index.
+	// Return:		None.
+	void Clear()
+	{
+		m_eSampling = eHMProbObjBoxSamplingLinear;
+		m_unTotal = 0;
+		m_unColumnSize = 0;
+		m_unTailProbObj = 0;
+		m_unThresholdShift = 0;
+		std::vector<unsigned int>().swap(m_vecPrefix);
+		std::vector<unsigned int>().swap(m_vecThreshold);
+		std::vector<unsigned short>().swap(m_vecCompactThreshold);
+		std::vector<unsigned int>().swap(m_vecAlias);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the strategy this index was built for.
+	EHMProbObjBoxSampling GetSampling() const { return m_eSampling; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the heap memory held by this index, in bytes.
+	size_t GetMemoryUsage() const
+	{
+		return (m_vecPrefix.capacity() + m_vecThreshold.capacity() + m_vecAlias.capacity()) * sizeof(unsigned int)
+			+ m_vecCompactThreshold.capacity() * sizeof(unsigned short);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Write this index in binary. A compact alias table writes its shift after
+	//				the header and its 16-bit thresholds in place of the thresholds.
+	// os:			The binary output stream.
+	// Return:		Return true if succeed, false if failed.
+	bool Save(std::ostream& os) const
+	{
+		const bool bCompact = (eHMProbObjBoxSamplingAliasCompact == m_eSampling);
+		const unsigned int arrHeader[m_scunHeaderLen] = { (unsigned int)m_eSampling, m_unTotal, m_unColumnSize, m_unTailProbObj,
+			(unsigned int)m_vecPrefix.size(), (unsigned int)(bCompact ? m_vecCompactThreshold.size() : m_vecThreshold.size()), (unsigned int)m_vecAlias.size() };
+
+		os.write(reinterpret_cast<const char*>(arrHeader), sizeof(arrHeader));
+		if (bCompact) os.write(reinterpret_cast<const char*>(&m_unThresholdShift), sizeof(m_unThresholdShift));
+		WriteArray(os, m_vecPrefix);
+		if (bCompact) WriteArray(os, m_vecCompactThreshold);
+		else WriteArray(os, m_vecThreshold);
+		WriteArray(os, m_vecAlias);
+		return os.good();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Read an index written by Save, with bulk reads, and check that it is
+	//				an index of the given pool: the array sizes, the positions and the keys
+	//				of every object must match the pool, so a damaged file is rejected
+	//				rather than read out of bounds by Find.
+	// is:			The binary input stream.
+	// vecProbObjPool:The pool the index was built from.
+	// unTotal:		The sum of all counts of the pool.
+	// Return:		Return true if succeed. If failed, this index is left empty.
+	template <typename TPool>
+	bool Load(std::istream& is, const TPool& vecProbObjPool, const unsigned int unTotal)
+	{
+		Clear();
+
+		unsigned int arrHeader[m_scunHeaderLen] = { 0 };
+		if (!is.read(reinterpret_cast<char*>(arrHeader), sizeof(arrHeader))) return false;
+		if (arrHeader[0] > (unsigned int)eHMProbObjBoxSamplingAliasCompact) return false;
+
+		const bool bCompact = (eHMProbObjBoxSamplingAliasCompact == (EHMProbObjBoxSampling)arrHeader[0]);
+		unsigned int unThresholdShift = 0;
+		if (bCompact && (!is.read(reinterpret_cast<char*>(&unThresholdShift), sizeof(unThresholdShift)) || unThresholdShift >= 32)) return false;
+
+		// Sizes a pool of n objects can not have are rejected before anything is allocated,
+		// the alias table has total / (total / n) < 2n columns.
+		const unsigned long long ullProbObjNum = vecProbObjPool.size();
+		if ((0 != arrHeader[4] && ullProbObjNum != arrHeader[4]) || arrHeader[5] >= 2 * ullProbObjNum + 1 || arrHeader[6] >= 2 * ullProbObjNum + 1) return false;
+
+		try
+		{
+			if (!ReadArray(is, m_vecPrefix, arrHeader[4]) || !(bCompact ? ReadArray(is, m_vecCompactThreshold, arrHeader[5]) : ReadArray(is, m_vecThreshold, arrHeader[5]))
+				|| !ReadArray(is, m_vecAlias, arrHeader[6]))
+			{
+				Clear();
+				return false;
+			}
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			Clear();
+			return false;
+		}
+
+		m_eSampling = (EHMProbObjBoxSampling)arrHeader[0];
+		m_unTotal = arrHeader[1];
+		m_unColumnSize = arrHeader[2];
+		m_unTailProbObj = arrHeader[3];
+		m_unThresholdShift = unThresholdShift;
+
+		bool bValid = false;
+		try
+		{
+			bValid = IsIndexOf(vecProbObjPool, unTotal);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+		}
+		if (!bValid) Clear();
+		return bValid;
+	}
+
+private:
+	EHMProbObjBoxSampling m_eSampling;
+	unsigned int m_unTotal;
+	std::vector<unsigned int> m_vecPrefix;
+	unsigned int m_unColumnSize;
+	unsigned int m_unTailProbObj;
+	std::vector<unsigned int> m_vecThreshold;
+	std::vector<unsigned int> m_vecAlias;
+	std::vector<unsigned short> m_vecCompactThreshold;	// Thresholds >> m_unThresholdShift.
+	unsigned int m_unThresholdShift;
+	static const unsigned int m_scunHeaderLen = 7;
+
+	static const unsigned int m_scunParallelBlockMin = 64 * 1024;
+
+	// Tells whether this index could have been built from the pool: the sizes and
+	// positions are in range, and the keys every object gets add up to its count,
+	// exactly for the prefix sums and the alias table, within the rounding for the
+	// compact alias table.
+	template <typename TPool>
+	bool IsIndexOf(const TPool& vecProbObjPool, const unsigned int unTotal) const
+	{
+		const size_t unProbObjNum = vecProbObjPool.size();
+		if (unTotal != m_unTotal) return false;
+
+		if (eHMProbObjBoxSamplingLinear == m_eSampling)
+		{
+			return m_vecPrefix.empty() && m_vecThreshold.empty() && m_vecCompactThreshold.empty() && m_vecAlias.empty();
+		}
+		if (eHMProbObjBoxSamplingPrefix == m_eSampling)
+		{
+			if (m_vecPrefix.size() != unProbObjNum || !m_vecThreshold.empty() || !m_vecCompactThreshold.empty() || !m_vecAlias.empty()) return false;
+
+			unsigned long long ullTop = 0;
+			for (size_t i = 0; i < unProbObjNum; i++)
+			{
+				ullTop += vecProbObjPool[i].second;
+				if (m_vecPrefix[i] != ullTop) return false;
+			}
+			return ullTop == m_unTotal;
+		}
+
+		const bool bCompact = (eHMProbObjBoxSamplingAliasCompact == m_eSampling);
+		if (!m_vecPrefix.empty() || (bCompact ? !m_vecThreshold.empty() : !m_vecCompactThreshold.empty())) return false;
+		if (0 == unProbObjNum || m_unTotal < unProbObjNum)
+		{
+			return 0 == m_unColumnSize && m_vecThreshold.empty() && m_vecCompactThreshold.empty() && m_vecAlias.empty();
+		}
+
+		const unsigned int unColumnNum = m_unTotal / (m_unTotal / (unsigned int)unProbObjNum);
+		const size_t unThresholdNum = bCompact ? m_vecCompactThreshold.size() : m_vecThreshold.size();
+		if (m_unTotal / unProbObjNum != m_unColumnSize || unColumnNum != unThresholdNum || unColumnNum != m_vecAlias.size()) return false;
+		if (m_unTailProbObj >= unProbObjNum) return false;
+
+		unsigned int unThresholdShift = 0, unThresholdMax = m_unColumnSize;
+		if (bCompact)
+		{
+			while ((m_unColumnSize >> unThresholdShift) >= 65535) unThresholdShift++;
+			if (unThresholdShift != m_unThresholdShift) return false;
+			unThresholdMax = (unsigned int)(((unsigned long long)m_unColumnSize + ((0 == unThresholdShift) ? 0 : 1u << (unThresholdShift - 1))) >> unThresholdShift);
+		}
+
+		// The keys every object gets from the columns, and for the compact table the number
+		// of column parts it owns, each of which may be off by half a rounding unit.
+		std::vector<unsigned long long> vecKeyNum(unProbObjNum, 0), vecPartNum(bCompact ? unProbObjNum : 0, 0);
+		for (unsigned int i = 0; i < unColumnNum; i++)
+		{
+			const unsigned int unThreshold = bCompact ? m_vecCompactThreshold[i] : m_vecThreshold[i];
+			if (unThreshold > unThresholdMax || m_vecAlias[i] >= unProbObjNum) return false;
+			if (i >= unProbObjNum && 0 != unThreshold) return false;
+
+			const unsigned int unOwn = bCompact ? (unsigned int)std::min<unsigned long long>(m_unColumnSize, (unsigned long long)unThreshold << unThresholdShift) : unThreshold;
+			if (i < unProbObjNum) vecKeyNum[i] += unOwn;
+			vecKeyNum[m_vecAlias[i]] += m_unColumnSize - unOwn;
+			if (bCompact)
+			{
+				if (i < unProbObjNum) vecPartNum[i]++;
+				vecPartNum[m_vecAlias[i]]++;
+			}
+		}
+		vecKeyNum[m_unTailProbObj] += m_unTotal - (unsigned long long)unColumnNum * m_unColumnSize;
+
+		const unsigned long long ullHalfUnit = (1ull << unThresholdShift) >> 1;
+		for (size_t i = 0; i < unProbObjNum; i++)
+		{
+			const unsigned long long ullCount = vecProbObjPool[i].second;
+			const unsigned long long ullError = (vecKeyNum[i] > ullCount) ? vecKeyNum[i] - ullCount : ullCount - vecKeyNum[i];
+			if (ullError > (bCompact ? vecPartNum[i] * ullHalfUnit : 0)) return false;
+		}
+		return true;
+	}
+
+	// Exclusive scan of per block sums, returns the total.
+	template <typename TSum>
+	static TSum ScanBlockSums(std::vector<TSum>& vecBlockSum)
+	{
+		TSum tTop = 0;
+		for (auto it = vecBlockSum.begin(); it != vecBlockSum.end(); it++)
+		{
+			const TSum tSum = *it;
+			*it = tTop;
+			tTop += tSum;
+		}
+		return tTop;
+	}
+
+	template <typename TPool>
+	void BuildPrefix(const TPool& vecProbObjPool, const unsigned int unBlockNum)
+	{
+		const size_t unProbObjNum = vecProbObjPool.size();
+		m_vecPrefix.resize(unProbObjNum);
+
+		if (1 == unBlockNum)
+		{
+			unsigned int unTop = 0;
+			for (size_t i = 0; i < unProbObjNum; i++)
+			{
+				unTop += vecProbObjPool[i].second;
+				m_vecPrefix[i] = unTop;
+			}
+			return;
+		}
+
+		// Every block sums its counts, then fills its prefix sums starting from the sum of
+		// the blocks before it.
+		std::vector<unsigned int> vecBlockSum(unBlockNum, 0);
+		CHMProbObjParallel::Run(unBlockNum, [&](const unsigned int unBlock)
+			{
+				unsigned int unSum = 0;
+				for (unsigned int i = CHMProbObjParallel::GetBlockBegin(unProbObjNum, unBlockNum, unBlock); i < CHMProbObjParallel::GetBlockBegin(unProbObjNum, unBlockNum, unBlock + 1); i++)
+				{
+					unSum += vecProbObjPool[i].second;
+				}
+				vecBlockSum[unBlock] = unSum;
+			});
+		ScanBlockSums(vecBlockSum);
+		CHMProbObjParallel::Run(unBlockNum, [&](const unsigned int unBlock)
+			{
+				unsigned int unTop = vecBlockSum[unBlock];
+				for (unsigned int i = CHMProbObjParallel::GetBlockBegin(unProbObjNum, unBlockNum, unBlock); i < CHMProbObjParallel::GetBlockBegin(unProbObjNum, unBlockNum, unBlock + 1); i++)
+				{
+					unTop += vecProbObjPool[i].second;
+					m_vecPrefix[i] = unTop;
+				}
+			});
+	}
+
+	template <typename TPool>
+	void BuildAlias(const TPool& vecProbObjPool, const unsigned int unBlockNum)
+	{
+		const unsigned int unProbObjNum = (unsigned int)vecProbObjPool.size();
+		if (0 == unProbObjNum || m_unTotal < unProbObjNum) return;
+
+		const unsigned int unColumnSize = m_unTotal / unProbObjNum;
+		const unsigned int unColumnNum = m_unTotal / unColumnSize;
+		const unsigned int unTail = m_unTotal - unColumnNum * unColumnSize;
+		m_unColumnSize = unColumnSize;
+
+		// Copy the weights, padded with empty objects up to unColumnNum, and find the first
+		// heaviest object and the small columns of every block.
+		std::vector<unsigned int> vecWeight(unColumnNum);
+		std::vector<unsigned int> vecBlockHeaviest(unBlockNum, 0), vecBlockSmallNum(unBlockNum, 0);
+		m_vecThreshold.resize(unColumnNum);
+		m_vecAlias.resize(unColumnNum);
+		CHMProbObjParallel::Run(unBlockNum, [&](const unsigned int unBlock)
+			{
+				const unsigned int unBegin = CHMProbObjParallel::GetBlockBegin(unColumnNum, unBlockNum, unBlock);
+				unsigned int unHeaviest = unBegin, unSmallNum = 0;
+				for (unsigned int i = unBegin; i < CHMProbObjParallel::GetBlockBegin(unColumnNum, unBlockNum, unBlock + 1); i++)
+				{
+					vecWeight[i] = (i < unProbObjNum) ? vecProbObjPool[i].second : 0;
+					if (vecWeight[i] > vecWeight[unHeaviest]) unHeaviest = i;
+					if (vecWeight[i] < unColumnSize) unSmallNum++;
+					m_vecThreshold[i] = unColumnSize;
+					m_vecAlias[i] = i;
+				}
+				vecBlockHeaviest[unBlock] = unHeaviest;
+				vecBlockSmallNum[unBlock] = unSmallNum;
+			});
+
+		// The heaviest object owns the tail keys, it has at least C >= unTail keys, and may
+		// be left with a small column.
+		unsigned int unHeaviestBlock = 0;
+		for (unsigned int i = 1; i < unBlockNum; i++)
+		{
+			if (vecWeight[vecBlockHeaviest[i]] > vecWeight[vecBlockHeaviest[unHeaviestBlock]]) unHeaviestBlock = i;
+		}
+		m_unTailProbObj = vecBlockHeaviest[unHeaviestBlock];
+		vecWeight[m_unTailProbObj] -= unTail;
+		if (vecWeight[m_unTailProbObj] < unColumnSize) vecBlockSmallNum[unHeaviestBlock]++;
+
+		const unsigned int unSmallNum = ScanBlockSums(vecBlockSmallNum);
+		std::vector<unsigned int> vecSmall(unSmallNum), vecLarge(unColumnNum - unSmallNum);
+		CHMProbObjParallel::Run(unBlockNum, [&](const unsigned int unBlock)
+			{
+				const unsigned int unBegin = CHMProbObjParallel::GetBlockBegin(unColumnNum, unBlockNum, unBlock);
+				unsigned int unSmall = vecBlockSmallNum[unBlock], unLarge = unBegin - unSmall;
+				for (unsigned int i = unBegin; i < CHMProbObjParallel::GetBlockBegin(unColumnNum, unBlockNum, unBlock + 1); i++)
+				{
+					if (vecWeight[i] < unColumnSize) vecSmall[unSmall++] = i;
+					else vecLarge[unLarge++] = i;
+				}
+			});
+		if (vecSmall.empty() || vecLarge.empty()) return;
+
+		// vecSurplus[j] is the surplus of the large columns before j, and vecDemand[b] the
+		// deficit of the small columns before segment b.
+		std::vector<unsigned long long> vecSurplus(vecLarge.size() + 1, 0), vecBlockSurplus(unBlockNum, 0), vecDemand(unBlockNum, 0);
+		CHMProbObjParallel::Run(unBlockNum, [&](const unsigned int unBlock)
+			{
+				unsigned long long ullSum = 0;
+				for (unsigned int i = CHMProbObjParallel::GetBlockBegin(vecLarge.size(), unBlockNum, unBlock); i < CHMProbObjParallel::GetBlockBegin(vecLarge.size(), unBlockNum, unBlock + 1); i++)
+				{
+					ullSum += vecWeight[vecLarge[i]] - unColumnSize;
+				}
+				vecBlockSurplus[unBlock] = ullSum;
+
+				ullSum = 0;
+				for (unsigned int i = CHMProbObjParallel::GetBlockBegin(vecSmall.size(), unBlockNum, unBlock); i < CHMProbObjParallel::GetBlockBegin(vecSmall.size(), unBlockNum, unBlock + 1); i++)
+				{
+					ullSum += unColumnSize - vecWeight[vecSmall[i]];
+				}
+				vecDemand[unBlock] = ullSum;
+			});
+		ScanBlockSums(vecBlockSurplus);
+		ScanBlockSums(vecDemand);
+		CHMProbObjParallel::Run(unBlockNum, [&](const unsigned int unBlock)
+			{
+				unsigned long long ullTop = vecBlockSurplus[unBlock];
+				for (unsigned int i = CHMProbObjParallel::GetBlockBegin(vecLarge.size(), unBlockNum, unBlock); i < CHMProbObjParallel::GetBlockBegin(vecLarge.size(), unBlockNum, unBlock + 1); i++)
+				{
+					ullTop += vecWeight[vecLarge[i]] - unColumnSize;
+					vecSurplus[i + 1] = ullTop;
+				}
+			});
+
+		// The sweep serves the small columns in order from the first large column with
+		// surplus left. A large column left with less than C keys becomes small and is
+		// served by the next large column. Before small column k it is at the first large
+		// column j whose surplus up to and including j covers the deficit before k, with
+		// that surplus minus the deficit plus C keys left.
+		CHMProbObjParallel::Run(unBlockNum, [&](const unsigned int unBlock)
+			{
+				const unsigned int unBegin = CHMProbObjParallel::GetBlockBegin(vecSmall.size(), unBlockNum, unBlock);
+				const unsigned int unEnd = CHMProbObjParallel::GetBlockBegin(vecSmall.size(), unBlockNum, unBlock + 1);
+				if (unBegin == unEnd) return;
+
+				size_t unLarge = std::lower_bound(vecSurplus.cbegin() + 1, vecSurplus.cend(), vecDemand[unBlock]) - (vecSurplus.cbegin() + 1);
+				unLarge = std::min(unLarge, vecLarge.size() - 1);
+				unsigned long long ullLeft = vecSurplus[unLarge + 1] - vecDemand[unBlock] + unColumnSize;
+				for (unsigned int i = unBegin; i < unEnd; i++)
+				{
+					const unsigned int unSmall = vecSmall[i];
+					m_vecThreshold[unSmall] = vecWeight[unSmall];
+					m_vecAlias[unSmall] = vecLarge[unLarge];
+					ullLeft -= unColumnSize - vecWeight[unSmall];
+					while (ullLeft < unColumnSize && unLarge + 1 < vecLarge.size())
+					{
+						m_vecThreshold[vecLarge[unLarge]] = (unsigned int)ullLeft;
+						m_vecAlias[vecLarge[unLarge]] = vecLarge[unLarge + 1];
+						ullLeft += vecWeight[vecLarge[unLarge + 1]] - unColumnSize;
+						unLarge++;
+					}
+				}
+			});
+	}
+
+	// Moves the thresholds of BuildAlias into 16 bits, rounded to nearest. With the fewest
+	// s such that C >> s < 65535 no rounded threshold exceeds 65535.
+	void CompactThreshold()
+	{
+		m_unThresholdShift = 0;
+		while ((m_unColumnSize >> m_unThresholdShift) >= 65535) m_unThresholdShift++;
+
+		const unsigned int unHalf = (0 == m_unThresholdShift) ? 0 : 1u << (m_unThresholdShift - 1);
+		m_vecCompactThreshold.resize(m_vecThreshold.size());
+		for (size_t i = 0; i < m_vecThreshold.size(); i++)
+		{
+			m_vecCompactThreshold[i] = (unsigned short)(((unsigned long long)m_vecThreshold[i] + unHalf) >> m_unThresholdShift);
+		}
+		std::vector<unsigned int>().swap(m_vecThreshold);
+	}
+
+	template <typename TValue>
+	static void WriteArray(std::ostream& os, const std::vector<TValue>& vecArray)
+	{
+		if (!vecArray.empty()) os.write(reinterpret_cast<const char*>(vecArray.data()), vecArray.size() * sizeof(TValue));
+	}
+
+	template <typename TValue>
+	static bool ReadArray(std::istream& is, std::vector<TValue>& vecArray, const unsigned int unLen)
+	{
+		vecArray.resize(unLen);
+		return 0 == unLen || (bool)is.read(reinterpret_cast<char*>(vecArray.data()), (size_t)unLen * sizeof(TValue));
+	}
+};
@@ -0,0 +1,357 @@
+#pragma once
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <unordered_set>
+#include <vector>
+#include "HMProbObjBox.h"
+
+//////////////////////////////////////////////////////////////////////////////////////
+// CHMProbObjFieldParser is the default key parser of CHMProbObjBoxLoader. It parses
+// integral keys in decimal and builds any other key from (const char*, size_t), which
+// covers std::string. Other key types need a user-defined parser with the same call
+// signature.
+template <typename T1>
+struct CHMProbObjFieldParser
+{
+	bool operator()(const char* const pField, const size_t unLen, T1& t1ProbObj) const
+	{
+		return Parse(pField, unLen, t1ProbObj, std::is_integral<T1>());
+	}
+
+private:
+	static bool Parse(const char* const pField, const size_t unLen, T1& t1ProbObj, std::true_type)
+	{
+		size_t i = 0;
+		bool bNegative = false;
+		if (i < unLen && ('-' == pField[i] || '+' == pField[i]))
+		{
+			bNegative = ('-' == pField[i]);
+			if (bNegative && !std::is_signed<T1>::value) return false;
+			i++;
+		}
+		if (i == unLen) return false;
+
+		// Checked before the multiply, which would wrap for 64-bit keys.
+		const unsigned long long ullMax = (unsigned long long)std::numeric_limits<T1>::max() + (bNegative ? 1 : 0);
+		unsigned long long ullValue = 0;
+		for (; i < unLen; i++)
+		{
+			if (pField[i] < '0' || pField[i] > '9') return false;
+			const unsigned int unDigit = pField[i] - '0';
+			if (ullValue > (ullMax - unDigit) / 10) return false;
+			ullValue = ullValue * 10 + unDigit;
+		}
+		t1ProbObj = bNegative ? (T1)(0 - ullValue) : (T1)ullValue;
+		return true;
+	}
+
+	static bool Parse(const char* const pField, const size_t unLen, T1& t1ProbObj, std::false_type)
+	{
+		static_assert(std::is_constructible<T1, const char*, size_t>::value, "CHMProbObjFieldParser can not parse this T1, use your own parser.");
+		t1ProbObj = T1(pField, unLen);
+		return true;
+	}
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+// CHMProbObjBoxLoader streams a CSV/TSV table into a CHMProbObjBox. The input is read
+// in fixed-size chunks and each line goes straight into the box, so memory is bounded
+// by the chunk size (or the longest line) plus the box itself, and in unique-keys mode
+// a hash set of the keys, see SetUniqueKeys. Fields are split on a single delimiter
+// character; surrounding blanks and double quotes are stripped, but quoted fields must
+// not contain the delimiter or line breaks.
+template <typename T1>
+class CHMProbObjBoxLoader
+{
+public:
+	CHMProbObjBoxLoader() : m_chDelimiter(','), m_unKeyColumn(0), m_unCountColumn(1), m_bHasHeader(false),
+		m_bUniqueKeys(false), m_unChunkSize(m_scunDefaultChunkSize), m_bHeaderSkipped(false), m_ullLineNum(0), m_ullBadLineNum(0) {};
+	~CHMProbObjBoxLoader() {};
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Set the field delimiter, ',' for CSV (default) or '\t' for TSV.
+	void SetDelimiter(const char chDelimiter) { m_chDelimiter = chDelimiter; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Set which columns, counted from 0, hold the key and the count.
+	//				Default key column 0 and count column 1.
+	void SetColumns(const unsigned int unKeyColumn, const unsigned int unCountColumn)
+	{
+		m_unKeyColumn = unKeyColumn;
+		m_unCountColumn = unCountColumn;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Set whether the first line which is not blank is a header which should
+	//				be skipped.
+	void SetHasHeader(const bool bHasHeader) { m_bHasHeader = bHasHeader; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Set whether every key appears only once in the table, default false.
+	//				By default every line goes through CHMProbObjBox::Modify, which replaces
+	//				the count of a key seen before but scans the pool first, so a Load is
+	//				O(n^2). Unique keys are appended with CHMProbObjBox::Append in O(1), and a
+	//				key already in the box or seen before is a bad line. That takes a hash
+	//				set of all keys of the box during the Load, O(number of keys) memory on
+	//				top of the box. For a T1 without std::hash unique keys still go through
+	//				Modify, O(n^2) as well.
+	void SetUniqueKeys(const bool bUniqueKeys) { m_bUniqueKeys = bUniqueKeys; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Set the size in bytes of each chunk read from the input.
+	void SetChunkSize(const unsigned int unChunkSize) { m_unChunkSize = (0 == unChunkSize) ? m_scunDefaultChunkSize : unChunkSize; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the number of lines read and the number of lines skipped because
+	//				they were malformed, by the last Load.
+	unsigned long long GetLineNum() const { return m_ullLineNum; }
+	unsigned long long GetBadLineNum() const { return m_ullBadLineNum; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Load a table from a stream into a box. Lines are added on top of the
+	//				current content of the box, and a count the count type of the box can
+	//				not hold is a bad line. An eager box is lazy during the Load, and the
+	//				sampling index is rebuilt once at the end.
+	// is:			The input stream.
+	// t1ProbObjBox:The box to fill.
+	// fnParseKey:	bool(const char* pField, size_t unLen, T1& t1ProbObj), parses a key field.
+	// fnProgress:	void(unsigned long long ullBytesRead, unsigned long long ullBytesTotal,
+	//				unsigned long long ullLineNum), called after every chunk. ullBytesTotal is
+	//				0 if unknown.
+	// ullBytesTotal:The size of the input if known, only passed to fnProgress.
+	// Return:		Return true if the whole input was read, false if a read error occurred.
+	template <typename TWeight, typename TParser = CHMProbObjFieldParser<T1>, typename TProgress = void (*)(unsigned long long, unsigned long long, unsigned long long)>
+	bool Load(std::istream& is, CHMProbObjBox<T1, TWeight>& t1ProbObjBox, TParser fnParseKey = TParser(), TProgress fnProgress = NULL,
+		const unsigned long long ullBytesTotal = 0)
+	{
+		const bool bEager = (eHMProbObjBoxRebuildEager == t1ProbObjBox.GetRebuildPolicy());
+		if (bEager) t1ProbObjBox.SetRebuildPolicy(eHMProbObjBoxRebuildLazy);
+		const bool bSucceed = LoadLines(is, t1ProbObjBox, fnParseKey, fnProgress, ullBytesTotal);
+		if (bEager) t1ProbObjBox.SetRebuildPolicy(eHMProbObjBoxRebuildEager);
+		t1ProbObjBox.Commit();
+		return bSucceed;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Load a table file into a box, see the stream version of Load.
+	// szFileName:	The file to read.
+	template <typename TWeight, typename TParser = CHMProbObjFieldParser<T1>, typename TProgress = void (*)(unsigned long long, unsigned long long, unsigned long long)>
+	bool Load(const char* const szFileName, CHMProbObjBox<T1, TWeight>& t1ProbObjBox, TParser fnParseKey = TParser(), TProgress fnProgress = NULL)
+	{
+		if (NULL == szFileName) return false;
+
+		std::ifstream ifs(szFileName, std::ios::binary | std::ios::ate);
+		if (!ifs.is_open()) return false;
+
+		const unsigned long long ullBytesTotal = (unsigned long long)ifs.tellg();
+		ifs.seekg(0);
+		return Load(ifs, t1ProbObjBox, fnParseKey, fnProgress, ullBytesTotal);
+	}
+
+private:
+	char m_chDelimiter;
+	unsigned int m_unKeyColumn;
+	unsigned int m_unCountColumn;
+	bool m_bHasHeader;
+	bool m_bUniqueKeys;
+	unsigned int m_unChunkSize;
+	bool m_bHeaderSkipped;
+	unsigned long long m_ullLineNum;
+	unsigned long long m_ullBadLineNum;
+	static const unsigned int m_scunDefaultChunkSize = 1 << 20;
+
+	// The keys in the box during a Load in unique-keys mode, unused without std::hash.
+	typedef typename std::conditional<CHMProbObjIsHashable<T1>::value, std::unordered_set<T1>, char>::type TKeySet;
+
+	template <typename TWeight, typename TParser, typename TProgress>
+	bool LoadLines(std::istream& is, CHMProbObjBox<T1, TWeight>& t1ProbObjBox, TParser& fnParseKey, TProgress& fnProgress,
+		const unsigned long long ullBytesTotal)
+	{
+		m_bHeaderSkipped = false;
+		m_ullLineNum = 0;
+		m_ullBadLineNum = 0;
+
+		std::vector<char> vecChunk;
+		TKeySet setKey;
+		try
+		{
+			vecChunk.resize(m_unChunkSize);
+			if (m_bUniqueKeys) InsertKeys(setKey, t1ProbObjBox, CHMProbObjIsHashable<T1>());
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			return false;
+		}
+
+		unsigned long long ullBytesRead = 0;
+		size_t unCarry = 0;
+		bool bEnd = false;
+		while (!bEnd)
+		{
+			// A line longer than the whole chunk grows the chunk.
+			if (unCarry == vecChunk.size()) vecChunk.resize(vecChunk.size() * 2);
+
+			is.read(vecChunk.data() + unCarry, vecChunk.size() - unCarry);
+			const size_t unRead = (size_t)is.gcount();
+			if (is.bad()) return false;
+			bEnd = (0 == unRead || is.eof());
+			ullBytesRead += unRead;
+
+			const char* pBegin = vecChunk.data();
+			const char* const pEnd = vecChunk.data() + unCarry + unRead;
+			for (const char* pLineEnd = (const char*)memchr(pBegin, '\n', pEnd - pBegin); NULL != pLineEnd;
+				pLineEnd = (const char*)memchr(pBegin, '\n', pEnd - pBegin))
+			{
+				ParseLine(pBegin, pLineEnd, t1ProbObjBox, fnParseKey, setKey);
+				pBegin = pLineEnd + 1;
+			}
+
+			unCarry = pEnd - pBegin;
+			if (bEnd && 0 != unCarry)
+			{
+				ParseLine(pBegin, pEnd, t1ProbObjBox, fnParseKey, setKey);
+				unCarry = 0;
+			}
+			else if (0 != unCarry && pBegin != vecChunk.data())
+			{
+				memmove(vecChunk.data(), pBegin, unCarry);
+			}
+
+			ReportProgress(fnProgress, ullBytesRead, ullBytesTotal, m_ullLineNum);
+		}
+		return true;
+	}
+
+	template <typename TWeight, typename TParser>
+	void ParseLine(const char* pBegin, const char* pEnd, CHMProbObjBox<T1, TWeight>& t1ProbObjBox, TParser& fnParseKey, TKeySet& setKey)
+	{
+		m_ullLineNum++;
+		if (pEnd > pBegin && '\r' == pEnd[-1]) pEnd--;
+		if (pBegin == pEnd) return;
+		if (m_bHasHeader && !m_bHeaderSkipped)
+		{
+			m_bHeaderSkipped = true;
+			return;
+		}
+
+		const char* pKeyField = NULL, * pKeyFieldEnd = NULL, * pCountField = NULL, * pCountFieldEnd = NULL;
+		unsigned int unColumn = 0;
+		for (const char* pField = pBegin; NULL == pKeyField || NULL == pCountField; unColumn++)
+		{
+			const char* pFieldEnd = (const char*)memchr(pField, m_chDelimiter, pEnd - pField);
+			if (NULL == pFieldEnd) pFieldEnd = pEnd;
+
+			if (unColumn == m_unKeyColumn)
+			{
+				pKeyField = pField;
+				pKeyFieldEnd = pFieldEnd;
+			}
+			if (unColumn == m_unCountColumn)
+			{
+				pCountField = pField;
+				pCountFieldEnd = pFieldEnd;
+			}
+
+			if (pFieldEnd == pEnd) break;
+			pField = pFieldEnd + 1;
+		}
+
+		T1 t1ProbObj;
+		unsigned int unCount = 0;
+		if (NULL == pKeyField || NULL == pCountField) return BadLine();
+
+		TrimField(pKeyField, pKeyFieldEnd);
+		TrimField(pCountField, pCountFieldEnd);
+		if (!ParseCount(pCountField, pCountFieldEnd, unCount) || unCount > std::numeric_limits<TWeight>::max()) return BadLine();
+		if (!fnParseKey(pKeyField, (size_t)(pKeyFieldEnd - pKeyField), t1ProbObj)) return BadLine();
+
+		if (m_bUniqueKeys)
+		{
+			if (0 != unCount) AppendUnique(t1ProbObjBox, t1ProbObj, unCount, setKey, CHMProbObjIsHashable<T1>());
+		}
+		else
+		{
+			t1ProbObjBox.Modify(&t1ProbObj, &unCount);
+		}
+	}
+
+	void BadLine() { m_ullBadLineNum++; }
+
+	template <typename TWeight>
+	static void InsertKeys(TKeySet& setKey, const CHMProbObjBox<T1, TWeight>& t1ProbObjBox, std::true_type)
+	{
+		setKey.reserve(t1ProbObjBox.GetPool().size());
+		for (auto it = t1ProbObjBox.GetPool().cbegin(); it != t1ProbObjBox.GetPool().cend(); it++) setKey.insert(it->first);
+	}
+
+	template <typename TWeight>
+	static void InsertKeys(TKeySet&, const CHMProbObjBox<T1, TWeight>&, std::false_type) {}
+
+	template <typename TWeight>
+	void AppendUnique(CHMProbObjBox<T1, TWeight>& t1ProbObjBox, const T1& t1ProbObj, const unsigned int unCount, TKeySet& setKey, std::true_type)
+	{
+		try
+		{
+			if (!setKey.insert(t1ProbObj).second) return BadLine();
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			return BadLine();
+		}
+		if (!t1ProbObjBox.Append(t1ProbObj, unCount))
+		{
+			setKey.erase(t1ProbObj);
+			BadLine();
+		}
+	}
+
+	template <typename TWeight>
+	void AppendUnique(CHMProbObjBox<T1, TWeight>& t1ProbObjBox, const T1& t1ProbObj, unsigned int unCount, TKeySet&, std::false_type)
+	{
+		t1ProbObjBox.Modify(&t1ProbObj, &unCount);
+	}
+
+	template <typename TProgress>
+	static void ReportProgress(TProgress& fnProgress, const unsigned long long ullBytesRead, const unsigned long long ullBytesTotal,
+		const unsigned long long ullLineNum)
+	{
+		fnProgress(ullBytesRead, ullBytesTotal, ullLineNum);
+	}
+
+	static void ReportProgress(void (*fnProgress)(unsigned long long, unsigned long long, unsigned long long),
+		const unsigned long long ullBytesRead, const unsigned long long ullBytesTotal, const unsigned long long ullLineNum)
+	{
+		if (NULL != fnProgress) fnProgress(ullBytesRead, ullBytesTotal, ullLineNum);
+	}
+
+	static void TrimField(const char*& pField, const char*& pFieldEnd)
+	{
+		while (pField < pFieldEnd && (' ' == *pField || '\t' == *pField)) pField++;
+		while (pField < pFieldEnd && (' ' == pFieldEnd[-1] || '\t' == pFieldEnd[-1])) pFieldEnd--;
+		if (pFieldEnd - pField >= 2 && '"' == *pField && '"' == pFieldEnd[-1])
+		{
+			pField++;
+			pFieldEnd--;
+		}
+	}
+
+	static bool ParseCount(const char* pField, const char* const pFieldEnd, unsigned int& unCount)
+	{
+		if (pField == pFieldEnd) return false;
+
+		unsigned long long ullCount = 0;
+		for (; pField < pFieldEnd; pField++)
+		{
+			if (*pField < '0' || *pField > '9') return false;
+			ullCount = ullCount * 10 + (*pField - '0');
+			if (ullCount > UINT_MAX) return false;
+		}
+		unCount = (unsigned int)ullCount;
+		return true;
+	}
+};
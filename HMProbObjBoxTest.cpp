@@ -0,0 +1,1935 @@
+//////////////////////////////////////////////////////////////////////////////////////
+// Tests of CHMProbObjBox and its companions, with no dependency but the standard library.
+// Build:	g++ -O2 -std=c++17 -pthread HMProbObjBoxTest.cpp -o HMProbObjBoxTest
+// Usage:	HMProbObjBoxTest
+// Built with -std=c++20 it also tests Draws.
+// Every failed check prints its line, and the exit code is 1 if any check failed.
+//////////////////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <random>
+#if __cplusplus >= 202002L
+#include <ranges>
+#endif
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "HMDenseProbObjBox.h"
+#include "HMFixedProbObjBox.h"
+#include "HMProbObjBox.h"
+#include "HMProbObjBoxLoader.h"
+#include "HMProbObjBoxVerify.h"
+#include "HMProbObjBoxView.h"
+#include "HMProbObjOverlayBox.h"
+#include "HMProbObjPityBox.h"
+#include "HMProbObjRegistry.h"
+#include "HMProbObjScheduleBox.h"
+#include "HMProbObjSimulator.h"
+#include "HMProbObjTreeBox.h"
+#include "HMProbObjVersionedBox.h"
+
+static unsigned int s_unCheckNum = 0;
+static unsigned int s_unFailNum = 0;
+
+#define HM_TEST_CHECK(bCond) CheckTest((bCond), #bCond, __LINE__)
+
+static void CheckTest(const bool bCond, const char* const szCond, const int nLine)
+{
+	s_unCheckNum++;
+	if (bCond) return;
+
+	s_unFailNum++;
+	printf("%s(%d), check failed: %s\n", __FILE__, nLine, szCond);
+}
+
+// The nRand of the draws compared by IsSameDraw: every key of a small box once, then
+// values spread over the positive ints.
+static int GetTestRand(const unsigned int i)
+{
+	return (i < 4096) ? (int)i : (int)((i * 2654435761u) >> 1);
+}
+
+// Whether a box draws the same object as a CHMProbObjBox for the same nRand, and fails
+// where it fails.
+template <typename TBox>
+static bool IsSameDraw(TBox& stBox, CHMProbObjBox<int>& stReference)
+{
+	if (stBox.GetCount() != stReference.GetCount()) return false;
+
+	for (unsigned int i = 0; i < 6000; i++)
+	{
+		int nProbObj = -1, nReference = -1;
+		const int nRand = GetTestRand(i);
+		const bool bDrawn = stBox.Draw(nProbObj, nRand);
+		if (bDrawn != stReference.Draw(nReference, nRand) || nProbObj != nReference) return false;
+	}
+	return true;
+}
+
+// Fills a box with unProbObjNum objects 0, 1, ... with counts in [1, unCountMax].
+template <typename TWeight>
+static void FillBox(CHMProbObjBox<int, TWeight>& stBox, const unsigned int unProbObjNum, const unsigned int unCountMax, const unsigned int unSeed)
+{
+	std::mt19937 rng(unSeed);
+	for (unsigned int i = 0; i < unProbObjNum; i++) stBox.Append((int)i, 1 + rng() % unCountMax);
+	stBox.Commit();
+}
+
+// Whether two boxes hold the same pool and draw the same object for the same nRand.
+static bool IsSameBox(CHMProbObjBox<int>& stLeft, CHMProbObjBox<int>& stRight)
+{
+	return stLeft.GetPool() == stRight.GetPool() && IsSameDraw(stLeft, stRight);
+}
+
+// Loads a snapshot into a box holding one object, and checks a failed Load left it so.
+static bool LoadSnapshot(const std::string& strSnapshot)
+{
+	CHMProbObjBox<int> stBox;
+	const int nProbObj = -7;
+	const unsigned int unCount = 3;
+	stBox.Modify(&nProbObj, &unCount);
+
+	std::stringstream ss(strSnapshot);
+	if (stBox.Load(ss)) return true;
+
+	HM_TEST_CHECK(1 == stBox.GetPool().size() && 3 == stBox.GetCount(&nProbObj) && 3 == stBox.GetCount());
+	return false;
+}
+
+static void SetSnapshotWord(std::string& strSnapshot, const size_t unOffset, const unsigned int unValue)
+{
+	memcpy(&strSnapshot[unOffset], &unValue, sizeof(unValue));
+}
+
+static unsigned int GetSnapshotWord(const std::string& strSnapshot, const size_t unOffset)
+{
+	unsigned int unValue = 0;
+	memcpy(&unValue, &strSnapshot[unOffset], sizeof(unValue));
+	return unValue;
+}
+
+static std::string ReadFile(const char* const szFileName)
+{
+	std::ifstream ifs(szFileName, std::ios::binary);
+	std::ostringstream oss;
+	oss << ifs.rdbuf();
+	return oss.str();
+}
+
+static void WriteFile(const char* const szFileName, const std::string& strData)
+{
+	std::ofstream ofs(szFileName, std::ios::binary | std::ios::trunc);
+	ofs.write(strData.data(), strData.size());
+}
+
+static void SetFileWord(std::string& strData, const size_t unOffset, const unsigned long long ullValue)
+{
+	memcpy(&strData[unOffset], &ullValue, sizeof(ullValue));
+}
+
+static void TestFixedBox()
+{
+	// Entries, replaced counts and removals in the same order as in a CHMProbObjBox.
+	std::mt19937 rng(26);
+	for (unsigned int t = 0; t < 50; t++)
+	{
+		CHMFixedProbObjBox<int, 8> stFixed;
+		CHMProbObjBox<int> stReference;
+		bool bSame = true;
+		for (unsigned int i = 0; i < 40 && bSame; i++)
+		{
+			const int nProbObj = (int)(rng() % 8);
+			const unsigned int unCount = (0 == rng() % 4) ? 0 : 1 + rng() % 100;
+			stFixed.Modify(&nProbObj, &unCount);
+			stReference.Modify(&nProbObj, &unCount);
+			bSame = stFixed.GetSize() == stReference.GetPool().size() && stFixed.GetCount(&nProbObj) == stReference.GetCount(&nProbObj)
+				&& IsSameDraw(stFixed, stReference);
+		}
+		HM_TEST_CHECK(bSame);
+	}
+
+	// An empty box, a new object with count 0, and a draw with a negative nRand.
+	CHMFixedProbObjBox<int, 4> stFixed;
+	int nProbObj = -1;
+	const int arrProbObj[] = { 1, 2, 3, 4, 5 };
+	const unsigned int arrCount[] = { 0, 2, 3, 4, 5 };
+	HM_TEST_CHECK(!stFixed.Draw(nProbObj, 0) && 0 == stFixed.GetCount());
+	stFixed.Modify(arrProbObj, arrCount, 1);
+	HM_TEST_CHECK(0 == stFixed.GetSize() && 0 == stFixed.GetCount());
+
+	// Objects beyond the capacity are ignored.
+	stFixed.Modify(arrProbObj, arrCount, 5);
+	HM_TEST_CHECK(4 == stFixed.GetSize() && 14 == stFixed.GetCount() && 0 == stFixed.GetCount(&arrProbObj[0]));
+	HM_TEST_CHECK(!stFixed.Draw(nProbObj, -2));
+	HM_TEST_CHECK(stFixed.Draw(nProbObj, 13) && 5 == nProbObj);
+
+	// A count which would take the total past UINT_MAX is ignored, as in CHMProbObjBox.
+	CHMFixedProbObjBox<int, 4> stFull;
+	CHMProbObjBox<int> stReference;
+	const unsigned int arrBigCount[] = { UINT_MAX - 10, 10, 9, UINT_MAX };
+	for (unsigned int i = 0; i < 4; i++)
+	{
+		stFull.Modify(&arrProbObj[i], &arrBigCount[i]);
+		stReference.Modify(&arrProbObj[i], &arrBigCount[i]);
+		HM_TEST_CHECK(stFull.GetCount() == stReference.GetCount() && stFull.GetSize() == stReference.GetPool().size());
+	}
+	HM_TEST_CHECK(UINT_MAX - 1 == stFull.GetCount() && IsSameDraw(stFull, stReference));
+
+	// Clear empties the box, and Dump writes the lines of CHMProbObjBox::Dump.
+	std::ostringstream ossFixed, ossReference;
+	stFull.Dump(ossFixed);
+	stReference.Dump(ossReference);
+	const std::string strFixed = ossFixed.str(), strReference = ossReference.str();
+	HM_TEST_CHECK(strFixed.substr(strFixed.find("\nProbability object index")) == strReference.substr(strReference.find("\nProbability object index")));
+	stFull.Clear();
+	HM_TEST_CHECK(0 == stFull.GetCount() && 0 == stFull.GetSize() && !stFull.Draw(nProbObj, 0));
+}
+
+static void TestSnapshot()
+{
+	// Round trips of small and big pools, and of an empty box.
+	for (unsigned int unProbObjNum = 1; unProbObjNum <= 3001; unProbObjNum += 1500)
+	{
+		CHMProbObjBox<int> stBox, stLoaded;
+		FillBox(stBox, unProbObjNum, 1000, unProbObjNum);
+
+		std::stringstream ss;
+		HM_TEST_CHECK(stBox.Save(ss));
+		HM_TEST_CHECK(stLoaded.Load(ss));
+		HM_TEST_CHECK(IsSameBox(stBox, stLoaded));
+	}
+
+	CHMProbObjBox<int> stEmpty, stLoaded;
+	std::stringstream ssEmpty;
+	HM_TEST_CHECK(stEmpty.Save(ssEmpty) && stLoaded.Load(ssEmpty) && 0 == stLoaded.GetCount() && stLoaded.GetPool().empty());
+
+	// Snapshot layout: 8 header words, magic, version, key size, pair size, size, total,
+	// sampling and whether an index follows, then the pool.
+	CHMProbObjBox<int> stBox;
+	FillBox(stBox, 10, 20, 7);
+	std::stringstream ss;
+	stBox.Save(ss);
+	const std::string strSnapshot = ss.str();
+	HM_TEST_CHECK(LoadSnapshot(strSnapshot));
+
+	// Every truncation fails, and so do a bad magic, a total which is not the sum of the
+	// counts and a count of 0.
+	for (size_t unLen = 0; unLen < strSnapshot.size(); unLen++)
+	{
+		HM_TEST_CHECK(!LoadSnapshot(strSnapshot.substr(0, unLen)));
+	}
+
+	std::string strCorrupt = strSnapshot;
+	SetSnapshotWord(strCorrupt, 0, 0);
+	HM_TEST_CHECK(!LoadSnapshot(strCorrupt));
+
+	for (int nDiff = -1; nDiff <= 1; nDiff += 2)
+	{
+		strCorrupt = strSnapshot;
+		SetSnapshotWord(strCorrupt, 5 * sizeof(unsigned int), GetSnapshotWord(strSnapshot, 5 * sizeof(unsigned int)) + nDiff);
+		HM_TEST_CHECK(!LoadSnapshot(strCorrupt));
+	}
+
+	strCorrupt = strSnapshot;
+	SetSnapshotWord(strCorrupt, 5 * sizeof(unsigned int), GetSnapshotWord(strSnapshot, 5 * sizeof(unsigned int)) - GetSnapshotWord(strSnapshot, 8 * sizeof(unsigned int) + sizeof(int)));
+	SetSnapshotWord(strCorrupt, 8 * sizeof(unsigned int) + sizeof(int), 0);
+	HM_TEST_CHECK(!LoadSnapshot(strCorrupt));
+
+	// A size bigger than the stream holds fails.
+	strCorrupt = strSnapshot;
+	SetSnapshotWord(strCorrupt, 4 * sizeof(unsigned int), 1000);
+	HM_TEST_CHECK(!LoadSnapshot(strCorrupt));
+}
+
+static void TestView()
+{
+	const char* const szFileName = "HMProbObjBoxTest.view.tmp";
+
+	// A view draws as the box it was written from.
+	for (unsigned int unProbObjNum = 0; unProbObjNum <= 2000; unProbObjNum += 1000)
+	{
+		CHMProbObjBox<int> stBox;
+		FillBox(stBox, unProbObjNum, 1000, unProbObjNum + 28);
+		CHMProbObjBoxView<int> stView;
+		HM_TEST_CHECK(CHMProbObjBoxView<int>::Write(stBox, szFileName) && stView.Open(szFileName));
+		HM_TEST_CHECK(stView.IsOpen() && unProbObjNum == stView.GetSize() && IsSameDraw(stView, stBox));
+
+		bool bSameCount = true;
+		for (int i = -1; i <= (int)unProbObjNum; i++) bSameCount = bSameCount && stView.GetCount(&i) == stBox.GetCount(&i);
+		HM_TEST_CHECK(bSameCount);
+	}
+
+	// Header layout: magic, version, key size, size, total, reserved, then the 64-bit
+	// offsets of the keys, the counts and the prefix sums.
+	CHMProbObjBox<int> stBox;
+	FillBox(stBox, 10, 20, 28);
+	CHMProbObjBoxView<int>::Write(stBox, szFileName);
+	const std::string strFile = ReadFile(szFileName);
+	const size_t unKeyOffset = 6 * sizeof(unsigned int), unCountOffset = unKeyOffset + 8, unPrefixOffset = unCountOffset + 8;
+
+	// Every truncation fails, and a failed Open leaves the view closed.
+	CHMProbObjBoxView<int> stView;
+	for (size_t unLen = 0; unLen < strFile.size(); unLen++)
+	{
+		WriteFile(szFileName, strFile.substr(0, unLen));
+		HM_TEST_CHECK(!stView.Open(szFileName) && !stView.IsOpen() && 0 == stView.GetCount());
+	}
+
+	// Offsets into the header, out of order, past the file, or so big that adding the
+	// size of an array wraps.
+	const unsigned long long arrCorrupt[][2] = { { unKeyOffset, 0 }, { unKeyOffset, 4 }, { unCountOffset, 44 },
+		{ unPrefixOffset, 84 }, { unPrefixOffset, strFile.size() }, { unKeyOffset, 0xFFFFFFFFFFFFFFF0ull },
+		{ unCountOffset, 0xFFFFFFFFFFFFFFF0ull }, { unPrefixOffset, 0xFFFFFFFFFFFFFFF0ull }, { unPrefixOffset, 0xFFFFFFFFFFFFFFFCull } };
+	for (size_t i = 0; i < sizeof(arrCorrupt) / sizeof(arrCorrupt[0]); i++)
+	{
+		std::string strCorrupt = strFile;
+		SetFileWord(strCorrupt, (size_t)arrCorrupt[i][0], arrCorrupt[i][1]);
+		WriteFile(szFileName, strCorrupt);
+		HM_TEST_CHECK(!stView.Open(szFileName) && !stView.IsOpen());
+	}
+
+	// A bad magic, key size or size, and a total which does not match the prefix sums.
+	const unsigned int arrCorruptWord[][2] = { { 0, 0 }, { 2, 8 }, { 3, 11 }, { 3, 0xFFFFFFFF }, { 4, stBox.GetCount() + 1 } };
+	for (size_t i = 0; i < sizeof(arrCorruptWord) / sizeof(arrCorruptWord[0]); i++)
+	{
+		std::string strCorrupt = strFile;
+		SetSnapshotWord(strCorrupt, arrCorruptWord[i][0] * sizeof(unsigned int), arrCorruptWord[i][1]);
+		WriteFile(szFileName, strCorrupt);
+		HM_TEST_CHECK(!stView.Open(szFileName) && !stView.IsOpen());
+	}
+
+	WriteFile(szFileName, strFile);
+	HM_TEST_CHECK(stView.Open(szFileName) && IsSameDraw(stView, stBox));
+	stView.Close();
+	HM_TEST_CHECK(!stView.IsOpen() && 0 == stView.GetSize());
+	std::remove(szFileName);
+}
+
+static bool LoadTable(CHMProbObjBoxLoader<std::string>& stLoader, CHMProbObjBox<std::string>& stBox, const std::string& strTable)
+{
+	std::stringstream ss(strTable);
+	return stLoader.Load(ss, stBox);
+}
+
+static unsigned int GetCount(const CHMProbObjBox<std::string>& stBox, const std::string& strKey)
+{
+	return stBox.GetCount(&strKey);
+}
+
+static void TestLoader()
+{
+	// Header, CRLF, blanks, quotes, a last line with no line break, and bad lines.
+	{
+		CHMProbObjBoxLoader<std::string> stLoader;
+		CHMProbObjBox<std::string> stBox;
+		stLoader.SetHasHeader(true);
+		HM_TEST_CHECK(LoadTable(stLoader, stBox, "key,count\r\n a , 1\r\n\"b\",2\r\n\r\nc,x\nd\ne,-1\nf,4294967296\ng,3"));
+		HM_TEST_CHECK(3 == stBox.GetPool().size() && 6 == stBox.GetCount());
+		HM_TEST_CHECK(1 == GetCount(stBox, "a") && 2 == GetCount(stBox, "b") && 3 == GetCount(stBox, "g"));
+		HM_TEST_CHECK(9 == stLoader.GetLineNum() && 4 == stLoader.GetBadLineNum());
+	}
+
+	// Blank lines before the header, which is the first line that is not blank.
+	{
+		CHMProbObjBoxLoader<std::string> stLoader;
+		CHMProbObjBox<std::string> stBox;
+		stLoader.SetHasHeader(true);
+		HM_TEST_CHECK(LoadTable(stLoader, stBox, "\r\n\nkey,count\na,1\n"));
+		HM_TEST_CHECK(1 == stBox.GetPool().size() && 1 == GetCount(stBox, "a") && 0 == stLoader.GetBadLineNum());
+	}
+
+	// TSV with the columns swapped, and lines longer than the chunk.
+	{
+		CHMProbObjBoxLoader<std::string> stLoader;
+		CHMProbObjBox<std::string> stBox;
+		stLoader.SetDelimiter('\t');
+		stLoader.SetColumns(2, 0);
+		stLoader.SetChunkSize(4);
+		HM_TEST_CHECK(LoadTable(stLoader, stBox, "5\tignored\tlong key field\n7\t\tk\n"));
+		HM_TEST_CHECK(5 == GetCount(stBox, "long key field") && 7 == GetCount(stBox, "k") && 0 == stLoader.GetBadLineNum());
+	}
+
+	// By default a line replaces the count of its key, and 0 removes the key.
+	{
+		CHMProbObjBoxLoader<std::string> stLoader;
+		CHMProbObjBox<std::string> stBox;
+		HM_TEST_CHECK(LoadTable(stLoader, stBox, "a,1\nb,2\na,3\nb,0\n"));
+		HM_TEST_CHECK(1 == stBox.GetPool().size() && 3 == GetCount(stBox, "a") && 0 == stLoader.GetBadLineNum());
+	}
+
+	// Unique keys: a repeated key or one already in the box is a bad line, a count of 0
+	// is skipped.
+	{
+		CHMProbObjBoxLoader<std::string> stLoader;
+		CHMProbObjBox<std::string> stBox;
+		const std::string strOld = "old";
+		const unsigned int unOldCount = 9;
+		stBox.Modify(&strOld, &unOldCount);
+		stLoader.SetUniqueKeys(true);
+		HM_TEST_CHECK(LoadTable(stLoader, stBox, "a,1\nb,2\na,3\nold,4\nc,0\n"));
+		HM_TEST_CHECK(3 == stBox.GetPool().size() && 1 == GetCount(stBox, "a") && 9 == GetCount(stBox, "old"));
+		HM_TEST_CHECK(2 == stLoader.GetBadLineNum());
+	}
+
+	// Integral keys out of range, including 64-bit overflow.
+	{
+		CHMProbObjBoxLoader<unsigned long long> stLoader;
+		CHMProbObjBox<unsigned long long> stBox;
+		std::stringstream ss("18446744073709551615,1\n18446744073709551616,1\n99999999999999999999,1\n-1,1\n");
+		HM_TEST_CHECK(stLoader.Load(ss, stBox));
+		HM_TEST_CHECK(1 == stBox.GetPool().size() && 3 == stLoader.GetBadLineNum());
+
+		CHMProbObjBoxLoader<signed char> stSmallLoader;
+		CHMProbObjBox<signed char> stSmallBox;
+		std::stringstream ssSmall("-128,1\n127,1\n128,1\n-129,1\n+5,1\n");
+		HM_TEST_CHECK(stSmallLoader.Load(ssSmall, stSmallBox));
+		HM_TEST_CHECK(3 == stSmallBox.GetPool().size() && 2 == stSmallLoader.GetBadLineNum());
+	}
+
+	// A file, with progress reported after every chunk up to its size.
+	{
+		const char* const szFileName = "HMProbObjBoxTest.csv.tmp";
+		WriteFile(szFileName, "1,10\n2,20\n3,30\n");
+		CHMProbObjBoxLoader<int> stLoader;
+		CHMProbObjBox<int> stBox;
+		unsigned long long ullLastRead = 0, ullLastTotal = 0, ullLastLineNum = 0;
+		auto fnProgress = [&](unsigned long long ullRead, unsigned long long ullTotal, unsigned long long ullLineNum)
+			{
+				ullLastRead = ullRead;
+				ullLastTotal = ullTotal;
+				ullLastLineNum = ullLineNum;
+			};
+		stLoader.SetChunkSize(5);
+		HM_TEST_CHECK(stLoader.Load(szFileName, stBox, CHMProbObjFieldParser<int>(), fnProgress));
+		HM_TEST_CHECK(3 == stBox.GetPool().size() && 60 == stBox.GetCount());
+		HM_TEST_CHECK(15 == ullLastRead && 15 == ullLastTotal && 3 == ullLastLineNum);
+		HM_TEST_CHECK(!stLoader.Load("HMProbObjBoxTest.missing.tmp", stBox));
+		std::remove(szFileName);
+	}
+}
+
+static void TestVerifier()
+{
+	typedef CHMProbObjBoxVerifier<int> CVerifier;
+
+	// A box with no entry expected less than 5 times is tested over all of them.
+	CHMProbObjBox<int> stBox;
+	FillBox(stBox, 100, 50, 31);
+	const SHMProbObjVerifyResult stResult = CVerifier::Verify(stBox, 400000, 4, 31);
+	HM_TEST_CHECK(400000 == stResult.ullDrawNum && 0 == stResult.ullFailedDrawNum && 99 == stResult.ullDegreesOfFreedom);
+	HM_TEST_CHECK(CVerifier::IsDistributionOk(stResult));
+
+	// Many rare entries are pooled into one bin, so a right box keeps passing. Each of
+	// them is expected about 0.1 times.
+	CHMProbObjBox<int> stSkewed;
+	stSkewed.Append(-1, 10000000);
+	for (int i = 0; i < 3000; i++) stSkewed.Append(i, 1);
+	stSkewed.Commit();
+	unsigned int unPassNum = 0;
+	for (unsigned int unSeed = 0; unSeed < 10; unSeed++)
+	{
+		const SHMProbObjVerifyResult stSkewedResult = CVerifier::Verify(stSkewed, 300000, 2, unSeed);
+		HM_TEST_CHECK(1 == stSkewedResult.ullDegreesOfFreedom);
+		unPassNum += CVerifier::IsDistributionOk(stSkewedResult) ? 1 : 0;
+	}
+	HM_TEST_CHECK(10 == unPassNum);
+
+	// A rare bin still expected less than 5 times joins the smallest other bin.
+	CHMProbObjBox<int> stTiny;
+	stTiny.Append(0, 1000000);
+	stTiny.Append(1, 10000);
+	stTiny.Append(2, 1);
+	stTiny.Commit();
+	HM_TEST_CHECK(1 == CVerifier::Verify(stTiny, 100000, 1, 0).ullDegreesOfFreedom);
+
+	// With a total of 3 * 2^29, 'nRand % total' for a 31-bit nRand draws the first third
+	// of the keys twice as often, which the tests find.
+	CHMProbObjBox<int> stBiased;
+	stBiased.Append(0, 1u << 29);
+	stBiased.Append(1, 1u << 30);
+	stBiased.Commit();
+	const SHMProbObjVerifyResult stBiasedResult = CVerifier::Verify(stBiased, 100000, 2, 0);
+	HM_TEST_CHECK(!CVerifier::IsDistributionOk(stBiasedResult) && 1.0 == stBiasedResult.dModuloBias);
+	HM_TEST_CHECK(CVerifier::CheckRegression(stBiasedResult, stResult).bDistributionRegressed);
+	HM_TEST_CHECK(!CVerifier::CheckRegression(stResult, stBiasedResult).bDistributionRegressed);
+
+	SHMProbObjVerifyResult stSlow = stResult, stBaseline = stResult;
+	stBaseline.dDrawsPerSec = 1000;
+	stSlow.dDrawsPerSec = 850;
+	HM_TEST_CHECK(CVerifier::CheckRegression(stSlow, stBaseline).bThroughputRegressed);
+	stSlow.dDrawsPerSec = 950;
+	HM_TEST_CHECK(!CVerifier::CheckRegression(stSlow, stBaseline).bThroughputRegressed);
+	HM_TEST_CHECK(std::string::npos != CVerifier::ToJson(stResult).find("\"dof\":99,"));
+
+	// An empty box is not drawn from.
+	CHMProbObjBox<int> stEmpty;
+	const SHMProbObjVerifyResult stEmptyResult = CVerifier::Verify(stEmpty, 1000);
+	HM_TEST_CHECK(0 == stEmptyResult.ullDrawNum && 0 == stEmptyResult.dModuloBias);
+}
+
+// Draws every key of [0, total) once, so every object must be drawn exactly as many
+// times as its count.
+template <typename TWeight>
+static bool IsExactDraw(CHMProbObjBox<int, TWeight>& stBox)
+{
+	std::map<int, unsigned int> mapDrawn;
+	int nProbObj = -1;
+	for (unsigned int k = 0; k < stBox.GetCount(); k++)
+	{
+		if (!stBox.Draw(nProbObj, (int)k)) return false;
+		mapDrawn[nProbObj]++;
+	}
+
+	unsigned int unDrawnNum = 0;
+	for (const auto& prDrawn : mapDrawn)
+	{
+		if (prDrawn.second != stBox.GetCount(&prDrawn.first)) return false;
+		unDrawnNum++;
+	}
+	for (const auto& prProbObj : stBox.GetPool())
+	{
+		if (0 < prProbObj.second && 0 == mapDrawn.count(prProbObj.first)) return false;
+	}
+	return 0 < unDrawnNum || 0 == stBox.GetCount();
+}
+
+static void TestIndexExactness(const EHMProbObjBoxSampling eSampling)
+{
+	for (unsigned int unProbObjNum = 1; unProbObjNum <= 4097; unProbObjNum += 1024)
+	{
+		CHMProbObjBox<int> stBox;
+		stBox.SetSampling(eSampling);
+		FillBox(stBox, unProbObjNum, 97, unProbObjNum + eSampling);
+		HM_TEST_CHECK(eSampling == stBox.GetSampling() && !stBox.IsDirty() && IsExactDraw(stBox));
+	}
+}
+
+static void TestIndexSnapshot(const EHMProbObjBoxSampling eSampling)
+{
+	// Round trips, the index is loaded with the pool and not rebuilt.
+	for (unsigned int unCountMax = 50; unCountMax <= 500000; unCountMax *= 10000)
+	{
+		CHMProbObjBox<int> stBox, stLoaded;
+		stBox.SetSampling(eSampling);
+		FillBox(stBox, 300, unCountMax, unCountMax);
+
+		std::stringstream ss;
+		HM_TEST_CHECK(stBox.Save(ss) && stLoaded.Load(ss));
+		HM_TEST_CHECK(eSampling == stLoaded.GetSampling() && !stLoaded.IsDirty() && IsSameBox(stBox, stLoaded));
+	}
+
+	// A box saved with an out of date index is saved without it, and rebuilt on Load.
+	CHMProbObjBox<int> stDirty, stLoaded;
+	stDirty.SetSampling(eSampling);
+	FillBox(stDirty, 10, 20, 3);
+	const int nProbObj = 10;
+	stDirty.Append(nProbObj, 5);
+	std::stringstream ssDirty;
+	HM_TEST_CHECK(stDirty.IsDirty() && stDirty.Save(ssDirty) && stLoaded.Load(ssDirty) && stLoaded.IsDirty() && IsSameBox(stDirty, stLoaded));
+
+	// Every truncation of the index fails.
+	const unsigned int unProbObjNum = 10;
+	const size_t unIndexOffset = 8 * sizeof(unsigned int) + unProbObjNum * sizeof(std::pair<int, unsigned int>);
+	CHMProbObjBox<int> stBox;
+	stBox.SetSampling(eSampling);
+	FillBox(stBox, unProbObjNum, 20, 7);
+	std::stringstream ss;
+	stBox.Save(ss);
+	const std::string strSnapshot = ss.str();
+	HM_TEST_CHECK(LoadSnapshot(strSnapshot));
+	for (size_t unLen = unIndexOffset; unLen < strSnapshot.size(); unLen++)
+	{
+		HM_TEST_CHECK(!LoadSnapshot(strSnapshot.substr(0, unLen)));
+	}
+
+	// Index layout: sampling, total, column size, tail object and the sizes of the prefix
+	// sums, thresholds and aliases, the shift of a compact table, then the arrays. A
+	// sampling or total other than the box's fails.
+	std::string strCorrupt = strSnapshot;
+	SetSnapshotWord(strCorrupt, unIndexOffset, (eHMProbObjBoxSamplingPrefix == eSampling) ? eHMProbObjBoxSamplingAlias : eHMProbObjBoxSamplingPrefix);
+	HM_TEST_CHECK(!LoadSnapshot(strCorrupt));
+	strCorrupt = strSnapshot;
+	SetSnapshotWord(strCorrupt, unIndexOffset + sizeof(unsigned int), GetSnapshotWord(strSnapshot, unIndexOffset + sizeof(unsigned int)) + 1);
+	HM_TEST_CHECK(!LoadSnapshot(strCorrupt));
+
+	const size_t unArrayOffset = unIndexOffset + ((eHMProbObjBoxSamplingAliasCompact == eSampling) ? 8 : 7) * sizeof(unsigned int);
+	if (eHMProbObjBoxSamplingPrefix == eSampling)
+	{
+		strCorrupt = strSnapshot;
+		SetSnapshotWord(strCorrupt, unArrayOffset + 3 * sizeof(unsigned int), GetSnapshotWord(strSnapshot, unArrayOffset + 3 * sizeof(unsigned int)) + 1);
+		HM_TEST_CHECK(!LoadSnapshot(strCorrupt));
+	}
+	else
+	{
+		// The aliases cut to none, an alias or the tail object out of range.
+		const unsigned int unColumnNum = GetSnapshotWord(strSnapshot, unIndexOffset + 6 * sizeof(unsigned int));
+		const size_t unAliasOffset = strSnapshot.size() - unColumnNum * sizeof(unsigned int);
+		strCorrupt = strSnapshot.substr(0, unAliasOffset);
+		SetSnapshotWord(strCorrupt, unIndexOffset + 6 * sizeof(unsigned int), 0);
+		HM_TEST_CHECK(!LoadSnapshot(strCorrupt));
+		strCorrupt = strSnapshot;
+		SetSnapshotWord(strCorrupt, unAliasOffset, unProbObjNum + 5);
+		HM_TEST_CHECK(!LoadSnapshot(strCorrupt));
+		strCorrupt = strSnapshot;
+		SetSnapshotWord(strCorrupt, unIndexOffset + 3 * sizeof(unsigned int), unProbObjNum);
+		HM_TEST_CHECK(!LoadSnapshot(strCorrupt));
+	}
+
+	// Flipped bytes in the index are rejected or give a box which still draws in range.
+	std::mt19937 rng(eSampling);
+	for (unsigned int i = 0; i < 300; i++)
+	{
+		strCorrupt = strSnapshot;
+		strCorrupt[unIndexOffset + rng() % (strCorrupt.size() - unIndexOffset)] ^= (char)(1 + rng() % 255);
+
+		CHMProbObjBox<int> stCorrupt;
+		std::stringstream ssCorrupt(strCorrupt);
+		if (!stCorrupt.Load(ssCorrupt)) continue;
+
+		int nDrawn = -1;
+		bool bInRange = true;
+		for (unsigned int r = 0; r < 200; r++) bInRange = bInRange && stCorrupt.Draw(nDrawn, (int)r) && 0 <= nDrawn && nDrawn < (int)unProbObjNum;
+		HM_TEST_CHECK(bInRange);
+	}
+}
+
+static void TestIndex()
+{
+	TestIndexExactness(eHMProbObjBoxSamplingPrefix);
+	TestIndexExactness(eHMProbObjBoxSamplingAlias);
+	TestIndexSnapshot(eHMProbObjBoxSamplingPrefix);
+	TestIndexSnapshot(eHMProbObjBoxSamplingAlias);
+
+	// A lazy box rebuilds at the next Draw or Commit, an eager one at once; Append only
+	// marks the index out of date under either policy.
+	CHMProbObjBox<int> stBox;
+	stBox.SetSampling(eHMProbObjBoxSamplingAlias);
+	const int arrProbObj[] = { 1, 2, 3 };
+	const unsigned int arrCount[] = { 10, 20, 30 };
+	stBox.Modify(arrProbObj, arrCount, 3);
+	int nProbObj = -1;
+	HM_TEST_CHECK(eHMProbObjBoxRebuildLazy == stBox.GetRebuildPolicy() && stBox.IsDirty());
+	HM_TEST_CHECK(stBox.Draw(nProbObj, 0) && !stBox.IsDirty());
+	stBox.Append(4, 40);
+	HM_TEST_CHECK(stBox.IsDirty());
+	stBox.Commit();
+	HM_TEST_CHECK(!stBox.IsDirty() && IsExactDraw(stBox));
+
+	stBox.SetRebuildPolicy(eHMProbObjBoxRebuildEager);
+	stBox.Modify(arrProbObj, arrCount, 1);
+	HM_TEST_CHECK(!stBox.IsDirty());
+	stBox.Append(5, 50);
+	HM_TEST_CHECK(stBox.IsDirty());
+	stBox.Commit();
+	stBox.Clear();
+	HM_TEST_CHECK(!stBox.IsDirty() && 0 == stBox.GetCount() && !stBox.Draw(nProbObj, 0) && eHMProbObjBoxSamplingAlias == stBox.GetSampling());
+
+	// The loader keeps an eager box eager, builds its index once and leaves it clean.
+	CHMProbObjBoxLoader<int> stLoader;
+	std::stringstream ssTable("0,5\n1,6\n2,7\n");
+	HM_TEST_CHECK(stLoader.Load(ssTable, stBox));
+	HM_TEST_CHECK(eHMProbObjBoxRebuildEager == stBox.GetRebuildPolicy() && !stBox.IsDirty() && IsExactDraw(stBox));
+}
+
+static void TestParallelBuild(const EHMProbObjBoxSampling eSampling)
+{
+	// An index built on several threads is the one built on one thread, so saves the same
+	// snapshot and draws the same objects. 300000 objects use up to 4 blocks.
+	CHMProbObjBox<int> stSingle;
+	stSingle.SetSampling(eSampling);
+	FillBox(stSingle, 300000, 5, 3);
+	std::stringstream ssSingle;
+	HM_TEST_CHECK(stSingle.Save(ssSingle));
+
+	const unsigned int arrThreadNum[] = { 2, 4, 8, 0 };
+	for (unsigned int t = 0; t < sizeof(arrThreadNum) / sizeof(arrThreadNum[0]); t++)
+	{
+		CHMProbObjBox<int> stMulti;
+		stMulti.SetSampling(eSampling);
+		stMulti.SetBuildThreadNum(arrThreadNum[t]);
+		FillBox(stMulti, 300000, 5, 3);
+
+		std::stringstream ssMulti;
+		HM_TEST_CHECK(arrThreadNum[t] == stMulti.GetBuildThreadNum() && stMulti.Save(ssMulti) && ssSingle.str() == ssMulti.str());
+		HM_TEST_CHECK(IsSameBox(stSingle, stMulti));
+	}
+
+	// A pool too small to split builds on one thread.
+	CHMProbObjBox<int> stSmall, stSmallMulti;
+	stSmall.SetSampling(eSampling);
+	stSmallMulti.SetSampling(eSampling);
+	stSmallMulti.SetBuildThreadNum(4);
+	FillBox(stSmall, 1000, 50, 9);
+	FillBox(stSmallMulti, 1000, 50, 9);
+	HM_TEST_CHECK(IsSameBox(stSmall, stSmallMulti) && IsExactDraw(stSmallMulti));
+}
+
+// A CHMProbObjBox of the leaves of a tree built in depth-first order, with a leaf's
+// object being its handle, which leaves out the leaves of count 0 as the tree does.
+static CHMProbObjBox<int> GetTreeReference(const CHMProbObjTreeBox<int>& stTree)
+{
+	CHMProbObjBox<int> stReference;
+	for (unsigned int i = 0; i < stTree.GetLeafNum(); i++)
+	{
+		if (0 != stTree.GetLeafCount(i)) stReference.Append(stTree.GetLeaf(i), stTree.GetLeafCount(i));
+	}
+	stReference.Commit();
+	return stReference;
+}
+
+static void TestTreeBox()
+{
+	// Boxes counting as the total of their entries draw as a CHMProbObjBox holding the
+	// leaves in depth-first order, and keep doing so as leaf counts change.
+	CHMProbObjTreeBox<int> stTree;
+	CHMProbObjBox<int> stReference;
+	std::vector<unsigned int> vecLeaf;
+	std::mt19937 rng(37);
+	const unsigned int unTier = stTree.AddBox(0);
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		const unsigned int unBox = stTree.AddBox(unTier);
+		for (unsigned int j = 0; j < 300; j++)
+		{
+			const int nProbObj = (int)vecLeaf.size();
+			const unsigned int unCount = 1 + rng() % 50;
+			vecLeaf.push_back(stTree.Append(unBox, nProbObj, unCount));
+			stReference.Append(nProbObj, unCount);
+		}
+	}
+	for (unsigned int j = 0; j < 100; j++)
+	{
+		const int nProbObj = (int)vecLeaf.size();
+		vecLeaf.push_back(stTree.Append(0, nProbObj, 7));
+		stReference.Append(nProbObj, 7);
+	}
+	stReference.Commit();
+	CHMProbObjBox<int> stRebuilt = GetTreeReference(stTree);
+	HM_TEST_CHECK(5 == stTree.GetBoxNum() && 1000 == stTree.GetLeafNum() && IsSameDraw(stTree, stReference) && IsSameBox(stReference, stRebuilt));
+
+	for (unsigned int i = 0; i < 500; i++)
+	{
+		const unsigned int unLeaf = vecLeaf[rng() % vecLeaf.size()];
+		const unsigned int unCount = (0 == i % 5) ? 0 : rng() % 100;
+		HM_TEST_CHECK(stTree.ModifyLeaf(unLeaf, unCount) && unCount == stTree.GetLeafCount(unLeaf));
+	}
+	stRebuilt = GetTreeReference(stTree);
+	HM_TEST_CHECK(IsSameDraw(stTree, stRebuilt));
+
+	// Modify looks the object up in its box, a count of 0 for an unknown one adds nothing.
+	const unsigned int unLeafNum = stTree.GetLeafNum();
+	HM_TEST_CHECK(stTree.Modify(4, 600, 33) && 33 == stTree.GetLeafCount(600) && unLeafNum == stTree.GetLeafNum());
+	HM_TEST_CHECK(stTree.Modify(2, 0, 34) && 34 == stTree.GetLeafCount(0) && unLeafNum == stTree.GetLeafNum());
+	HM_TEST_CHECK(stTree.Modify(0, -5, 0) && unLeafNum == stTree.GetLeafNum());
+	HM_TEST_CHECK(stTree.Modify(0, -5, 8) && unLeafNum + 1 == stTree.GetLeafNum() && -5 == stTree.GetLeaf(unLeafNum));
+	stRebuilt = GetTreeReference(stTree);
+	HM_TEST_CHECK(IsSameDraw(stTree, stRebuilt));
+
+	// A box with a fixed count weighs that count while it has an entry, whatever the
+	// counts of its entries, and a draw picks a new key inside it.
+	CHMProbObjTreeBox<int> stTiered;
+	const unsigned int unCommon = stTiered.AddBox(0, 900), unRare = stTiered.AddBox(0, 100), unEmpty = stTiered.AddBox(0, 500);
+	for (int i = 0; i < 10; i++) stTiered.Append(unCommon, i, 1000000);
+	stTiered.Append(unRare, 100, 1);
+	stTiered.Append(unRare, 101, 3);
+	HM_TEST_CHECK(1000 == stTiered.GetCount() && 10000000 == stTiered.GetCount(unCommon) && 0 == stTiered.GetCount(unEmpty));
+
+	bool bInTier = true;
+	unsigned int arrRare[2] = { 0, 0 };
+	for (int k = 0; k < 1000; k++)
+	{
+		int nProbObj = -1;
+		bInTier = bInTier && stTiered.Draw(nProbObj, k) && ((k < 900) ? (0 <= nProbObj && nProbObj < 10) : (100 == nProbObj || 101 == nProbObj));
+		if (100 <= nProbObj) arrRare[nProbObj - 100]++;
+	}
+	HM_TEST_CHECK(bInTier && 0 < arrRare[0] && arrRare[0] < arrRare[1]);
+
+	int nDrawn = -1;
+	HM_TEST_CHECK(stTiered.Draw(nDrawn, 5, unRare) && (100 == nDrawn || 101 == nDrawn));
+	HM_TEST_CHECK(!stTiered.Draw(nDrawn, 5, unEmpty) && !stTiered.Draw(nDrawn, 5, 99));
+	HM_TEST_CHECK(stTiered.SetBoxCount(unRare, 0) && 904 == stTiered.GetCount());
+	HM_TEST_CHECK(stTiered.SetBoxCount(unRare, 50) && 950 == stTiered.GetCount() && !stTiered.SetBoxCount(0, 5) && !stTiered.SetBoxCount(99, 5));
+	HM_TEST_CHECK(UINT_MAX != stTiered.Append(unEmpty, 200, 1) && 1450 == stTiered.GetCount());
+
+	// Edge cases: an empty tree, unknown handles, nRand below -1 and totals overflowing.
+	CHMProbObjTreeBox<int> stEmpty;
+	unsigned int unLeaf = 0;
+	HM_TEST_CHECK(0 == stEmpty.GetCount() && !stEmpty.Draw(nDrawn, 0) && !stEmpty.DrawLeaf(unLeaf, 0));
+	HM_TEST_CHECK(UINT_MAX == stEmpty.AddBox(1) && UINT_MAX == stEmpty.Append(1, 0, 1) && !stEmpty.ModifyLeaf(0, 1) && !stEmpty.Modify(1, 0, 1));
+	HM_TEST_CHECK(0 == stEmpty.GetCount(1) && 0 == stEmpty.GetLeafCount(0));
+
+	const unsigned int unBox = stEmpty.AddBox(0);
+	const unsigned int unBig = stEmpty.Append(unBox, 1, UINT_MAX - 1);
+	HM_TEST_CHECK(UINT_MAX != unBig && UINT_MAX - 1 == stEmpty.GetCount() && !stEmpty.Draw(nDrawn, -2));
+	HM_TEST_CHECK(UINT_MAX == stEmpty.Append(0, 2, 2) && 1 == stEmpty.GetLeafNum() && UINT_MAX - 1 == stEmpty.GetCount());
+	HM_TEST_CHECK(!stEmpty.ModifyLeaf(unBig, UINT_MAX) || UINT_MAX == stEmpty.GetCount());
+	HM_TEST_CHECK(stEmpty.SetBoxCount(unBox, 10) && UINT_MAX != stEmpty.Append(0, 2, 2) && 12 == stEmpty.GetCount());
+	HM_TEST_CHECK(stEmpty.DrawLeaf(unLeaf, 11) && 1 == unLeaf && stEmpty.Draw(nDrawn, 3) && 1 == nDrawn);
+
+	// Dump lists every box and leaf, indented by depth.
+	std::stringstream ss;
+	stTiered.Dump(ss);
+	const std::string strDump = ss.str();
+	HM_TEST_CHECK(0 == strDump.find("Current total probability object count 1450.\nProbability object tree box, 4 boxes, 13 leaves.\n"));
+	HM_TEST_CHECK(std::string::npos != strDump.find("Box 2, count 50, total 4.\n  Probability object leaf 10, count 1.\n"));
+
+	stTiered.Clear();
+	HM_TEST_CHECK(1 == stTiered.GetBoxNum() && 0 == stTiered.GetLeafNum() && 0 == stTiered.GetCount() && !stTiered.Draw(nDrawn, 0));
+}
+
+// What DrawIf draws for an nRand, worked out from Draw of the same box and a
+// CHMProbObjBox of the accepted objects in pool order: the key of Draw first, then up to
+// 15 more keys of the generator seeded by nRand (none for a linear box), then a key
+// below the accepted total into the accepted objects.
+template <typename TPred>
+static bool DrawIfReference(CHMProbObjBox<int>& stBox, const TPred& fnPred, const int nRand, int& nProbObj)
+{
+	CHMProbObjBox<int> stAccepted;
+	for (const auto& prProbObj : stBox.GetPool())
+	{
+		if (fnPred(prProbObj.first)) stAccepted.Append(prProbObj.first, prProbObj.second);
+	}
+	stAccepted.Commit();
+
+	CHMProbObjSplitMix stRand(nRand);
+	const unsigned int unTryNum = (eHMProbObjBoxSamplingLinear == stBox.GetSampling()) ? 1 : 16;
+	unsigned int unKeyNum = nRand % stBox.GetCount();
+	for (unsigned int i = 0; i < unTryNum; i++, unKeyNum = stRand.NextBelow(stBox.GetCount()))
+	{
+		if (!stBox.Draw(nProbObj, (int)unKeyNum)) return false;
+		if (fnPred(nProbObj)) return true;
+	}
+	return 0 != stAccepted.GetCount() && stAccepted.Draw(nProbObj, (int)stRand.NextBelow(stAccepted.GetCount()));
+}
+
+static void TestDrawIf(const EHMProbObjBoxSampling eSampling)
+{
+	CHMProbObjBox<int> stBox;
+	stBox.SetSampling(eSampling);
+	FillBox(stBox, 1000, 100, 38);
+	const std::vector<std::pair<int, unsigned int>> vecPool = stBox.GetPool();
+
+	// Accepting everything draws as Draw, an empty excluded set too.
+	const std::set<int> setNone;
+	bool bSame = true;
+	for (unsigned int i = 0; i < 6000; i++)
+	{
+		int nProbObj = -1, nAll = -2, nExcluding = -3;
+		const int nRand = GetTestRand(i);
+		bSame = bSame && stBox.Draw(nProbObj, nRand) && stBox.DrawIf(nAll, [](const int) { return true; }, nRand)
+			&& stBox.DrawExcluding(nExcluding, setNone, nRand) && nProbObj == nAll && nProbObj == nExcluding;
+	}
+	HM_TEST_CHECK(bSame);
+
+	// A predicate accepting a tenth of the objects, and one accepting a single object
+	// which makes almost every draw fall through to the exact scan, draw as worked out.
+	const auto fnTenth = [](const int nProbObj) { return 0 == nProbObj % 10; };
+	const auto fnOne = [](const int nProbObj) { return 777 == nProbObj; };
+	std::set<int> setExcluded;
+	for (int i = 0; i < 1000; i++)
+	{
+		if (0 != i % 10) setExcluded.insert(i);
+	}
+
+	bool bExact = true;
+	std::map<int, unsigned int> mapDrawn;
+	for (unsigned int i = 0; i < 3000; i++)
+	{
+		int nProbObj = -1, nExcluding = -2, nReference = -3;
+		const int nRand = GetTestRand(i * 7);
+		const bool bDrawn = stBox.DrawIf(nProbObj, fnTenth, nRand);
+		bExact = bExact && bDrawn && DrawIfReference(stBox, fnTenth, nRand, nReference) && nProbObj == nReference;
+		bExact = bExact && stBox.DrawExcluding(nExcluding, setExcluded, nRand) && nProbObj == nExcluding;
+		if (bDrawn) mapDrawn[nProbObj]++;
+		bExact = bExact && stBox.DrawIf(nProbObj, fnOne, nRand) && 777 == nProbObj;
+	}
+	HM_TEST_CHECK(bExact);
+
+	// The draws follow the counts of the accepted objects: the drawn share of the
+	// objects of counts above 50 is their share of the accepted total, within a few
+	// standard deviations.
+	unsigned int unAcceptedTotal = 0, unHighTotal = 0, unHighDrawn = 0;
+	for (const auto& prProbObj : vecPool)
+	{
+		if (!fnTenth(prProbObj.first)) continue;
+		unAcceptedTotal += prProbObj.second;
+		if (50 < prProbObj.second) unHighTotal += prProbObj.second;
+	}
+	for (const auto& prDrawn : mapDrawn)
+	{
+		const int nKey = prDrawn.first;
+		HM_TEST_CHECK(fnTenth(nKey));
+		if (50 < stBox.GetCount(&nKey)) unHighDrawn += prDrawn.second;
+	}
+	const double dShare = (double)unHighTotal / unAcceptedTotal;
+	HM_TEST_CHECK(std::fabs(unHighDrawn - 3000 * dShare) < 5 * std::sqrt(3000 * dShare * (1 - dShare)));
+
+	// Nothing accepted, every object excluded, an empty box or nRand below -1 fail, and
+	// the box is left as it was.
+	int nProbObj = -1;
+	for (int i = 0; i < 1000; i += 10) setExcluded.insert(i);
+	HM_TEST_CHECK(!stBox.DrawIf(nProbObj, [](const int) { return false; }, 5) && !stBox.DrawExcluding(nProbObj, setExcluded, 5));
+	HM_TEST_CHECK(!stBox.DrawIf(nProbObj, fnTenth, -2) && vecPool == stBox.GetPool() && !stBox.IsDirty());
+
+	const int nRemoved = 777;
+	const unsigned int unZero = 0;
+	stBox.Modify(&nRemoved, &unZero, 1);
+	HM_TEST_CHECK(!stBox.DrawIf(nProbObj, fnOne, 5));
+
+	CHMProbObjBox<int> stEmpty;
+	stEmpty.SetSampling(eSampling);
+	HM_TEST_CHECK(!stEmpty.DrawIf(nProbObj, [](const int) { return true; }, 5) && !stEmpty.DrawExcluding(nProbObj, setNone, 5));
+}
+
+// The objects SampleDistinct draws for an nRand, worked out directly: every object in
+// pool order gets the key -ln(u) / count for the next u of the generator seeded by
+// nRand, and the unK smallest keys are drawn in increasing order.
+static std::vector<int> SampleDistinctReference(const CHMProbObjBox<int>& stBox, const unsigned int unK, const int nRand)
+{
+	std::vector<std::pair<double, int>> vecKey;
+	CHMProbObjSplitMix stRand(nRand);
+	for (const auto& prProbObj : stBox.GetPool()) vecKey.push_back(std::make_pair(-std::log(stRand.NextOpen()) / prProbObj.second, prProbObj.first));
+	std::sort(vecKey.begin(), vecKey.end());
+
+	std::vector<int> vecOut;
+	for (unsigned int i = 0; i < unK && i < vecKey.size(); i++) vecOut.push_back(vecKey[i].second);
+	return vecOut;
+}
+
+static void TestSampleDistinct()
+{
+	CHMProbObjBox<int> stBox;
+	FillBox(stBox, 2000, 1000, 39);
+
+	bool bExact = true;
+	std::vector<int> vecOut;
+	const unsigned int arrK[] = { 1, 2, 10, 1999, 2000, 5000 };
+	for (unsigned int k = 0; k < sizeof(arrK) / sizeof(arrK[0]); k++)
+	{
+		for (unsigned int i = 0; i < 20; i++)
+		{
+			const int nRand = GetTestRand(i * 1000 + k);
+			bExact = bExact && stBox.SampleDistinct(arrK[k], vecOut, nRand) && SampleDistinctReference(stBox, arrK[k], nRand) == vecOut;
+		}
+	}
+	HM_TEST_CHECK(bExact && 2000 == vecOut.size() && 2000 == std::set<int>(vecOut.begin(), vecOut.end()).size());
+
+	// The same nRand draws the same objects whatever the sampling.
+	std::vector<int> vecIndexed;
+	stBox.SetSampling(eHMProbObjBoxSamplingAlias);
+	HM_TEST_CHECK(stBox.SampleDistinct(50, vecOut, 12345) && stBox.SampleDistinct(50, vecIndexed, 12345) && vecOut == vecIndexed);
+	HM_TEST_CHECK(stBox.SampleDistinct(50, vecIndexed, 12346) && vecOut != vecIndexed);
+
+	// Ordered pairs from counts 1, 2 and 7 follow drawing one object and taking it out:
+	// the first is i with probability c[i] / 10, the second j with c[j] / (10 - c[i]).
+	CHMProbObjBox<int> stSmall;
+	const int arrProbObj[] = { 0, 1, 2 };
+	const unsigned int arrCount[] = { 1, 2, 7 };
+	stSmall.Modify(arrProbObj, arrCount, 3);
+	unsigned int arrPair[3][3] = {};
+	const unsigned int unSampleNum = 30000;
+	for (unsigned int i = 0; i < unSampleNum; i++)
+	{
+		if (stSmall.SampleDistinct(2, vecOut, GetTestRand(i + 5000)) && 2 == vecOut.size()) arrPair[vecOut[0]][vecOut[1]]++;
+	}
+
+	bool bFollowed = true;
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		for (unsigned int j = 0; j < 3; j++)
+		{
+			if (i == j)
+			{
+				bFollowed = bFollowed && 0 == arrPair[i][j];
+				continue;
+			}
+			const double dProb = arrCount[i] / 10.0 * arrCount[j] / (10.0 - arrCount[i]);
+			bFollowed = bFollowed && std::fabs(arrPair[i][j] - unSampleNum * dProb) < 5 * std::sqrt(unSampleNum * dProb * (1 - dProb));
+		}
+	}
+	HM_TEST_CHECK(bFollowed);
+
+	// 0 objects succeed with none, even from an empty box, and old content is dropped.
+	CHMProbObjBox<int> stEmpty;
+	vecOut.assign(3, 7);
+	HM_TEST_CHECK(stBox.SampleDistinct(0, vecOut, 5) && vecOut.empty());
+	vecOut.assign(3, 7);
+	HM_TEST_CHECK(stEmpty.SampleDistinct(0, vecOut, 5) && vecOut.empty());
+	vecOut.assign(3, 7);
+	HM_TEST_CHECK(!stEmpty.SampleDistinct(1, vecOut, 5) && vecOut.empty());
+	HM_TEST_CHECK(!stBox.SampleDistinct(1, vecOut, -2) && !stBox.SampleDistinct(0, vecOut, -2) && vecOut.empty());
+	HM_TEST_CHECK(stBox.SampleDistinct(3, vecOut) && 3 == vecOut.size());
+}
+
+static void TestWeightedShuffle()
+{
+	// The first unK objects are SampleDistinct's for the same nRand, and all objects are
+	// there once.
+	CHMProbObjBox<int> stBox;
+	FillBox(stBox, 3000, 500, 40);
+	std::vector<int> vecShuffled, vecSampled;
+	bool bPrefix = true;
+	for (unsigned int i = 0; i < 10; i++)
+	{
+		const int nRand = GetTestRand(i * 31 + 7);
+		bPrefix = bPrefix && stBox.WeightedShuffle(vecShuffled, nRand) && SampleDistinctReference(stBox, 3000, nRand) == vecShuffled;
+		const unsigned int unK = 1 + i * 300;
+		bPrefix = bPrefix && stBox.SampleDistinct(unK, vecSampled, nRand) && std::equal(vecSampled.begin(), vecSampled.end(), vecShuffled.begin());
+	}
+	HM_TEST_CHECK(bPrefix && 3000 == vecShuffled.size() && 3000 == std::set<int>(vecShuffled.begin(), vecShuffled.end()).size());
+
+	// A pool keyed and sorted in several blocks is shuffled as on one thread.
+	CHMProbObjBox<int> stBig;
+	FillBox(stBig, 300000, 1000, 41);
+	std::vector<int> vecSingle, vecMulti;
+	HM_TEST_CHECK(stBig.WeightedShuffle(vecSingle, 99, 1) && 300000 == vecSingle.size());
+	const unsigned int arrThreadNum[] = { 2, 3, 4, 0 };
+	for (unsigned int t = 0; t < sizeof(arrThreadNum) / sizeof(arrThreadNum[0]); t++)
+	{
+		HM_TEST_CHECK(stBig.WeightedShuffle(vecMulti, 99, arrThreadNum[t]) && vecSingle == vecMulti);
+	}
+	HM_TEST_CHECK(stBig.SampleDistinct(1000, vecSampled, 99) && std::equal(vecSampled.begin(), vecSampled.end(), vecSingle.begin()));
+
+	// An empty box or nRand below -1 fail and drop the old content, one object is itself.
+	CHMProbObjBox<int> stEmpty;
+	vecShuffled.assign(3, 7);
+	HM_TEST_CHECK(!stEmpty.WeightedShuffle(vecShuffled, 5) && vecShuffled.empty());
+	vecShuffled.assign(3, 7);
+	HM_TEST_CHECK(!stBox.WeightedShuffle(vecShuffled, -2) && vecShuffled.empty());
+	stEmpty.Append(42, 1);
+	HM_TEST_CHECK(stEmpty.WeightedShuffle(vecShuffled, 5, 4) && std::vector<int>(1, 42) == vecShuffled);
+}
+
+// A CHMProbObjBox with the keys of an overlay: the base entries without an override in
+// pool order, then the overridden base entries in pool order with their new counts, then
+// the new objects in the order they were added.
+static CHMProbObjBox<int> GetOverlayReference(const CHMProbObjBox<int>& stBase, const std::map<int, unsigned int>& mapBaseOverride,
+	const std::vector<std::pair<int, unsigned int>>& vecNew)
+{
+	CHMProbObjBox<int> stReference;
+	for (const auto& prProbObj : stBase.GetPool())
+	{
+		if (0 == mapBaseOverride.count(prProbObj.first)) stReference.Append(prProbObj.first, prProbObj.second);
+	}
+	for (const auto& prProbObj : stBase.GetPool())
+	{
+		const auto it = mapBaseOverride.find(prProbObj.first);
+		if (mapBaseOverride.end() != it && 0 != it->second) stReference.Append(it->first, it->second);
+	}
+	for (const auto& prProbObj : vecNew)
+	{
+		if (0 != prProbObj.second) stReference.Append(prProbObj.first, prProbObj.second);
+	}
+	stReference.Commit();
+	return stReference;
+}
+
+static void TestOverlayBox(const EHMProbObjBoxSampling eSampling)
+{
+	CHMProbObjBox<int> stBase;
+	stBase.SetSampling(eSampling);
+	FillBox(stBase, 2000, 300, 42);
+	const std::vector<std::pair<int, unsigned int>> vecBasePool = stBase.GetPool();
+
+	// Without overrides the overlay draws as the base in pool order.
+	CHMProbObjOverlayBox<int> stOverlay(stBase);
+	std::map<int, unsigned int> mapBaseOverride;
+	std::vector<std::pair<int, unsigned int>> vecNew;
+	CHMProbObjBox<int> stReference = GetOverlayReference(stBase, mapBaseOverride, vecNew);
+	HM_TEST_CHECK(0 == stOverlay.GetOverrideNum() && IsSameDraw(stOverlay, stReference));
+
+	// Reweighted and removed base entries are cut out of the base keys and drawn after
+	// them, new objects last; restored ones go back to their base keys.
+	std::mt19937 rng(eSampling);
+	for (unsigned int r = 0; r < 6; r++)
+	{
+		for (unsigned int i = 0; i < 10; i++)
+		{
+			const int nProbObj = (int)(rng() % 2000);
+			const unsigned int unCount = (0 == i % 4) ? 0 : rng() % 500;
+			stOverlay.Modify(&nProbObj, &unCount, 1);
+			mapBaseOverride[nProbObj] = unCount;
+		}
+
+		const int nNew = 2000 + (int)r;
+		const unsigned int unNewCount = 1 + rng() % 100;
+		stOverlay.Modify(&nNew, &unNewCount, 1);
+		vecNew.push_back(std::make_pair(nNew, unNewCount));
+
+		const int nRestored = mapBaseOverride.begin()->first;
+		stOverlay.Restore(nRestored);
+		mapBaseOverride.erase(nRestored);
+
+		stReference = GetOverlayReference(stBase, mapBaseOverride, vecNew);
+		HM_TEST_CHECK(mapBaseOverride.size() + vecNew.size() == stOverlay.GetOverrideNum() && IsSameDraw(stOverlay, stReference));
+	}
+
+	bool bSameCount = true;
+	for (int i = 0; i < 2010; i++)
+	{
+		bSameCount = bSameCount && stReference.GetCount(&i) == stOverlay.GetCount(&i);
+	}
+	HM_TEST_CHECK(bSameCount && vecBasePool == stBase.GetPool());
+
+	// A removed new object keeps its place at 0, a new object of count 0 adds nothing,
+	// and a count which would overflow the total is ignored.
+	std::map<int, unsigned int> mapNew;
+	mapNew[2001] = 0;
+	mapNew[3000] = 0;
+	stOverlay.Modify(mapNew);
+	vecNew[1].second = 0;
+	const unsigned int unOverrideNum = stOverlay.GetOverrideNum(), unTotal = stOverlay.GetCount();
+	const int nHuge = 4000;
+	const unsigned int unHuge = UINT_MAX - unTotal + 1;
+	const unsigned int unHugeReplacing = UINT_MAX - (unTotal - vecNew[0].second) + 1;
+	stOverlay.Modify(&nHuge, &unHuge, 1);
+	stOverlay.Modify(&vecNew[0].first, &unHugeReplacing, 1);
+	stReference = GetOverlayReference(stBase, mapBaseOverride, vecNew);
+	HM_TEST_CHECK(unOverrideNum == stOverlay.GetOverrideNum() && unTotal == stOverlay.GetCount() && IsSameDraw(stOverlay, stReference));
+	const unsigned int unFull = UINT_MAX - unTotal;
+	stOverlay.Modify(&nHuge, &unFull, 1);
+	HM_TEST_CHECK(UINT_MAX == stOverlay.GetCount() && unFull == stOverlay.GetCount(&nHuge));
+	stOverlay.Restore(nHuge);
+	HM_TEST_CHECK(unTotal == stOverlay.GetCount() && stOverlay.GetMemoryUsage() < 2000);
+
+	int nProbObj = -1;
+	HM_TEST_CHECK(!stOverlay.Draw(nProbObj, -2));
+	stOverlay.Clear();
+	mapBaseOverride.clear();
+	vecNew.clear();
+	stReference = GetOverlayReference(stBase, mapBaseOverride, vecNew);
+	HM_TEST_CHECK(0 == stOverlay.GetOverrideNum() && IsSameDraw(stOverlay, stReference));
+
+	// Over an empty base an overlay draws only its new objects.
+	CHMProbObjBox<int> stEmpty;
+	CHMProbObjOverlayBox<int> stEmptyOverlay(stEmpty);
+	HM_TEST_CHECK(0 == stEmptyOverlay.GetCount() && !stEmptyOverlay.Draw(nProbObj, 0));
+	const int nOnly = 9;
+	const unsigned int unOnly = 4;
+	stEmptyOverlay.Modify(&nOnly, &unOnly, 1);
+	HM_TEST_CHECK(4 == stEmptyOverlay.GetCount() && stEmptyOverlay.Draw(nProbObj, 3) && 9 == nProbObj);
+	stEmptyOverlay.Restore(nOnly);
+	HM_TEST_CHECK(0 == stEmptyOverlay.GetCount() && 0 == stEmptyOverlay.GetOverrideNum() && !stEmptyOverlay.Draw(nProbObj, 0));
+}
+
+// Whether a versioned box holds the entries of a CHMProbObjBox in the same order and
+// draws as it does.
+static bool IsSameVersion(const CHMProbObjVersionedBox<int>& stVersion, CHMProbObjBox<int>& stReference)
+{
+	std::vector<std::pair<int, unsigned int>> vecPool;
+	stVersion.ForEach([&vecPool](const int nProbObj, const unsigned int unCount) { vecPool.push_back(std::make_pair(nProbObj, unCount)); });
+	return vecPool == stReference.GetPool() && vecPool.size() == stVersion.GetSize() && IsSameDraw(stVersion, stReference);
+}
+
+static void TestVersionedBox()
+{
+	// Updates, removals and appends keep the order and the draws of a linear CHMProbObjBox.
+	CHMProbObjVersionedBox<int> stBox;
+	CHMProbObjBox<int> stReference;
+	std::mt19937 rng(43);
+	for (unsigned int i = 0; i < 3000; i++)
+	{
+		const int nProbObj = (int)i;
+		const unsigned int unCount = 1 + rng() % 100;
+		stBox.Modify(&nProbObj, &unCount, 1);
+		stReference.Modify(&nProbObj, &unCount, 1);
+	}
+	HM_TEST_CHECK(3 == stBox.GetChunkNum() && IsSameVersion(stBox, stReference));
+
+	for (unsigned int i = 0; i < 300; i++)
+	{
+		const int nProbObj = (int)(rng() % 3100);
+		const unsigned int unCount = (0 == i % 3) ? 0 : rng() % 100;
+		stBox.Modify(&nProbObj, &unCount, 1);
+		stReference.Modify(&nProbObj, &unCount, 1);
+	}
+	bool bSameCount = true;
+	for (int i = 0; i < 3100; i++) bSameCount = bSameCount && stReference.GetCount(&i) == stBox.GetCount(&i);
+	HM_TEST_CHECK(bSameCount && IsSameVersion(stBox, stReference));
+
+	// A snapshot shares every chunk, and a change to either version copies only the
+	// chunk it touches, never seen by the other version.
+	CHMProbObjVersionedBox<int> stSnapshot = stBox.Snapshot();
+	CHMProbObjBox<int> stSnapshotReference = stReference;
+	unsigned int unSharedNum = 0;
+	HM_TEST_CHECK(3 == stSnapshot.GetChunkNum(&unSharedNum) && 3 == unSharedNum);
+
+	const int nFirst = stReference.GetPool().front().first;
+	const unsigned int unFirst = 12345;
+	stSnapshot.Modify(&nFirst, &unFirst, 1);
+	stSnapshotReference.Modify(&nFirst, &unFirst, 1);
+	HM_TEST_CHECK(3 == stSnapshot.GetChunkNum(&unSharedNum) && 2 == unSharedNum && 3 == stBox.GetChunkNum(&unSharedNum) && 2 == unSharedNum);
+	HM_TEST_CHECK(IsSameVersion(stSnapshot, stSnapshotReference) && IsSameVersion(stBox, stReference));
+
+	const int nLast = stReference.GetPool().back().first;
+	const unsigned int unZero = 0;
+	stBox.Modify(&nLast, &unZero, 1);
+	stReference.Modify(&nLast, &unZero, 1);
+	std::map<int, unsigned int> mapAppended;
+	mapAppended[5000] = 7;
+	mapAppended[5001] = 8;
+	stBox.Modify(mapAppended);
+	stReference.Modify(mapAppended);
+	HM_TEST_CHECK(3 == stBox.GetChunkNum(&unSharedNum) && 1 == unSharedNum);
+	HM_TEST_CHECK(IsSameVersion(stSnapshot, stSnapshotReference) && IsSameVersion(stBox, stReference));
+
+	// A hundred versions, each one change away from the last, share all other chunks.
+	std::vector<CHMProbObjVersionedBox<int>> vecVersion(1, stBox);
+	std::vector<CHMProbObjBox<int>> vecReference(1, stReference);
+	for (unsigned int v = 1; v <= 100; v++)
+	{
+		vecVersion.push_back(vecVersion.back().Snapshot());
+		vecReference.push_back(vecReference.back());
+		const int nProbObj = vecReference.back().GetPool()[rng() % vecReference.back().GetPool().size()].first;
+		const unsigned int unCount = 1 + v;
+		vecVersion.back().Modify(&nProbObj, &unCount, 1);
+		vecReference.back().Modify(&nProbObj, &unCount, 1);
+	}
+	bool bIsolated = true;
+	for (unsigned int v = 0; v <= 100; v += 10)
+	{
+		bIsolated = bIsolated && 3 == vecVersion[v].GetChunkNum(&unSharedNum) && 1 <= unSharedNum && IsSameVersion(vecVersion[v], vecReference[v]);
+	}
+	HM_TEST_CHECK(bIsolated);
+
+	// Removing the last entry of a chunk drops the chunk from that version only.
+	CHMProbObjVersionedBox<int> stSmall;
+	for (int i = 0; i < 1025; i++)
+	{
+		const unsigned int unCount = 1;
+		stSmall.Modify(&i, &unCount, 1);
+	}
+	const CHMProbObjVersionedBox<int> stSmallSnapshot = stSmall.Snapshot();
+	const int nAlone = 1024;
+	stSmall.Modify(&nAlone, &unZero, 1);
+	HM_TEST_CHECK(1 == stSmall.GetChunkNum(&unSharedNum) && 1 == unSharedNum && 1024 == stSmall.GetCount());
+	HM_TEST_CHECK(2 == stSmallSnapshot.GetChunkNum() && 1025 == stSmallSnapshot.GetCount() && 1 == stSmallSnapshot.GetCount(&nAlone));
+
+	// Edge cases: an empty box, a new object of count 0, totals overflowing and Clear.
+	CHMProbObjVersionedBox<int> stEmpty;
+	int nProbObj = -1;
+	HM_TEST_CHECK(0 == stEmpty.GetCount() && 0 == stEmpty.GetSize() && 0 == stEmpty.GetChunkNum(&unSharedNum) && !stEmpty.Draw(nProbObj, 0));
+	stEmpty.Modify(&nProbObj, &unZero, 1);
+	HM_TEST_CHECK(0 == stEmpty.GetSize());
+
+	const unsigned int unBig = UINT_MAX - 10, unFits = 9, unOver = 10;
+	const int arrProbObj[] = { 1, 2, 3 };
+	stEmpty.Modify(&arrProbObj[0], &unBig, 1);
+	stEmpty.Modify(&arrProbObj[1], &unOver, 1);
+	stEmpty.Modify(&arrProbObj[2], &unFits, 1);
+	HM_TEST_CHECK(UINT_MAX - 1 == stEmpty.GetCount() && 0 == stEmpty.GetCount(&arrProbObj[1]) && !stEmpty.Draw(nProbObj, -2));
+
+	std::stringstream ss;
+	stSnapshot.Dump(ss);
+	HM_TEST_CHECK(ss.str() == "Current total probability object count " + std::to_string(stSnapshot.GetCount()) + ".\n"
+		"Versioned probability object box, " + std::to_string(stSnapshot.GetSize()) + " objects in 3 chunks, 1 shared.\n");
+
+	const CHMProbObjVersionedBox<int> stKept = stEmpty.Snapshot();
+	stEmpty.Clear();
+	HM_TEST_CHECK(0 == stEmpty.GetCount() && !stEmpty.Draw(nProbObj, 0) && 2 == stKept.GetSize() && UINT_MAX - 1 == stKept.GetCount());
+}
+
+// What a schedule box draws for an nRand, worked out from a CHMProbObjBox per schedule
+// holding the same entries: a uniform key of the generator seeded by nRand picks a
+// schedule by its count times its multiplier, and the next value is the nRand of the
+// draw from its box.
+static bool DrawScheduleReference(const CHMProbObjScheduleBox<int>& stBox, std::vector<CHMProbObjBox<int>>& vecReference,
+	const long long llNow, const int nRand, int& nProbObj)
+{
+	double dTotal = 0;
+	for (unsigned int i = 0; i < vecReference.size(); i++) dTotal += vecReference[i].GetCount() * stBox.GetMultiplier(i, llNow);
+	if (dTotal <= 0) return false;
+
+	CHMProbObjSplitMix stRand(nRand);
+	double dKey = stRand.NextOpen() * dTotal;
+	unsigned int unSchedule = UINT_MAX;
+	for (unsigned int i = 0; i < vecReference.size(); i++)
+	{
+		const double dMass = vecReference[i].GetCount() * stBox.GetMultiplier(i, llNow);
+		if (dMass <= 0) continue;
+
+		unSchedule = i;
+		if (dKey < dMass) break;
+		dKey -= dMass;
+	}
+	return vecReference[unSchedule].Draw(nProbObj, (int)(stRand.Next() >> 33));
+}
+
+// A key without std::hash, so the schedule box searches every box for it.
+struct SHMTestKey
+{
+	int nId;
+	bool operator==(const SHMTestKey& stOther) const { return nId == stOther.nId; }
+};
+
+static void TestScheduleBox(const EHMProbObjBoxSampling eSampling)
+{
+	// A ramp from 1 to 3 over [0, 100] and down to 0 at 200, and a step to 2 at 50.
+	const SHMProbObjSchedulePoint arrRamp[] = { { 0, 1.0 }, { 100, 3.0 }, { 200, 0.0 } };
+	const SHMProbObjSchedulePoint arrStep[] = { { 50, 0.0 }, { 50, 2.0 } };
+	CHMProbObjScheduleBox<int> stBox;
+	stBox.SetSampling(eSampling);
+	HM_TEST_CHECK(1 == stBox.AddSchedule(arrRamp, 3) && 2 == stBox.AddSchedule(arrStep, 2) && 3 == stBox.GetScheduleNum());
+	HM_TEST_CHECK(1.0 == stBox.GetMultiplier(1, -5) && 2.0 == stBox.GetMultiplier(1, 50) && 1.5 == stBox.GetMultiplier(1, 150) && 0.0 == stBox.GetMultiplier(1, 250));
+	HM_TEST_CHECK(0.0 == stBox.GetMultiplier(2, 49) && 2.0 == stBox.GetMultiplier(2, 50) && 1.0 == stBox.GetMultiplier(1, 0) && 1.0 == stBox.GetMultiplier(0, 1000) && 0.0 == stBox.GetMultiplier(3, 0));
+
+	// Objects modified into schedules, moved between them and removed draw as worked out
+	// at every time.
+	std::vector<CHMProbObjBox<int>> vecReference(3);
+	for (unsigned int j = 0; j < vecReference.size(); j++) vecReference[j].SetSampling(eSampling);
+	std::mt19937 rng(44);
+	for (unsigned int i = 0; i < 3000; i++)
+	{
+		const int nProbObj = (int)(rng() % 1000);
+		const unsigned int unCount = (0 == i % 7) ? 0 : 1 + rng() % 100, unSchedule = rng() % 3;
+		stBox.Modify(&nProbObj, &unCount, 1, unSchedule);
+		for (unsigned int j = 0; j < vecReference.size(); j++)
+		{
+			const unsigned int unZero = 0;
+			vecReference[j].Modify(&nProbObj, (j == unSchedule) ? &unCount : &unZero, 1);
+		}
+	}
+	stBox.Commit();
+
+	bool bSameCount = true;
+	for (int i = 0; i < 1000; i++)
+	{
+		unsigned int unSchedule = 0, unCount = 0;
+		for (unsigned int j = 0; j < vecReference.size() && 0 == unCount; j++) unCount = vecReference[j].GetCount(&i), unSchedule = j;
+		unsigned int unFound = 0;
+		bSameCount = bSameCount && unCount == stBox.GetCount(&i, &unFound) && ((0 == unCount) ? UINT_MAX : unSchedule) == unFound;
+	}
+	HM_TEST_CHECK(bSameCount);
+
+	const long long arrNow[] = { -100, 0, 49, 50, 75, 150, 200, 1000 };
+	for (unsigned int t = 0; t < sizeof(arrNow) / sizeof(arrNow[0]); t++)
+	{
+		double dTotal = 0;
+		for (unsigned int j = 0; j < vecReference.size(); j++) dTotal += vecReference[j].GetCount() * stBox.GetMultiplier(j, arrNow[t]);
+
+		bool bSame = true;
+		for (unsigned int i = 0; i < 2000; i++)
+		{
+			int nProbObj = -1, nReference = -2;
+			const int nRand = GetTestRand(i * 13);
+			bSame = bSame && stBox.Draw(nProbObj, arrNow[t], nRand) && DrawScheduleReference(stBox, vecReference, arrNow[t], nRand, nReference) && nProbObj == nReference;
+		}
+		HM_TEST_CHECK(bSame && std::fabs(dTotal - stBox.GetTotal(arrNow[t])) <= 1e-9 * dTotal);
+	}
+
+	// With the constant and the step schedule emptied, nothing is drawn once the ramp is
+	// down to 0.
+	const unsigned int unZeroCount = 0;
+	for (int i = 0; i < 1000; i++)
+	{
+		unsigned int unSchedule = 0;
+		if (0 != stBox.GetCount(&i, &unSchedule) && 1 != unSchedule) stBox.Modify(&i, &unZeroCount, 1, unSchedule);
+	}
+	int nProbObj = -1;
+	HM_TEST_CHECK(1.5 * vecReference[1].GetCount() == stBox.GetTotal(150) && stBox.Draw(nProbObj, 150, 5) && 0 != vecReference[1].GetCount(&nProbObj));
+	HM_TEST_CHECK(0 == stBox.GetTotal(200) && !stBox.Draw(nProbObj, 200, 5) && !stBox.Draw(nProbObj, 150, -2));
+
+	stBox.Clear();
+	const int nKept = 5;
+	const unsigned int unKept = 3;
+	stBox.Modify(&nKept, &unKept, 1, 1);
+	HM_TEST_CHECK(1 == stBox.GetScheduleNum() && 0 == stBox.GetTotal(0) && 0 == stBox.GetCount(&nKept) && !stBox.Draw(nProbObj, 0, 1));
+	stBox.Modify(&nKept, &unKept, 1, 0);
+	HM_TEST_CHECK(3 == stBox.GetCount(&nKept) && stBox.Draw(nProbObj, 0, 1) && 5 == nProbObj && 1.0 == stBox.GetMultiplier(0, 7));
+
+	// Bad schedules are refused, a count overflowing its box leaves the object out.
+	const SHMProbObjSchedulePoint arrUnsorted[] = { { 10, 1.0 }, { 5, 1.0 } };
+	const SHMProbObjSchedulePoint arrNegative[] = { { 10, -1.0 } };
+	const SHMProbObjSchedulePoint arrNan[] = { { 10, std::nan("") } };
+	HM_TEST_CHECK(UINT_MAX == stBox.AddSchedule(arrUnsorted, 2) && UINT_MAX == stBox.AddSchedule(arrNegative, 1));
+	HM_TEST_CHECK(UINT_MAX == stBox.AddSchedule(arrNan, 1) && UINT_MAX == stBox.AddSchedule(arrRamp, 0) && UINT_MAX == stBox.AddSchedule(NULL, 1));
+
+	const int arrProbObj[] = { 1, 2 };
+	const unsigned int arrCount[] = { UINT_MAX - 10, 20 };
+	unsigned int unSchedule = 0;
+	stBox.Modify(arrProbObj, arrCount, 2, 0);
+	stBox.Modify(arrProbObj, arrCount, 2, 5);
+	HM_TEST_CHECK(UINT_MAX - 10 == stBox.GetCount(&arrProbObj[0]) && 0 == stBox.GetCount(&arrProbObj[1], &unSchedule) && UINT_MAX == unSchedule);
+	HM_TEST_CHECK(1 == stBox.AddSchedule(arrStep, 2));
+	stBox.Modify(&arrProbObj[1], &arrCount[1], 1, 1);
+	HM_TEST_CHECK(20 == stBox.GetCount(&arrProbObj[1], &unSchedule) && 1 == unSchedule);
+
+	// A key without std::hash moves between schedules the same way.
+	CHMProbObjScheduleBox<SHMTestKey> stPlain;
+	const SHMTestKey stKey = { 7 };
+	const unsigned int unCount = 4;
+	HM_TEST_CHECK(1 == stPlain.AddSchedule(arrStep, 2));
+	stPlain.Modify(&stKey, &unCount, 1, 0);
+	stPlain.Modify(&stKey, &unCount, 1, 1);
+	SHMTestKey stDrawn = { 0 };
+	HM_TEST_CHECK(4 == stPlain.GetCount(&stKey, &unSchedule) && 1 == unSchedule && 8.0 == stPlain.GetTotal(60) && 0 == stPlain.GetTotal(0));
+	HM_TEST_CHECK(stPlain.Draw(stDrawn, 60, 3) && 7 == stDrawn.nId && !stPlain.Draw(stDrawn, 0, 3));
+}
+
+static void TestRegistry()
+{
+	// Boxes of ids draw as CHMProbObjBox holding the objects themselves, and the inverted
+	// index lists the boxes holding every object.
+	CHMProbObjRegistry<std::string> stRegistry;
+	std::vector<CHMProbObjBox<std::string>> vecReference(5);
+	for (unsigned int b = 0; b < vecReference.size(); b++) HM_TEST_CHECK(b == stRegistry.AddBox());
+
+	std::mt19937 rng(45);
+	for (unsigned int i = 0; i < 4000; i++)
+	{
+		const unsigned int unBox = rng() % 5;
+		const std::string strProbObj = "item" + std::to_string(rng() % 300);
+		const unsigned int unCount = (0 == i % 6) ? 0 : 1 + rng() % 100;
+		stRegistry.Modify(unBox, &strProbObj, &unCount, 1);
+		vecReference[unBox].Modify(&strProbObj, &unCount, 1);
+	}
+
+	// The boxes and the index after a series of changes.
+	const auto fnIsSame = [&stRegistry, &vecReference]()
+	{
+		for (unsigned int b = 0; b < vecReference.size(); b++)
+		{
+			if (stRegistry.GetCount(b) != vecReference[b].GetCount()) return false;
+			for (unsigned int i = 0; i < 3000; i++)
+			{
+				std::string strProbObj, strReference;
+				const bool bDrawn = stRegistry.Draw(b, strProbObj, GetTestRand(i));
+				if (bDrawn != vecReference[b].Draw(strReference, GetTestRand(i)) || strProbObj != strReference) return false;
+			}
+		}
+
+		for (unsigned int i = 0; i < 310; i++)
+		{
+			const std::string strProbObj = "item" + std::to_string(i);
+			std::vector<unsigned int> vecBox;
+			for (unsigned int b = 0; b < vecReference.size(); b++)
+			{
+				if (0 != vecReference[b].GetCount(&strProbObj)) vecBox.push_back(b);
+				if (stRegistry.GetCount(b, &strProbObj) != vecReference[b].GetCount(&strProbObj)) return false;
+			}
+			if (vecBox != stRegistry.FindBoxes(strProbObj)) return false;
+		}
+		return true;
+	};
+	HM_TEST_CHECK(300 >= stRegistry.GetProbObjNum() && fnIsSame());
+
+	// An object set in all its boxes at once, then taken out of all of them.
+	std::string strShared = "item0";
+	for (unsigned int i = 0; 3 > stRegistry.FindBoxes(strShared).size(); i++) strShared = "item" + std::to_string(i);
+	const unsigned int unBoxNum = (unsigned int)stRegistry.FindBoxes(strShared).size();
+	HM_TEST_CHECK(unBoxNum == stRegistry.ModifyInAllBoxes(strShared, 77));
+	for (unsigned int b = 0; b < vecReference.size(); b++)
+	{
+		if (0 == vecReference[b].GetCount(&strShared)) continue;
+		const unsigned int unCount = 77;
+		vecReference[b].Modify(&strShared, &unCount, 1);
+	}
+	HM_TEST_CHECK(fnIsSame());
+
+	const std::vector<unsigned int> vecBox = stRegistry.FindBoxes(strShared);
+	HM_TEST_CHECK(unBoxNum == stRegistry.ModifyInAllBoxes(strShared, 0) && stRegistry.FindBoxes(strShared).empty());
+	for (unsigned int i = 0; i < vecBox.size(); i++)
+	{
+		const unsigned int unZero = 0;
+		vecReference[vecBox[i]].Modify(&strShared, &unZero, 1);
+	}
+	HM_TEST_CHECK(0 == stRegistry.ModifyInAllBoxes(strShared, 5) && UINT_MAX != stRegistry.FindId(strShared) && fnIsSame());
+
+	// A cleared box leaves the index, its objects stay interned with their ids.
+	const unsigned int unProbObjNum = stRegistry.GetProbObjNum();
+	const std::string strFirst = stRegistry.GetProbObj(0);
+	stRegistry.ClearBox(2);
+	vecReference[2].Clear();
+	HM_TEST_CHECK(unProbObjNum == stRegistry.GetProbObjNum() && 0 == stRegistry.FindId(strFirst) && 0 == stRegistry.Intern(strFirst) && fnIsSame());
+
+	// The sampling of a box may be changed through GetBox, and adding boxes moves none.
+	stRegistry.GetBox(1).SetSampling(eHMProbObjBoxSamplingAlias);
+	vecReference[1].SetSampling(eHMProbObjBoxSamplingAlias);
+	const CHMProbObjBox<unsigned int>* pFirstBox = &stRegistry.GetBox(0);
+	for (unsigned int i = 0; i < 1000; i++) stRegistry.AddBox();
+	HM_TEST_CHECK(1005 == stRegistry.GetBoxNum() && pFirstBox == &stRegistry.GetBox(0) && fnIsSame());
+
+	// Edge cases: an empty box, unknown boxes and objects, a count of 0 for an object never
+	// interned, and a count overflowing a box.
+	std::string strDrawn;
+	const std::string strNew = "new", strNever = "never";
+	const unsigned int unZero = 0, unBig = UINT_MAX - 1;
+	stRegistry.Modify(1004, &strNever, &unZero, 1);
+	stRegistry.Modify(5000, &strNew, &unBig, 1);
+	HM_TEST_CHECK(!stRegistry.Draw(1004, strDrawn, 0) && !stRegistry.Draw(5000, strDrawn, 0) && 0 == stRegistry.GetCount(5000));
+	HM_TEST_CHECK(UINT_MAX == stRegistry.FindId(strNever) && UINT_MAX == stRegistry.FindId(strNew) && stRegistry.FindBoxes(strNever).empty());
+	stRegistry.ClearBox(5000);
+
+	stRegistry.Modify(1004, &strNew, &unBig, 1);
+	const std::vector<unsigned int> vecNewBox(1, 1004);
+	HM_TEST_CHECK(unBig == stRegistry.GetCount(1004) && vecNewBox == stRegistry.FindBoxes(strNew));
+	HM_TEST_CHECK(stRegistry.Draw(1004, strDrawn, 5) && strNew == strDrawn && !stRegistry.Draw(1004, strDrawn, -2));
+	stRegistry.Modify(1004, &strFirst, &unBig, 1);
+	const std::vector<unsigned int>& vecFirstBox = stRegistry.FindBoxes(strFirst);
+	HM_TEST_CHECK(0 == stRegistry.GetCount(1004, &strFirst) && vecFirstBox.end() == std::find(vecFirstBox.begin(), vecFirstBox.end(), 1004u));
+}
+
+// The keys of the dense box tests, an enum class with a signed underlying type.
+enum class EHMTestTier : short { Low = -3, Mid = 0, High = 4 };
+
+static void TestDenseBox(const EHMProbObjBoxSampling eSampling)
+{
+	// Keys of [-100, 900] draw as a CHMProbObjBox holding the same entries in key order.
+	typedef CHMDenseProbObjBox<int, -100, 900> CHMTestDenseBox;
+	CHMTestDenseBox stBox;
+	stBox.SetSampling(eSampling);
+	HM_TEST_CHECK(1001 == CHMTestDenseBox::Range() && 0 == stBox.GetMemoryUsage() && eSampling == stBox.GetSampling());
+
+	std::vector<unsigned int> vecCount(1001, 0);
+	std::mt19937 rng(46);
+	for (unsigned int r = 0; r < 3; r++)
+	{
+		for (unsigned int i = 0; i < 2000; i++)
+		{
+			const int nProbObj = -120 + (int)(rng() % 1040);
+			const unsigned int unCount = (0 == i % 4) ? 0 : rng() % 1000;
+			stBox.Modify(&nProbObj, &unCount, 1);
+			if (-100 <= nProbObj && nProbObj <= 900) vecCount[nProbObj + 100] = unCount;
+		}
+		if (1 == r) stBox.Commit();
+
+		CHMProbObjBox<int> stReference;
+		stReference.SetSampling(eSampling);
+		unsigned int unSize = 0;
+		for (int i = 0; i < 1001; i++)
+		{
+			if (0 == vecCount[i]) continue;
+			stReference.Append(i - 100, vecCount[i]);
+			unSize++;
+		}
+		stReference.Commit();
+
+		bool bSameCount = true;
+		for (int i = -120; i < 920; i++) bSameCount = bSameCount && stReference.GetCount(&i) == stBox.GetCount(&i);
+		HM_TEST_CHECK(bSameCount && unSize == stBox.GetSize() && IsSameDraw(stBox, stReference));
+	}
+	HM_TEST_CHECK(1001 * sizeof(unsigned int) <= stBox.GetMemoryUsage());
+
+	// Dump lists the keys with a count in increasing order.
+	CHMTestDenseBox stSmall;
+	std::map<int, unsigned int> mapProbObj;
+	mapProbObj[900] = 3;
+	mapProbObj[-100] = 1;
+	mapProbObj[5] = 0;
+	mapProbObj[901] = 9;
+	stSmall.Modify(mapProbObj);
+	std::stringstream ss;
+	stSmall.Dump(ss);
+	HM_TEST_CHECK(ss.str() == "Current total probability object count 4.\nDense probability object box range -100 to 900\n"
+		"Probability object key -100, count 1.\nProbability object key 900, count 3.\n");
+
+	// Edge cases: an empty box, nRand below -1, totals overflowing and Clear.
+	int nProbObj = 0;
+	const int arrProbObj[] = { 1, 2, 3 };
+	const unsigned int arrCount[] = { UINT_MAX - 10, 11, 10 };
+	CHMTestDenseBox stEmpty;
+	HM_TEST_CHECK(0 == stEmpty.GetCount() && 0 == stEmpty.GetSize() && !stEmpty.Draw(nProbObj, 0));
+	stEmpty.Modify(arrProbObj, arrCount, 3);
+	HM_TEST_CHECK(UINT_MAX == stEmpty.GetCount() && 2 == stEmpty.GetSize() && 0 == stEmpty.GetCount(&arrProbObj[1]));
+	HM_TEST_CHECK(stEmpty.Draw(nProbObj, INT_MAX) && 1 == nProbObj && !stEmpty.Draw(nProbObj, -2));
+	stEmpty.Clear();
+	HM_TEST_CHECK(0 == stEmpty.GetCount() && 0 == stEmpty.GetSize() && !stEmpty.Draw(nProbObj, 0) && 0 == stEmpty.GetMemoryUsage());
+
+	// Enum and narrow keys, with the whole range of signed char.
+	CHMDenseProbObjBox<EHMTestTier, EHMTestTier::Low, EHMTestTier::High> stTier;
+	const EHMTestTier arrTier[] = { EHMTestTier::Low, EHMTestTier::High };
+	const unsigned int arrTierCount[] = { 2, 3 };
+	stTier.SetSampling(eSampling);
+	stTier.Modify(arrTier, arrTierCount, 2);
+	EHMTestTier eTier = EHMTestTier::Mid;
+	HM_TEST_CHECK(8 == stTier.Range() && stTier.Draw(eTier, 1) && EHMTestTier::Low == eTier && stTier.Draw(eTier, 2) && EHMTestTier::High == eTier);
+
+	CHMDenseProbObjBox<signed char, -128, 127> stChar;
+	stChar.SetSampling(eSampling);
+	for (int i = -128; i < 128; i++)
+	{
+		const signed char cProbObj = (signed char)i;
+		const unsigned int unCount = 1;
+		stChar.Modify(&cProbObj, &unCount, 1);
+	}
+	bool bExact = true;
+	for (int k = 0; k < 256; k++)
+	{
+		signed char cProbObj = 0;
+		bExact = bExact && stChar.Draw(cProbObj, k) && ((eHMProbObjBoxSamplingAlias == eSampling) || k - 128 == cProbObj);
+	}
+	HM_TEST_CHECK(256 == stChar.Range() && 256 == stChar.GetSize() && bExact);
+}
+
+static void TestCompactWeight()
+{
+	// The compact alias table is exact while total / size < 65535, and is saved, loaded
+	// and built on several threads as the full one.
+	TestIndexExactness(eHMProbObjBoxSamplingAliasCompact);
+	TestIndexSnapshot(eHMProbObjBoxSamplingAliasCompact);
+	TestParallelBuild(eHMProbObjBoxSamplingAliasCompact);
+
+	CHMProbObjBox<int> stFull, stCompact;
+	stFull.SetSampling(eHMProbObjBoxSamplingAlias);
+	stCompact.SetSampling(eHMProbObjBoxSamplingAliasCompact);
+	FillBox(stFull, 100000, 97, 47);
+	FillBox(stCompact, 100000, 97, 47);
+	HM_TEST_CHECK(stCompact.GetMemoryUsage() < stFull.GetMemoryUsage());
+
+	// Beyond that, every object is drawn for its count of keys give or take total * 2^-16.
+	CHMProbObjBox<int> stWide;
+	stWide.SetSampling(eHMProbObjBoxSamplingAliasCompact);
+	FillBox(stWide, 10, 2000000, 48);
+	std::vector<unsigned int> vecDrawn(10, 0);
+	int nProbObj = -1;
+	for (unsigned int k = 0; k < stWide.GetCount(); k++)
+	{
+		if (stWide.Draw(nProbObj, (int)k) && 0 <= nProbObj && nProbObj < 10) vecDrawn[nProbObj]++;
+	}
+	bool bClose = true;
+	for (int i = 0; i < 10; i++) bClose = bClose && std::fabs((double)vecDrawn[i] - stWide.GetCount(&i)) <= stWide.GetCount() / 65536.0;
+	HM_TEST_CHECK(bClose && 65535 <= stWide.GetCount() / 10);
+
+	// Counts of 8 and 16 bits draw as with unsigned int counts, in a smaller pool.
+	CHMProbObjBox<int> stReference;
+	CHMProbObjBox<int, unsigned char> stByte;
+	CHMProbObjBox<int, unsigned short> stShort;
+	FillBox(stReference, 5000, 255, 49);
+	FillBox(stByte, 5000, 255, 49);
+	FillBox(stShort, 5000, 255, 49);
+	HM_TEST_CHECK(IsSameDraw(stByte, stReference) && IsSameDraw(stShort, stReference));
+	CHMProbObjBox<short> stWideShort;
+	CHMProbObjBox<short, unsigned short> stNarrowShort;
+	for (short i = 0; i < 5000; i++)
+	{
+		stWideShort.Append(i, 1 + i % 255);
+		stNarrowShort.Append(i, 1 + i % 255);
+	}
+	HM_TEST_CHECK(2 * stNarrowShort.GetMemoryUsage() <= stWideShort.GetMemoryUsage());
+
+	const EHMProbObjBoxSampling arrSampling[] = { eHMProbObjBoxSamplingPrefix, eHMProbObjBoxSamplingAlias, eHMProbObjBoxSamplingAliasCompact };
+	for (unsigned int i = 0; i < sizeof(arrSampling) / sizeof(arrSampling[0]); i++)
+	{
+		stReference.SetSampling(arrSampling[i]);
+		stShort.SetSampling(arrSampling[i]);
+		HM_TEST_CHECK(IsSameDraw(stShort, stReference) && IsExactDraw(stShort));
+	}
+
+	// Counts which do not fit the count type are refused, and a snapshot loads only into a
+	// box of the same count type.
+	const int nKey = 1;
+	const unsigned int unFits = 255, unTooBig = 256;
+	const unsigned int unTotal = stByte.GetCount(), unOld = stByte.GetCount(&nKey);
+	HM_TEST_CHECK(!stByte.Append(-1, unTooBig) && stByte.Append(-1, unFits) && unTotal + 255 == stByte.GetCount());
+	stByte.Modify(&nKey, &unTooBig, 1);
+	HM_TEST_CHECK(unOld == stByte.GetCount(&nKey));
+
+	std::stringstream ss;
+	CHMProbObjBox<int, unsigned char> stByteLoaded;
+	HM_TEST_CHECK(stByte.Save(ss) && stByteLoaded.Load(ss) && stByte.GetPool() == stByteLoaded.GetPool());
+	std::stringstream ssOther(ss.str());
+	CHMProbObjBox<int> stOther;
+	HM_TEST_CHECK(!stOther.Load(ssOther) && 0 == stOther.GetCount());
+}
+
+static void TestSimulator()
+{
+	CHMProbObjBox<int> stBox;
+	FillBox(stBox, 50, 100, 5);
+	const auto fnIsTarget = [](const int& nProbObj) { return nProbObj < 2; };
+	const int arrTarget[] = { 0, 1 };
+	const double dProb = (double)(stBox.GetCount(&arrTarget[0]) + stBox.GetCount(&arrTarget[1])) / stBox.GetCount();
+
+	CHMProbObjPityBox<int> stPityBox;
+	HM_TEST_CHECK(stPityBox.Bind(stBox, fnIsTarget));
+	stPityBox.SetPity(20, 200, 40);
+
+	for (unsigned int b = 0; b < 2; b++)
+	{
+		CHMProbObjSimulator<int> stSimulator;
+		HM_TEST_CHECK((0 == b) ? stSimulator.Bind(stBox) : stSimulator.Bind(stPityBox));
+
+		// The same seed gives the same result on any number of threads.
+		SHMProbObjSimResult stSingle, stMulti, stExact;
+		HM_TEST_CHECK(stSimulator.Simulate(fnIsTarget, 20000, 60, stSingle, 17, 1) && 20000 == stSingle.unPlayerNum && 60 == stSingle.vecFirstHit.size());
+		for (unsigned int unThreadNum = 2; unThreadNum <= 8; unThreadNum *= 2)
+		{
+			HM_TEST_CHECK(stSimulator.Simulate(fnIsTarget, 20000, 60, stMulti, 17, unThreadNum));
+			HM_TEST_CHECK(stSingle.vecFirstHit == stMulti.vecFirstHit && stSingle.dHitMean == stMulti.dHitMean);
+		}
+		HM_TEST_CHECK(stSimulator.Simulate(fnIsTarget, 20000, 60, stMulti, 18, 4) && stSingle.vecFirstHit != stMulti.vecFirstHit);
+
+		// And it is close to the exact result.
+		HM_TEST_CHECK(stSimulator.Solve(fnIsTarget, 60, stExact) && 0 == stExact.unPlayerNum);
+		std::vector<double> vecSimCurve, vecExactCurve;
+		CHMProbObjSimulator<int>::GetDropCurve(stSingle, vecSimCurve);
+		CHMProbObjSimulator<int>::GetDropCurve(stExact, vecExactCurve);
+		double dDiff = 0;
+		for (size_t i = 0; i < vecSimCurve.size() && i < vecExactCurve.size(); i++) dDiff = std::max(dDiff, std::fabs(vecSimCurve[i] - vecExactCurve[i]));
+		HM_TEST_CHECK(vecSimCurve.size() == vecExactCurve.size() && dDiff < 0.02);
+		HM_TEST_CHECK(std::fabs(stSingle.dHitMean - stExact.dHitMean) < 0.05 * stExact.dHitMean);
+
+		if (0 == b)
+		{
+			// Pulls from a plain box are independent: the first hit is geometric, a player
+			// hits 60 * p times on average.
+			bool bGeometric = true;
+			for (unsigned int m = 0; m < 60; m++) bGeometric = bGeometric && std::fabs(stExact.vecFirstHit[m] - std::pow(1 - dProb, m) * dProb) < 1e-12;
+			const unsigned int unPercentile = (unsigned int)std::ceil(std::log(0.05) / std::log(1 - dProb));
+			HM_TEST_CHECK(bGeometric && std::fabs(stExact.dHitMean - 60 * dProb) < 1e-9);
+			HM_TEST_CHECK(((unPercentile <= 60) ? unPercentile : UINT_MAX) == CHMProbObjSimulator<int>::GetPercentile(stExact, 0.95));
+		}
+		else
+		{
+			// With hard pity at pull 40 every player has the top tier by then, in the
+			// simulation as in the exact result.
+			HM_TEST_CHECK(std::fabs(vecExactCurve[39] - 1) < 1e-12 && 1 == vecSimCurve[39] && 40 >= CHMProbObjSimulator<int>::GetPercentile(stSingle, 1.0));
+		}
+		HM_TEST_CHECK(UINT_MAX == CHMProbObjSimulator<int>::GetPercentile(stExact, 1.5));
+
+		// A throwing predicate fails the simulation on any thread.
+		auto fnThrow = [](const int& nProbObj) -> bool
+			{
+				if (10 == nProbObj) throw std::runtime_error("target predicate");
+				return false;
+			};
+		HM_TEST_CHECK(!stSimulator.Simulate(fnThrow, 20000, 60, stMulti, 17, 4));
+
+		// No player, no pull or a seed below -1 fail, and an unbound simulator fails.
+		HM_TEST_CHECK(!stSimulator.Simulate(fnIsTarget, 0, 60, stMulti, 17) && !stSimulator.Simulate(fnIsTarget, 10, 0, stMulti, 17));
+		HM_TEST_CHECK(!stSimulator.Simulate(fnIsTarget, 10, 60, stMulti, -2) && !stSimulator.Solve(fnIsTarget, 0, stExact));
+		stSimulator.Unbind();
+		HM_TEST_CHECK(!stSimulator.Simulate(fnIsTarget, 10, 60, stMulti, 17) && !stSimulator.Solve(fnIsTarget, 60, stExact));
+	}
+
+	// An empty box can not be bound.
+	CHMProbObjBox<int> stEmpty;
+	CHMProbObjPityBox<int> stEmptyPity;
+	CHMProbObjSimulator<int> stSimulator;
+	HM_TEST_CHECK(!stSimulator.Bind(stEmpty) && (!stEmptyPity.Bind(stEmpty, fnIsTarget) || !stSimulator.Bind(stEmptyPity)));
+}
+
+#if __cplusplus >= 202002L
+// The key of Draws for the next value of a generator, uniform in [0, unTotal).
+template <typename TRng>
+static unsigned int NextDrawsKey(TRng& tRng, const unsigned int unTotal)
+{
+	if constexpr (TRng::max() - TRng::min() >= 0xFFFFFFFFull)
+	{
+		const unsigned int unReject = (0u - unTotal) % unTotal;
+		unsigned long long ullProduct = 0;
+		do
+		{
+			ullProduct = (unsigned long long)(unsigned int)(tRng() - TRng::min()) * unTotal;
+		} while ((unsigned int)ullProduct < unReject);
+		return (unsigned int)(ullProduct >> 32);
+	}
+	else
+	{
+		return std::uniform_int_distribution<unsigned int>(0, unTotal - 1)(tRng);
+	}
+}
+
+// Whether Draws gives, batch after batch, the objects Draw gives for the keys of the
+// same generator.
+template <typename TRng>
+static bool IsSameDraws(CHMProbObjBox<int>& stBox, const unsigned int unBatch, const unsigned int unDrawNum)
+{
+	TRng tRng(unBatch), tReferenceRng(unBatch);
+	unsigned int unDrawn = 0;
+	for (const int nProbObj : stBox.Draws(tRng, unBatch) | std::views::take(unDrawNum))
+	{
+		int nReference = -1;
+		if (!stBox.Draw(nReference, (int)NextDrawsKey(tReferenceRng, stBox.GetCount())) || nProbObj != nReference) return false;
+		unDrawn++;
+	}
+	return unDrawNum == unDrawn;
+}
+
+static void TestDraws()
+{
+	// Every batch size and sampling maps the keys of the generator as Draw does.
+	const EHMProbObjBoxSampling arrSampling[] = { eHMProbObjBoxSamplingLinear, eHMProbObjBoxSamplingPrefix, eHMProbObjBoxSamplingAlias };
+	for (unsigned int i = 0; i < sizeof(arrSampling) / sizeof(arrSampling[0]); i++)
+	{
+		CHMProbObjBox<int> stBox;
+		stBox.SetSampling(arrSampling[i]);
+		FillBox(stBox, 3000, 1000, 48);
+		HM_TEST_CHECK(IsSameDraws<std::mt19937>(stBox, 1, 500) && IsSameDraws<std::mt19937>(stBox, 7, 3000) && IsSameDraws<std::mt19937>(stBox, 256, 5000));
+		HM_TEST_CHECK(IsSameDraws<std::minstd_rand>(stBox, 256, 5000) && IsSameDraws<std::mt19937_64>(stBox, 100, 5000));
+	}
+
+	// The range keeps the pool it was taken from while the box changes, a batch of 0
+	// draws one at a time.
+	CHMProbObjBox<int> stBox;
+	FillBox(stBox, 10, 5, 49);
+	std::mt19937 rng(1);
+	auto vwDraws = stBox.Draws(rng, 0);
+	auto it = vwDraws.begin();
+	stBox.Clear();
+	const int nOnly = 99;
+	const unsigned int unOnly = 1;
+	stBox.Modify(&nOnly, &unOnly, 1);
+	bool bKept = true;
+	for (unsigned int i = 0; i < 1000 && bKept; i++, ++it) bKept = vwDraws.end() != it && 0 <= *it && *it < 10;
+	HM_TEST_CHECK(bKept);
+
+	// The same under background rebuilds, which share the published pool.
+	CHMProbObjBox<int> stBackground;
+	stBackground.SetRebuildPolicy(eHMProbObjBoxRebuildBackground);
+	FillBox(stBackground, 10, 5, 50);
+	auto vwBackground = stBackground.Draws(rng);
+	stBackground.Modify(&nOnly, &unOnly, 1);
+	stBackground.Commit();
+	unsigned int unTaken = 0;
+	bKept = true;
+	for (const int nProbObj : vwBackground | std::views::take(2000))
+	{
+		bKept = bKept && 0 <= nProbObj && nProbObj < 10;
+		unTaken++;
+	}
+	HM_TEST_CHECK(bKept && 2000 == unTaken);
+
+	// The range of an empty box is empty.
+	CHMProbObjBox<int> stEmpty;
+	auto vwEmpty = stEmpty.Draws(rng);
+	HM_TEST_CHECK(vwEmpty.end() == vwEmpty.begin());
+}
+#endif
+
+// Whether the queries of a box agree with its pool: the probability of every object, the
+// entropy, the top objects and the CDF at and between the objects.
+static bool IsSameQuery(const CHMProbObjBox<int>& stBox, const int nKeyMin, const int nKeyMax)
+{
+	const std::vector<std::pair<int, unsigned int>>& vecPool = stBox.GetPool();
+	const double dTotal = stBox.GetCount();
+	double dEntropy = 0;
+	for (const auto& prProbObj : vecPool) dEntropy -= prProbObj.second / dTotal * std::log2(prProbObj.second / dTotal);
+	if (std::fabs(dEntropy - stBox.Entropy()) > 1e-9) return false;
+
+	std::vector<std::pair<int, unsigned int>> vecTop = vecPool;
+	std::stable_sort(vecTop.begin(), vecTop.end(), [](const std::pair<int, unsigned int>& prLeft, const std::pair<int, unsigned int>& prRight)
+		{
+			return prLeft.second > prRight.second;
+		});
+	std::vector<std::pair<int, double>> vecTopK;
+	if (!stBox.TopK(10, vecTopK) || std::min<size_t>(10, vecTop.size()) != vecTopK.size()) return false;
+	for (size_t i = 0; i < vecTopK.size(); i++)
+	{
+		if (vecTop[i].first != vecTopK[i].first || vecTop[i].second / dTotal != vecTopK[i].second) return false;
+	}
+
+	unsigned int unCumulative = 0;
+	for (int i = nKeyMin; i <= nKeyMax; i++)
+	{
+		const unsigned int unCount = stBox.GetCount(&i);
+		unCumulative += unCount;
+		if (unCount / dTotal != stBox.Probability(i) || unCumulative / dTotal != stBox.CDF(i)) return false;
+	}
+	return 0 == stBox.CDF(nKeyMin - 1) && 1 == stBox.CDF(nKeyMax + 1);
+}
+
+static void TestQuery()
+{
+	// Queries agree with the pool, and are built again after every kind of change.
+	CHMProbObjBox<int> stBox;
+	std::mt19937 rng(50);
+	std::vector<int> vecKey(3000);
+	for (int i = 0; i < 3000; i++) vecKey[i] = i * 2 + 1;
+	std::shuffle(vecKey.begin(), vecKey.end(), rng);
+	for (unsigned int i = 0; i < 1000; i++) stBox.Append(vecKey[i], 1 + rng() % 20);
+	HM_TEST_CHECK(IsSameQuery(stBox, 0, 6001) && IsExactDraw(stBox));
+
+	const std::vector<std::pair<int, unsigned int>> vecPool = stBox.GetPool();
+	const int nFirst = vecPool.front().first;
+	const unsigned int unFirst = 1000;
+	stBox.Modify(&nFirst, &unFirst, 1);
+	HM_TEST_CHECK(IsSameQuery(stBox, 0, 6001) && (double)unFirst / stBox.GetCount() == stBox.Probability(nFirst));
+	const unsigned int unZero = 0;
+	stBox.Modify(&nFirst, &unZero, 1);
+	HM_TEST_CHECK(0 == stBox.Probability(nFirst) && IsSameQuery(stBox, 0, 6001));
+	stBox.Append(-5, 3);
+	HM_TEST_CHECK(IsSameQuery(stBox, -6, 6001));
+
+	std::stringstream ss;
+	CHMProbObjBox<int> stLoaded;
+	stLoaded.Append(7, 7);
+	HM_TEST_CHECK(1 == stLoaded.Probability(7) && stBox.Save(ss) && stLoaded.Load(ss) && 0 == stLoaded.Probability(7) && IsSameQuery(stLoaded, -6, 6001));
+
+	// Ties keep pool order, k beyond the size lists all, k of 0 none.
+	CHMProbObjBox<int> stTied;
+	const int arrProbObj[] = { 9, 3, 5, 1 };
+	const unsigned int arrCount[] = { 2, 4, 2, 4 };
+	stTied.Modify(arrProbObj, arrCount, 4);
+	std::vector<std::pair<int, double>> vecTopK;
+	HM_TEST_CHECK(stTied.TopK(100, vecTopK) && 4 == vecTopK.size() && 3 == vecTopK[0].first && 1 == vecTopK[1].first && 9 == vecTopK[2].first && 5 == vecTopK[3].first);
+	HM_TEST_CHECK(stTied.TopK(0, vecTopK) && vecTopK.empty());
+	HM_TEST_CHECK(std::fabs(stTied.Entropy() - (1.0 / 3 + std::log2(3.0))) < 1e-12 && 1.0 / 3 == stTied.CDF(2) && 8.0 / 12 == stTied.CDF(3));
+
+	// An empty box has no probabilities and no top objects, a box of one object no entropy.
+	CHMProbObjBox<int> stEmpty;
+	HM_TEST_CHECK(0 == stEmpty.Probability(1) && 0 == stEmpty.Entropy() && 0 == stEmpty.CDF(1) && !stEmpty.TopK(3, vecTopK) && vecTopK.empty());
+	stEmpty.Append(1, 5);
+	HM_TEST_CHECK(1 == stEmpty.Probability(1) && 0 == stEmpty.Entropy() && 0 == stEmpty.CDF(0) && 1 == stEmpty.CDF(1));
+	stEmpty.Clear();
+	HM_TEST_CHECK(0 == stEmpty.Probability(1) && 0 == stEmpty.Entropy() && !stEmpty.TopK(3, vecTopK));
+
+	// Objects without std::hash or operator< are found by a scan, and strings are ordered.
+	CHMProbObjBox<SHMTestKey> stPlain;
+	const SHMTestKey arrKey[] = { { 1 }, { 2 } };
+	const unsigned int arrKeyCount[] = { 1, 3 };
+	stPlain.Modify(arrKey, arrKeyCount, 2);
+	std::vector<std::pair<SHMTestKey, double>> vecPlainTop;
+	HM_TEST_CHECK(0.75 == stPlain.Probability(arrKey[1]) && stPlain.TopK(1, vecPlainTop) && 2 == vecPlainTop[0].first.nId);
+
+	CHMProbObjBox<std::string> stString;
+	stString.Append("b", 1);
+	stString.Append("a", 1);
+	stString.Append("c", 2);
+	HM_TEST_CHECK(0.25 == stString.CDF("a") && 0.5 == stString.CDF("bz") && 1 == stString.CDF("d") && 0 == stString.CDF("") && 0.5 == stString.Probability("c"));
+}
+
+int main()
+{
+	TestFixedBox();
+	TestSnapshot();
+	TestView();
+	TestLoader();
+	TestVerifier();
+	TestIndex();
+	TestParallelBuild(eHMProbObjBoxSamplingPrefix);
+	TestParallelBuild(eHMProbObjBoxSamplingAlias);
+	TestTreeBox();
+	TestDrawIf(eHMProbObjBoxSamplingLinear);
+	TestDrawIf(eHMProbObjBoxSamplingPrefix);
+	TestDrawIf(eHMProbObjBoxSamplingAlias);
+	TestSampleDistinct();
+	TestWeightedShuffle();
+	TestOverlayBox(eHMProbObjBoxSamplingLinear);
+	TestOverlayBox(eHMProbObjBoxSamplingPrefix);
+	TestOverlayBox(eHMProbObjBoxSamplingAlias);
+	TestVersionedBox();
+	TestScheduleBox(eHMProbObjBoxSamplingLinear);
+	TestScheduleBox(eHMProbObjBoxSamplingAlias);
+	TestRegistry();
+	TestDenseBox(eHMProbObjBoxSamplingLinear);
+	TestDenseBox(eHMProbObjBoxSamplingPrefix);
+	TestDenseBox(eHMProbObjBoxSamplingAlias);
+	TestCompactWeight();
+#if __cplusplus >= 202002L
+	TestDraws();
+#endif
+	TestSimulator();
+	TestQuery();
+
+	printf("%u checks, %u failed.\n", s_unCheckNum, s_unFailNum);
+	return (0 == s_unFailNum) ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+#pragma once
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <exception>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////////////
+// CHMProbObjSplitMix is a small splitmix64 generator. Draws which need more than one
+// random value seed it from their nRand (or rand() for -1), so a given nRand still
+// always draws the same result.
+class CHMProbObjSplitMix
+{
+public:
+	explicit CHMProbObjSplitMix(const unsigned long long ullSeed) : m_ullState(ullSeed) {};
+	~CHMProbObjSplitMix() {};
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the next 64-bit random value.
+	unsigned long long Next()
+	{
+		unsigned long long ullValue = (m_ullState += 0x9E3779B97F4A7C15ull);
+		ullValue = (ullValue ^ (ullValue >> 30)) * 0xBF58476D1CE4E5B9ull;
+		ullValue = (ullValue ^ (ullValue >> 27)) * 0x94D049BB133111EBull;
+		return ullValue ^ (ullValue >> 31);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Skip values, as if Next had been called ullNum times.
+	void Discard(const unsigned long long ullNum) { m_ullState += ullNum * 0x9E3779B97F4A7C15ull; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get a random value in [0, unBound), unBound must not be 0. The bias is
+	//				below 2^-32.
+	unsigned int NextBelow(const unsigned int unBound)
+	{
+		return (unsigned int)(((Next() >> 32) * unBound) >> 32);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get a random value in (0, 1), never 0 or 1.
+	double NextOpen()
+	{
+		return ((Next() >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+	}
+
+private:
+	unsigned long long m_ullState;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+// CHMProbObjFenwick keeps the counts of a list of slots in a Fenwick tree, so a count
+// can be changed and a key found in O(log n). Slots are only appended, a slot with
+// count 0 is never found.
+class CHMProbObjFenwick
+{
+public:
+	CHMProbObjFenwick() : m_unTotal(0) {};
+	~CHMProbObjFenwick() {};
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Append a slot.
+	// unCount:		The count of the slot.
+	// Return:		None. The caller keeps the total below UINT_MAX.
+	void Append(const unsigned int unCount)
+	{
+		// Tree slot i (1-based) holds the counts of (i - lowbit(i), i].
+		const unsigned int unIndex = (unsigned int)m_vecTree.size() + 1;
+		const unsigned int unSum = GetPrefix(unIndex - 1) - GetPrefix(unIndex - (unIndex & (0u - unIndex)));
+		m_vecTree.push_back(unSum + unCount);
+		try
+		{
+			m_vecCount.push_back(unCount);
+		}
+		catch (...)
+		{
+			m_vecTree.pop_back();
+			throw;
+		}
+		m_unTotal += unCount;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Remove the last slot. No tree slot before it covers it.
+	// Return:		None.
+	void PopBack()
+	{
+		if (m_vecCount.empty()) return;
+
+		m_unTotal -= m_vecCount.back();
+		m_vecTree.pop_back();
+		m_vecCount.pop_back();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Set the count of a slot.
+	// unPos:		The slot, it must be less than GetSize().
+	// unCount:		The new count.
+	// Return:		None. The caller keeps the total below UINT_MAX.
+	void Set(const unsigned int unPos, const unsigned int unCount)
+	{
+		// Unsigned arithmetic wraps, so adding the difference also works when it shrinks.
+		const unsigned int unDelta = unCount - m_vecCount[unPos];
+		for (unsigned int i = unPos + 1; i <= m_vecTree.size(); i += i & (0u - i)) m_vecTree[i - 1] += unDelta;
+		m_vecCount[unPos] = unCount;
+		m_unTotal += unDelta;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the sum of the counts of the slots before unPos.
+	unsigned int GetPrefix(unsigned int unPos) const
+	{
+		unsigned int unSum = 0;
+		for (; 0 != unPos; unPos -= unPos & (0u - unPos)) unSum += m_vecTree[unPos - 1];
+		return unSum;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Find the slot a key falls in.
+	// unKey:		The key, it must be less than GetTotal(). It is left as the offset of
+	//				the key within the slot found.
+	// Return:		The slot.
+	unsigned int Find(unsigned int& unKey) const
+	{
+		unsigned int unStep = 1, unPos = 0;
+		while (unStep <= m_vecTree.size() / 2) unStep <<= 1;
+		for (; 0 != unStep; unStep >>= 1)
+		{
+			if (unPos + unStep <= m_vecTree.size() && m_vecTree[unPos + unStep - 1] <= unKey)
+			{
+				unPos += unStep;
+				unKey -= m_vecTree[unPos - 1];
+			}
+		}
+		return unPos;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Clear all slots.
+	void Clear()
+	{
+		std::vector<unsigned int>().swap(m_vecTree);
+		std::vector<unsigned int>().swap(m_vecCount);
+		m_unTotal = 0;
+	}
+
+	unsigned int GetCount(const unsigned int unPos) const { return m_vecCount[unPos]; }
+	unsigned int GetTotal() const { return m_unTotal; }
+	unsigned int GetSize() const { return (unsigned int)m_vecCount.size(); }
+	size_t GetMemoryUsage() const { return (m_vecTree.capacity() + m_vecCount.capacity()) * sizeof(unsigned int); }
+
+private:
+	std::vector<unsigned int> m_vecTree;
+	std::vector<unsigned int> m_vecCount;
+	unsigned int m_unTotal;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+// CHMProbObjParallel splits work over a range into blocks run on their own threads,
+// for index builds and shuffles of big pools.
+class CHMProbObjParallel
+{
+public:
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the number of blocks to split a range into.
+	// unThreadNum:	The most threads to use, 0 means one per hardware thread.
+	// unLen:		The length of the range.
+	// unBlockMin:	The shortest block worth a thread of its own.
+	// Return:		The number of blocks, at least 1.
+	static unsigned int GetBlockNum(unsigned int unThreadNum, const size_t unLen, const size_t unBlockMin)
+	{
+		if (0 == unThreadNum) unThreadNum = std::max(1u, std::thread::hardware_concurrency());
+		return (unsigned int)std::max<size_t>(1, std::min<size_t>(unThreadNum, unLen / std::max<size_t>(1, unBlockMin)));
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the first position of a block when unLen positions are split into
+	//				unBlockNum blocks.
+	static unsigned int GetBlockBegin(const size_t unLen, const unsigned int unBlockNum, const unsigned int unBlock)
+	{
+		return (unsigned int)((unsigned long long)unLen * unBlock / unBlockNum);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Run fnBlock(0) .. fnBlock(unBlockNum - 1), block 0 on the calling thread.
+	//				Blocks which can not get a thread run on the calling thread too. An
+	//				exception of a block is caught where it runs, and once every thread is
+	//				joined the one of the first failed block is thrown again.
+	// Return:		None, after all blocks are done.
+	template <typename TFunc>
+	static void Run(const unsigned int unBlockNum, const TFunc& fnBlock)
+	{
+		std::vector<std::exception_ptr> vecException(unBlockNum);
+		auto fnCatchBlock = [&fnBlock, &vecException](const unsigned int unBlock)
+			{
+				try
+				{
+					fnBlock(unBlock);
+				}
+				catch (...)
+				{
+					vecException[unBlock] = std::current_exception();
+				}
+			};
+
+		std::vector<std::thread> vecThread;
+		unsigned int unBlock = 1;
+		try
+		{
+			vecThread.reserve(unBlockNum);
+			for (; unBlock < unBlockNum; unBlock++) vecThread.emplace_back(fnCatchBlock, unBlock);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+		}
+
+		fnCatchBlock(0);
+		for (unsigned int i = unBlock; i < unBlockNum; i++) fnCatchBlock(i);
+		for (auto it = vecThread.begin(); it != vecThread.end(); it++) it->join();
+		for (auto it = vecException.cbegin(); it != vecException.cend(); it++)
+		{
+			if (*it) std::rethrow_exception(*it);
+		}
+	}
+};
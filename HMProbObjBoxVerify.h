@@ -0,0 +1,259 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "HMProbObjBox.h"
+
+//////////////////////////////////////////////////////////////////////////////////////
+// Result of CHMProbObjBoxVerifier::Verify.
+struct SHMProbObjVerifyResult
+{
+	unsigned long long ullDrawNum;			// Draws done.
+	unsigned long long ullFailedDrawNum;	// Draws which failed or returned an object not in the pool.
+	double dDrawsPerSec;					// Draws per second over all threads.
+	double dChiSquare;						// Pearson chi-square of the histogram against the pool weights,
+											// entries expected less than 5 times pooled into one bin.
+	unsigned long long ullDegreesOfFreedom;	// The number of bins less 1.
+	double dChiSquarePValue;
+	double dKSStatistic;					// Largest CDF distance, in pool order.
+	double dKSPValue;						// Asymptotic, conservative for a discrete distribution.
+	double dModuloBias;						// Largest relative bias of 'nRand % total' for a 31-bit nRand.
+	double dRandModuloBias;					// Same for nRand == -1, which uses rand().
+	bool bRandCoversTotal;					// Whether rand() can reach every count of the box at all.
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+// Result of CHMProbObjBoxVerifier::CheckRegression.
+struct SHMProbObjVerifyRegression
+{
+	bool bDistributionRegressed;	// The distribution test failed now but passed in the baseline.
+	bool bThroughputRegressed;		// Draws per second dropped more than allowed.
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+// CHMProbObjBoxVerifier checks that the draws of a box follow its weights. It runs
+// the draws on several threads, each with its own RNG stream and histogram, merges the
+// histograms once at the end, and tests them against GetPool() with a chi-square and
+// a Kolmogorov-Smirnov test. Drawn objects are mapped back to pool entries with THash,
+// so every object in the pool should be unique.
+template <typename T1, typename THash = std::hash<T1>>
+class CHMProbObjBoxVerifier
+{
+public:
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Draw from a box many times and test the histogram against its weights.
+	//				The index of the box is committed first, and the box must not be
+	//				modified while this runs.
+	// t1ProbObjBox:The box to verify.
+	// ullDrawNum:	The number of draws, split over all threads.
+	// unThreadNum:	The number of threads, 0 means one per hardware thread.
+	// ullSeed:		The seed of the RNG streams, thread i uses ullSeed + i.
+	// Return:		The result.
+	template <typename TWeight>
+	static SHMProbObjVerifyResult Verify(CHMProbObjBox<T1, TWeight>& t1ProbObjBox, const unsigned long long ullDrawNum,
+		unsigned int unThreadNum = 0, const unsigned long long ullSeed = 0)
+	{
+		SHMProbObjVerifyResult stResult = SHMProbObjVerifyResult();
+		t1ProbObjBox.Commit();
+		const auto& vecProbObjPool = t1ProbObjBox.GetPool();
+		const unsigned int unTotal = t1ProbObjBox.GetCount();
+
+		stResult.dModuloBias = ModuloBias(0x80000000ull, unTotal);
+		stResult.dRandModuloBias = ModuloBias((unsigned long long)RAND_MAX + 1, unTotal);
+		stResult.bRandCoversTotal = ((unsigned long long)RAND_MAX + 1 >= unTotal);
+		if (vecProbObjPool.empty() || 0 == ullDrawNum) return stResult;
+
+		std::unordered_map<T1, unsigned int, THash> mapProbObjIndex;
+		mapProbObjIndex.reserve(vecProbObjPool.size());
+		for (unsigned int i = 0; i < vecProbObjPool.size(); i++) mapProbObjIndex.emplace(vecProbObjPool[i].first, i);
+
+		if (0 == unThreadNum) unThreadNum = std::max(1u, std::thread::hardware_concurrency());
+		std::vector<std::vector<unsigned long long>> vecHistogram(unThreadNum);
+		std::vector<unsigned long long> vecFailed(unThreadNum, 0);
+		std::vector<std::thread> vecThread;
+
+		auto fnWorker = [&](const unsigned int unThread, const unsigned long long ullThreadDrawNum)
+		{
+			std::vector<unsigned long long>& vecLocal = vecHistogram[unThread];
+			vecLocal.assign(vecProbObjPool.size(), 0);
+			std::mt19937_64 rng(ullSeed + unThread);
+			T1 t1ProbObj = vecProbObjPool[0].first;
+			for (unsigned long long i = 0; i < ullThreadDrawNum; i++)
+			{
+				auto it = mapProbObjIndex.end();
+				if (t1ProbObjBox.Draw(t1ProbObj, (int)(rng() >> 33))) it = mapProbObjIndex.find(t1ProbObj);
+				if (mapProbObjIndex.end() == it) vecFailed[unThread]++;
+				else vecLocal[it->second]++;
+			}
+		};
+
+		std::chrono::steady_clock::time_point tpBegin = std::chrono::steady_clock::now();
+		for (unsigned int i = 0; i < unThreadNum; i++)
+		{
+			vecThread.emplace_back(fnWorker, i, ullDrawNum / unThreadNum + (i < ullDrawNum % unThreadNum ? 1 : 0));
+		}
+		for (auto it = vecThread.begin(); it != vecThread.end(); it++) it->join();
+		const double dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tpBegin).count();
+
+		std::vector<unsigned long long> vecObserved(vecProbObjPool.size(), 0);
+		for (unsigned int i = 0; i < unThreadNum; i++)
+		{
+			for (size_t j = 0; j < vecObserved.size(); j++) vecObserved[j] += vecHistogram[i][j];
+			stResult.ullFailedDrawNum += vecFailed[i];
+		}
+
+		stResult.ullDrawNum = ullDrawNum;
+		stResult.dDrawsPerSec = (dSeconds > 0) ? ullDrawNum / dSeconds : 0;
+
+		const unsigned long long ullHitNum = ullDrawNum - stResult.ullFailedDrawNum;
+		// The chi-square distribution only fits bins expected at least 5 times, so rarer
+		// entries are pooled into one bin, which joins the smallest other bin if it is
+		// still too small.
+		std::vector<std::pair<double, double>> vecBin;
+		std::pair<double, double> prRareBin(0, 0);
+		double dCdfObserved = 0, dCdfExpected = 0;
+		vecBin.reserve(vecObserved.size());
+		for (size_t i = 0; i < vecObserved.size(); i++)
+		{
+			const double dProb = (double)vecProbObjPool[i].second / unTotal;
+			const double dExpected = dProb * ullHitNum;
+			if (dExpected >= m_scdMinBinExpected) vecBin.push_back(std::make_pair((double)vecObserved[i], dExpected));
+			else
+			{
+				prRareBin.first += vecObserved[i];
+				prRareBin.second += dExpected;
+			}
+
+			dCdfObserved += (0 == ullHitNum) ? 0 : (double)vecObserved[i] / ullHitNum;
+			dCdfExpected += dProb;
+			stResult.dKSStatistic = std::max(stResult.dKSStatistic, std::fabs(dCdfObserved - dCdfExpected));
+		}
+		if (prRareBin.second >= m_scdMinBinExpected || (vecBin.empty() && prRareBin.second > 0)) vecBin.push_back(prRareBin);
+		else if (prRareBin.second > 0)
+		{
+			auto itSmallest = std::min_element(vecBin.begin(), vecBin.end(),
+				[](const std::pair<double, double>& prLeft, const std::pair<double, double>& prRight) { return prLeft.second < prRight.second; });
+			itSmallest->first += prRareBin.first;
+			itSmallest->second += prRareBin.second;
+		}
+
+		for (auto it = vecBin.cbegin(); it != vecBin.cend(); it++) stResult.dChiSquare += (it->first - it->second) * (it->first - it->second) / it->second;
+		stResult.ullDegreesOfFreedom = vecBin.empty() ? 0 : vecBin.size() - 1;
+		stResult.dChiSquarePValue = (0 == stResult.ullDegreesOfFreedom) ? 1.0 : GammaQ(stResult.ullDegreesOfFreedom / 2.0, stResult.dChiSquare / 2.0);
+		stResult.dKSPValue = KolmogorovQ(std::sqrt((double)ullHitNum) * stResult.dKSStatistic);
+		return stResult;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Compare a result with a baseline result of an earlier build.
+	// stResult:	The current result.
+	// stBaseline:	The baseline result.
+	// dMinPValue:	The distribution test fails when a p-value drops below this.
+	// dMaxSlowdown:The largest allowed relative drop of draws per second.
+	// Return:		Which regressions were found.
+	static SHMProbObjVerifyRegression CheckRegression(const SHMProbObjVerifyResult& stResult, const SHMProbObjVerifyResult& stBaseline,
+		const double dMinPValue = 0.001, const double dMaxSlowdown = 0.1)
+	{
+		SHMProbObjVerifyRegression stRegression;
+		stRegression.bDistributionRegressed = !IsDistributionOk(stResult, dMinPValue) && IsDistributionOk(stBaseline, dMinPValue);
+		stRegression.bThroughputRegressed = stResult.dDrawsPerSec < stBaseline.dDrawsPerSec * (1 - dMaxSlowdown);
+		return stRegression;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Check whether a result passes the distribution tests.
+	// stResult:	The result.
+	// dMinPValue:	The smallest p-value accepted.
+	// Return:		Return true if no draw failed and both tests pass.
+	static bool IsDistributionOk(const SHMProbObjVerifyResult& stResult, const double dMinPValue = 0.001)
+	{
+		return 0 == stResult.ullFailedDrawNum && stResult.dChiSquarePValue >= dMinPValue && stResult.dKSPValue >= dMinPValue;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Format a result as one JSON line.
+	// stResult:	The result.
+	// Return:		The JSON line, without line break.
+	static std::string ToJson(const SHMProbObjVerifyResult& stResult)
+	{
+		char szLine[512];
+		snprintf(szLine, sizeof(szLine), "{\"draws\":%llu,\"failed_draws\":%llu,\"draws_per_sec\":%.1f,\"chi_square\":%.4f,"
+			"\"dof\":%llu,\"chi_square_p\":%.6g,\"ks\":%.6g,\"ks_p\":%.6g,\"modulo_bias\":%.6g,\"rand_modulo_bias\":%.6g,"
+			"\"rand_covers_total\":%s}",
+			stResult.ullDrawNum, stResult.ullFailedDrawNum, stResult.dDrawsPerSec, stResult.dChiSquare,
+			stResult.ullDegreesOfFreedom, stResult.dChiSquarePValue, stResult.dKSStatistic, stResult.dKSPValue,
+			stResult.dModuloBias, stResult.dRandModuloBias, stResult.bRandCoversTotal ? "true" : "false");
+		return szLine;
+	}
+
+private:
+	static constexpr double m_scdMinBinExpected = 5.0;
+
+	// With R random values folded onto unTotal counts, R % unTotal counts get one more
+	// value than the others, so their relative bias is 1 / (R / unTotal).
+	static double ModuloBias(const unsigned long long ullRange, const unsigned int unTotal)
+	{
+		if (0 == unTotal || 0 == ullRange % unTotal) return 0;
+		if (ullRange < unTotal) return 1;
+		return 1.0 / (double)(ullRange / unTotal);
+	}
+
+	// Regularized upper incomplete gamma Q(a, x), by series for x < a + 1 and by
+	// continued fraction otherwise.
+	static double GammaQ(const double dA, const double dX)
+	{
+		if (dX <= 0) return 1.0;
+
+		const double dLogPrefix = dA * std::log(dX) - dX - std::lgamma(dA);
+		if (dX < dA + 1)
+		{
+			double dTerm = 1.0 / dA, dSum = dTerm;
+			for (int i = 1; i < 100000; i++)
+			{
+				dTerm *= dX / (dA + i);
+				dSum += dTerm;
+				if (std::fabs(dTerm) < std::fabs(dSum) * 1e-15) break;
+			}
+			return std::max(0.0, 1.0 - dSum * std::exp(dLogPrefix));
+		}
+
+		const double dTiny = 1e-300;
+		double dB = dX + 1 - dA, dC = 1 / dTiny, dD = 1 / dB, dH = dD;
+		for (int i = 1; i < 100000; i++)
+		{
+			const double dAn = -i * (i - dA);
+			dB += 2;
+			dD = dAn * dD + dB;
+			if (std::fabs(dD) < dTiny) dD = dTiny;
+			dC = dB + dAn / dC;
+			if (std::fabs(dC) < dTiny) dC = dTiny;
+			dD = 1 / dD;
+			const double dDelta = dD * dC;
+			dH *= dDelta;
+			if (std::fabs(dDelta - 1) < 1e-15) break;
+		}
+		return std::min(1.0, std::exp(dLogPrefix) * dH);
+	}
+
+	// Survival function of the Kolmogorov distribution.
+	static double KolmogorovQ(const double dLambda)
+	{
+		if (dLambda < 0.2) return 1.0;
+
+		double dSum = 0;
+		for (int i = 1; i <= 100; i++)
+		{
+			const double dTerm = std::exp(-2.0 * i * i * dLambda * dLambda);
+			dSum += (i % 2 ? 2 : -2) * dTerm;
+			if (dTerm < 1e-16) break;
+		}
+		return std::min(1.0, std::max(0.0, dSum));
+	}
+};
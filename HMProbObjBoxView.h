@@ -0,0 +1,293 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+#include "HMProbObjBox.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////
+// CHMProbObjBoxView is a read-only box served straight from a memory-mapped table
+// file. The file holds the keys, the counts and the prefix sums of the counts as
+// three flat arrays, so opening a view costs no parsing or copying, and every
+// process mapping the same file shares its physical pages. Build the file with
+// CHMProbObjBoxView<T1>::Write from a CHMProbObjBox<T1> of any count type, the file
+// keeps 32-bit counts. T1 must be trivially copyable.
+template <typename T1>
+class CHMProbObjBoxView
+{
+	static_assert(std::is_trivially_copyable<T1>::value, "CHMProbObjBoxView needs a trivially copyable T1.");
+
+public:
+	CHMProbObjBoxView() : m_pMapping(NULL), m_ullMappingSize(0), m_unProbObjNum(0), m_unCurrentProbObjCount(0),
+		m_pProbObjKey(NULL), m_pProbObjCount(NULL), m_pProbObjPrefix(NULL)
+	{
+#ifdef _WIN32
+		m_hFile = INVALID_HANDLE_VALUE;
+		m_hMapping = NULL;
+#endif
+	}
+	~CHMProbObjBoxView() { Close(); }
+
+	CHMProbObjBoxView(const CHMProbObjBoxView&) = delete;
+	CHMProbObjBoxView& operator=(const CHMProbObjBoxView&) = delete;
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Write a table file of a box, which can be opened by CHMProbObjBoxView.
+	// t1ProbObjBox:The box to write.
+	// szFileName:	The file to write, it will be truncated.
+	// Return:		Return true if succeed, false if failed.
+	template <typename TWeight>
+	static bool Write(const CHMProbObjBox<T1, TWeight>& t1ProbObjBox, const char* const szFileName)
+	{
+		if (NULL == szFileName) return false;
+
+		const auto& vecProbObjPool = t1ProbObjBox.GetPool();
+		const unsigned long long ullProbObjNum = vecProbObjPool.size();
+
+		SHMProbObjBoxViewHeader stHeader;
+		memset(&stHeader, 0, sizeof(stHeader));
+		stHeader.unMagic = m_scunViewMagic;
+		stHeader.unVersion = m_scunCHMProbObjBoxViewVersion;
+		stHeader.unKeySize = (unsigned int)sizeof(T1);
+		stHeader.unProbObjNum = (unsigned int)ullProbObjNum;
+		stHeader.unTotalCount = t1ProbObjBox.GetCount();
+		stHeader.ullKeyOffset = AlignUp(sizeof(stHeader), alignof(T1));
+		stHeader.ullCountOffset = AlignUp(stHeader.ullKeyOffset + ullProbObjNum * sizeof(T1), alignof(unsigned int));
+		stHeader.ullPrefixOffset = stHeader.ullCountOffset + ullProbObjNum * sizeof(unsigned int);
+
+		std::ofstream ofs(szFileName, std::ios::binary | std::ios::trunc);
+		if (!ofs.is_open()) return false;
+
+		ofs.write(reinterpret_cast<const char*>(&stHeader), sizeof(stHeader));
+		WritePadding(ofs, stHeader.ullKeyOffset - sizeof(stHeader));
+		for (auto it = vecProbObjPool.cbegin(); it != vecProbObjPool.cend(); it++)
+		{
+			ofs.write(reinterpret_cast<const char*>(&it->first), sizeof(T1));
+		}
+		WritePadding(ofs, stHeader.ullCountOffset - stHeader.ullKeyOffset - ullProbObjNum * sizeof(T1));
+		for (auto it = vecProbObjPool.cbegin(); it != vecProbObjPool.cend(); it++)
+		{
+			const unsigned int unCount = it->second;
+			ofs.write(reinterpret_cast<const char*>(&unCount), sizeof(unsigned int));
+		}
+		unsigned int unTop = 0;
+		for (auto it = vecProbObjPool.cbegin(); it != vecProbObjPool.cend(); it++)
+		{
+			unTop += it->second;
+			ofs.write(reinterpret_cast<const char*>(&unTop), sizeof(unsigned int));
+		}
+		return ofs.good();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Map a table file written by Write. An opened view is closed first.
+	// szFileName:	The file to map.
+	// Return:		Return true if succeed, false if failed.
+	bool Open(const char* const szFileName)
+	{
+		Close();
+		if (NULL == szFileName) return false;
+
+		if (!MapFile(szFileName) || !Attach())
+		{
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Unmap the table file, the view becomes empty.
+	// Return:		None.
+	void Close()
+	{
+#ifdef _WIN32
+		if (NULL != m_pMapping) UnmapViewOfFile(m_pMapping);
+		if (NULL != m_hMapping) CloseHandle(m_hMapping);
+		if (INVALID_HANDLE_VALUE != m_hFile) CloseHandle(m_hFile);
+		m_hMapping = NULL;
+		m_hFile = INVALID_HANDLE_VALUE;
+#else
+		if (NULL != m_pMapping) munmap(m_pMapping, (size_t)m_ullMappingSize);
+#endif
+		m_pMapping = NULL;
+		m_ullMappingSize = 0;
+		m_unProbObjNum = 0;
+		m_unCurrentProbObjCount = 0;
+		m_pProbObjKey = NULL;
+		m_pProbObjCount = NULL;
+		m_pProbObjPrefix = NULL;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Draw a probability object from this view, same as CHMProbObjBox::Draw.
+	// t1ProbObj:	If this call succeed, the drawn probability object will be put into
+	//				t1ProbObj.
+	// nRand:		It decides which probability object will be drawn. It should be a positive
+	//				random int value(recommended), or -1.
+	// Return:		Return true if succeed, false if failed.
+	bool Draw(T1& t1ProbObj, const int nRand = -1) const
+	{
+		if (0 == m_unCurrentProbObjCount) return false;
+		if (nRand < 0 && -1 != nRand) return false;
+
+		unsigned int unRand = (0 > nRand) ? rand() : nRand;
+		unsigned int unKeyNum = unRand % m_unCurrentProbObjCount;
+
+		const unsigned int* pTop = std::upper_bound(m_pProbObjPrefix, m_pProbObjPrefix + m_unProbObjNum, unKeyNum);
+		if (pTop == m_pProbObjPrefix + m_unProbObjNum) return false;
+
+		memcpy(&t1ProbObj, m_pProbObjKey + (pTop - m_pProbObjPrefix), sizeof(T1));
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get particular or total probability objects counts, depend on pProbObj.
+	// pProbObj:	A pointer of the specific probability object, if it == NULL, get the
+	//				total count.
+	// Return:		The count.
+	unsigned int GetCount(const T1* const pProbObj = NULL) const
+	{
+		if (NULL == pProbObj) return m_unCurrentProbObjCount;
+
+		for (unsigned int i = 0; i < m_unProbObjNum; i++)
+		{
+			if (*pProbObj == m_pProbObjKey[i]) return m_pProbObjCount[i];
+		}
+		return 0;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the number of probability objects in this view.
+	// Return:		The number of probability objects.
+	unsigned int GetSize() const { return m_unProbObjNum; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Check whether a table file is mapped.
+	// Return:		Return true if a table file is mapped.
+	bool IsOpen() const { return NULL != m_pMapping; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the version of CHMProbObjBoxView, which is also its file format tag.
+	// Return:		A unsigned int stands for the version.
+	unsigned int Version() const { return m_scunCHMProbObjBoxViewVersion; }
+
+private:
+	struct SHMProbObjBoxViewHeader
+	{
+		unsigned int unMagic;
+		unsigned int unVersion;
+		unsigned int unKeySize;
+		unsigned int unProbObjNum;
+		unsigned int unTotalCount;
+		unsigned int unReserved;
+		unsigned long long ullKeyOffset;
+		unsigned long long ullCountOffset;
+		unsigned long long ullPrefixOffset;
+	};
+
+	void* m_pMapping;
+	unsigned long long m_ullMappingSize;
+	unsigned int m_unProbObjNum;
+	unsigned int m_unCurrentProbObjCount;
+	const T1* m_pProbObjKey;
+	const unsigned int* m_pProbObjCount;
+	const unsigned int* m_pProbObjPrefix;
+#ifdef _WIN32
+	HANDLE m_hFile;
+	HANDLE m_hMapping;
+#endif
+	static const unsigned int m_scunViewMagic = 0x56504D48;	// "HMPV"
+	static const unsigned int m_scunCHMProbObjBoxViewVersion = 1;
+
+	static unsigned long long AlignUp(const unsigned long long ullOffset, const unsigned long long ullAlign)
+	{
+		return (ullOffset + ullAlign - 1) / ullAlign * ullAlign;
+	}
+
+	static void WritePadding(std::ofstream& ofs, unsigned long long ullLen)
+	{
+		for (; ullLen > 0; ullLen--) ofs.put(0);
+	}
+
+	bool MapFile(const char* const szFileName)
+	{
+#ifdef _WIN32
+		m_hFile = CreateFileA(szFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (INVALID_HANDLE_VALUE == m_hFile) return false;
+
+		LARGE_INTEGER stFileSize;
+		if (!GetFileSizeEx(m_hFile, &stFileSize) || 0 == stFileSize.QuadPart) return false;
+
+		m_hMapping = CreateFileMappingA(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (NULL == m_hMapping) return false;
+
+		m_pMapping = MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+		if (NULL == m_pMapping) return false;
+		m_ullMappingSize = (unsigned long long)stFileSize.QuadPart;
+#else
+		int nFd = open(szFileName, O_RDONLY);
+		if (0 > nFd) return false;
+
+		struct stat stFileStat;
+		if (0 != fstat(nFd, &stFileStat) || 0 == stFileStat.st_size)
+		{
+			close(nFd);
+			return false;
+		}
+
+		void* pMapping = mmap(NULL, (size_t)stFileStat.st_size, PROT_READ, MAP_SHARED, nFd, 0);
+		close(nFd);
+		if (MAP_FAILED == pMapping) return false;
+
+		m_pMapping = pMapping;
+		m_ullMappingSize = (unsigned long long)stFileStat.st_size;
+#endif
+		return true;
+	}
+
+	bool Attach()
+	{
+		if (sizeof(SHMProbObjBoxViewHeader) > m_ullMappingSize) return false;
+
+		const SHMProbObjBoxViewHeader* pHeader = static_cast<const SHMProbObjBoxViewHeader*>(m_pMapping);
+		if (m_scunViewMagic != pHeader->unMagic || m_scunCHMProbObjBoxViewVersion != pHeader->unVersion) return false;
+		if (sizeof(T1) != pHeader->unKeySize) return false;
+		if (0 != pHeader->ullKeyOffset % alignof(T1) || 0 != pHeader->ullCountOffset % alignof(unsigned int)
+			|| 0 != pHeader->ullPrefixOffset % alignof(unsigned int)) return false;
+
+		// The offsets come from the file, so they are checked in order against the mapping
+		// first, and the array sizes are compared with their differences, which can not wrap.
+		const unsigned long long ullProbObjNum = pHeader->unProbObjNum;
+		if (pHeader->ullKeyOffset < sizeof(SHMProbObjBoxViewHeader) || pHeader->ullCountOffset < pHeader->ullKeyOffset
+			|| pHeader->ullPrefixOffset < pHeader->ullCountOffset || pHeader->ullPrefixOffset > m_ullMappingSize) return false;
+		if (ullProbObjNum * sizeof(T1) > pHeader->ullCountOffset - pHeader->ullKeyOffset) return false;
+		if (ullProbObjNum * sizeof(unsigned int) > pHeader->ullPrefixOffset - pHeader->ullCountOffset) return false;
+		if (ullProbObjNum * sizeof(unsigned int) > m_ullMappingSize - pHeader->ullPrefixOffset) return false;
+
+		const char* pBase = static_cast<const char*>(m_pMapping);
+		m_pProbObjKey = reinterpret_cast<const T1*>(pBase + pHeader->ullKeyOffset);
+		m_pProbObjCount = reinterpret_cast<const unsigned int*>(pBase + pHeader->ullCountOffset);
+		m_pProbObjPrefix = reinterpret_cast<const unsigned int*>(pBase + pHeader->ullPrefixOffset);
+		m_unProbObjNum = pHeader->unProbObjNum;
+		m_unCurrentProbObjCount = pHeader->unTotalCount;
+
+		// The total has to agree with the prefix sums, or Draw could run past the table.
+		if (0 != m_unProbObjNum && m_pProbObjPrefix[m_unProbObjNum - 1] != m_unCurrentProbObjCount) return false;
+		if (0 == m_unProbObjNum && 0 != m_unCurrentProbObjCount) return false;
+		return true;
+	}
+};
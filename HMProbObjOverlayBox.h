@@ -0,0 +1,219 @@
+#pragma once
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "HMProbObjBox.h"
+
+//////////////////////////////////////////////////////////////////////////////////////
+// CHMProbObjOverlayBox is a per-player view of a shared CHMProbObjBox: it keeps only the
+// entries whose counts differ from the base, and objects the base does not hold, so
+// a player costs bytes instead of a copy of the pool.
+//
+// The keys of a draw are laid out as the keys of the base in pool order with the keys
+// of the overridden base entries cut out, followed by the keys of the overrides. A key
+// in the base part is moved past the cut-out ranges before it and found in the base,
+// so a draw is O(d + log n) with d overrides on a base with prefix sampling, and
+// O(d + n) on other bases.
+//
+// The base must outlive the overlay and must not be modified while overlays reference
+// it. Commit the base before drawing from overlays on several threads.
+template <typename T1, typename TWeight = unsigned int>
+class CHMProbObjOverlayBox
+{
+public:
+	explicit CHMProbObjOverlayBox(const CHMProbObjBox<T1, TWeight>& t1BaseBox) : m_pBaseBox(&t1BaseBox), m_unBaseRestCount(t1BaseBox.GetCount()),
+		m_unOverrideCount(0) {};
+	~CHMProbObjOverlayBox() {};
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Draw a probability object from this overlay.
+	// t1ProbObj:	If this call succeed, the drawn probability object will be put into
+	//				t1ProbObj.
+	// nRand:		It decides which probability object will be drawn. It should be a positive
+	//				random int value(recommended), or -1.
+	// Return:		Return true if succeed, false if failed.
+	bool Draw(T1& t1ProbObj, const int nRand = -1) const
+	{
+		const unsigned int unTotal = GetCount();
+		if (0 == unTotal) return false;
+		if (nRand < 0 && -1 != nRand) return false;
+
+		unsigned int unRand = (0 > nRand) ? rand() : nRand;
+		unsigned int unKeyNum = unRand % unTotal;
+
+		if (unKeyNum < m_unBaseRestCount)
+		{
+			// The overrides of base entries are sorted by position, so their cut-out key
+			// ranges are in key order.
+			for (auto it = m_vecOverride.cbegin(); it != m_vecOverride.cend() && UINT_MAX != it->unPos && unKeyNum >= it->unBaseKey; it++)
+			{
+				unKeyNum += it->unBaseCount;
+			}
+			return m_pBaseBox->FindByKey(t1ProbObj, unKeyNum);
+		}
+
+		unKeyNum -= m_unBaseRestCount;
+		for (auto it = m_vecOverride.cbegin(); it != m_vecOverride.cend(); it++)
+		{
+			if (unKeyNum < it->unCount)
+			{
+				t1ProbObj = it->t1ProbObj;
+				return true;
+			}
+			unKeyNum -= it->unCount;
+		}
+		return false;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Modify probability objects of this overlay, the base is not changed.
+	// t1ProbObj:	A pointer to the storage of object that you want to modify.
+	// pCount:		A pointer to the storage of every object's new count.
+	// unLen:		The length of storage.
+	// Return:		None.
+	void Modify(const T1* const t1ProbObj, const unsigned int* const pCount, const unsigned int unLen = 1)
+	{
+		if (NULL == t1ProbObj || NULL == pCount || 0 == unLen) return;
+
+		for (unsigned int i = 0; i < unLen; i++)
+		{
+			ModifyOverride(t1ProbObj[i], pCount[i]);
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Modify probability objects of this overlay, the base is not changed.
+	// t2ProbObj:	A user-defined container which contains the probability objects and
+	//				their counts we want.
+	// Return:		None.
+	template <typename T2>
+	void Modify(const T2& t2ProbObj)
+	{
+		for (auto it = t2ProbObj.cbegin(); it != t2ProbObj.cend(); it++)
+		{
+			ModifyOverride(it->first, it->second);
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Drop the override of a probability object, so it has its base count again.
+	// t1ProbObj:	The probability object.
+	// Return:		None.
+	void Restore(const T1& t1ProbObj)
+	{
+		for (auto it = m_vecOverride.begin(); it != m_vecOverride.end(); it++)
+		{
+			if (t1ProbObj == it->t1ProbObj)
+			{
+				m_unBaseRestCount += it->unBaseCount;
+				m_unOverrideCount -= it->unCount;
+				m_vecOverride.erase(it);
+				return;
+			}
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Drop all overrides, so this overlay draws as its base.
+	// Return:		None.
+	void Clear()
+	{
+		std::vector<SHMProbObjOverride>().swap(m_vecOverride);
+		m_unBaseRestCount = m_pBaseBox->GetCount();
+		m_unOverrideCount = 0;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get particular or total probability objects counts, depend on pProbObj.
+	// pProbObj:	A pointer of the specific probability object, if it == NULL, get the
+	//				total count.
+	// Return:		The count.
+	unsigned int GetCount(const T1* const pProbObj = NULL) const
+	{
+		if (NULL == pProbObj) return m_unBaseRestCount + m_unOverrideCount;
+
+		for (auto it = m_vecOverride.cbegin(); it != m_vecOverride.cend(); it++)
+		{
+			if (*pProbObj == it->t1ProbObj) return it->unCount;
+		}
+		return m_pBaseBox->GetCount(pProbObj);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the number of overrides, including objects the base does not hold.
+	unsigned int GetOverrideNum() const { return (unsigned int)m_vecOverride.size(); }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the memory held by this overlay, in bytes, without the base.
+	size_t GetMemoryUsage() const { return sizeof(*this) + m_vecOverride.capacity() * sizeof(SHMProbObjOverride); }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the version of CHMProbObjOverlayBox.
+	// Return:		A unsigned int stands for the version.
+	unsigned int Version() const { return m_scunCHMProbObjOverlayBoxVersion; }
+
+private:
+	struct SHMProbObjOverride
+	{
+		T1 t1ProbObj;
+		unsigned int unPos;			// The base pool position, UINT_MAX if not in the base.
+		unsigned int unBaseKey;		// The first base key of the base entry.
+		unsigned int unBaseCount;	// The base count, cut out of the base keys.
+		unsigned int unCount;		// The count in this overlay, 0 if removed.
+	};
+
+	const CHMProbObjBox<T1, TWeight>* m_pBaseBox;
+	std::vector<SHMProbObjOverride> m_vecOverride;	// Base entries by position, then new objects.
+	unsigned int m_unBaseRestCount;					// The base total without overridden entries.
+	unsigned int m_unOverrideCount;
+	static const unsigned int m_scunProbObjBoxCapacity = UINT_MAX;
+	static const unsigned int m_scunCHMProbObjOverlayBoxVersion = 1;
+
+	void ModifyOverride(const T1& t1ProbObj, const unsigned int unCount)
+	{
+		for (auto it = m_vecOverride.begin(); it != m_vecOverride.end(); it++)
+		{
+			if (t1ProbObj == it->t1ProbObj)
+			{
+				if (m_scunProbObjBoxCapacity - unCount >= GetCount() - it->unCount)
+				{
+					m_unOverrideCount = m_unOverrideCount - it->unCount + unCount;
+					it->unCount = unCount;
+				}
+				return;
+			}
+		}
+
+		SHMProbObjOverride stOverride = { t1ProbObj, UINT_MAX, 0, 0, unCount };
+		const std::vector<std::pair<T1, TWeight>>& vecBasePool = m_pBaseBox->GetPool();
+		for (unsigned int i = 0; i < vecBasePool.size(); i++)
+		{
+			if (t1ProbObj == vecBasePool[i].first)
+			{
+				stOverride.unPos = i;
+				stOverride.unBaseCount = vecBasePool[i].second;
+				break;
+			}
+			stOverride.unBaseKey += vecBasePool[i].second;
+		}
+		if (UINT_MAX == stOverride.unPos && 0 == unCount) return;
+		if (m_scunProbObjBoxCapacity - unCount < GetCount() - stOverride.unBaseCount) return;
+
+		try
+		{
+			auto itPos = std::find_if(m_vecOverride.begin(), m_vecOverride.end(), [&stOverride](const SHMProbObjOverride& stOther)
+				{
+					return stOther.unPos > stOverride.unPos;
+				});
+			m_vecOverride.insert(itPos, stOverride);
+			m_unBaseRestCount -= stOverride.unBaseCount;
+			m_unOverrideCount += unCount;
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+		}
+	}
+};
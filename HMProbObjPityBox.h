@@ -0,0 +1,223 @@
+#pragma once
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "HMProbObjBox.h"
+#include "HMProbObjBoxUtil.h"
+
+//////////////////////////////////////////////////////////////////////////////////////
+// Pity counters of one player, kept by the caller. 4 bytes, so millions of players can
+// share one CHMProbObjPityBox.
+struct SHMProbObjPityState
+{
+	unsigned int unPullNum;		// Pulls since the last top tier object.
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+// CHMProbObjPityBox draws from a CHMProbObjBox with soft and hard pity on a top tier of
+// its objects, without modifying it. The top tier objects and the others keep their
+// pool positions and prefix sums here. A draw adds the pity ramp to the top tier count
+// virtually, so with top count T, other count R and ramp r the top tier is drawn with
+// probability (T + r) / (T + r + R), and the objects within a tier by their counts.
+// Draw is const, so any number of threads may draw for their players at once.
+//
+// The box must outlive this and must not be modified while bound, Bind again after
+// modifying it.
+template <typename T1, typename TWeight = unsigned int>
+class CHMProbObjPityBox
+{
+public:
+	CHMProbObjPityBox() : m_pProbObjPool(NULL), m_unTopCount(0), m_unRestCount(0), m_unSoftPity(0), m_unRampCount(0), m_unHardPity(0) {};
+	~CHMProbObjPityBox() {};
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Bind this to a box and split its objects into the top tier and the rest.
+	// t1ProbObjBox:The box to draw from.
+	// fnIsTop:		A callable bool(const T1&), true for a top tier object.
+	// Return:		Return true if succeed. If failed, this is left unbound.
+	template <typename TPred>
+	bool Bind(const CHMProbObjBox<T1, TWeight>& t1ProbObjBox, const TPred& fnIsTop)
+	{
+		Unbind();
+
+		const std::vector<std::pair<T1, TWeight>>& vecProbObjPool = t1ProbObjBox.GetPool();
+		if (vecProbObjPool.empty()) return false;
+
+		try
+		{
+			for (unsigned int i = 0; i < vecProbObjPool.size(); i++)
+			{
+				if (fnIsTop(vecProbObjPool[i].first)) AppendPos(m_vecTopPos, m_vecTopPrefix, m_unTopCount, i, vecProbObjPool[i].second);
+				else AppendPos(m_vecRestPos, m_vecRestPrefix, m_unRestCount, i, vecProbObjPool[i].second);
+			}
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			Unbind();
+			return false;
+		}
+
+		m_pProbObjPool = &vecProbObjPool;
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Unbind this from its box.
+	// Return:		None.
+	void Unbind()
+	{
+		m_pProbObjPool = NULL;
+		m_unTopCount = 0;
+		m_unRestCount = 0;
+		std::vector<unsigned int>().swap(m_vecTopPos);
+		std::vector<unsigned int>().swap(m_vecTopPrefix);
+		std::vector<unsigned int>().swap(m_vecRestPos);
+		std::vector<unsigned int>().swap(m_vecRestPrefix);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Set the pity rules. The rules stay when binding another box.
+	// unSoftPity:	The first pull whose top tier count is ramped, 0 means no soft pity.
+	//				With unSoftPity 74, pull 74 after the last top tier object adds
+	//				unRampCount, pull 75 adds 2 * unRampCount, and so on.
+	// unRampCount:	The count added to the top tier per pull from unSoftPity on, in the
+	//				counts of the box.
+	// unHardPity:	The pull which always draws the top tier, 0 means no hard pity.
+	// Return:		None.
+	void SetPity(const unsigned int unSoftPity, const unsigned int unRampCount, const unsigned int unHardPity)
+	{
+		m_unSoftPity = unSoftPity;
+		m_unRampCount = unRampCount;
+		m_unHardPity = unHardPity;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Draw a probability object for a player and update the pity counter.
+	// stState:		The pity counters of the player. The counter is reset when the top tier
+	//				is drawn and counts up otherwise.
+	// t1ProbObj:	If this call succeed, the drawn probability object will be put into
+	//				t1ProbObj.
+	// nRand:		It decides which probability object will be drawn. It should be a positive
+	//				random int value(recommended), or -1.
+	// Return:		Return true if succeed, false if failed. stState is kept if failed.
+	bool Draw(SHMProbObjPityState& stState, T1& t1ProbObj, const int nRand = -1) const
+	{
+		if (NULL == m_pProbObjPool) return false;
+		if (nRand < 0 && -1 != nRand) return false;
+
+		unsigned int unRand = (0 > nRand) ? rand() : nRand;
+		const unsigned int unTopCount = GetTopCount(stState);
+		const unsigned int unRestCount = (0 != m_unTopCount && IsHardPity(stState)) ? 0 : m_unRestCount;
+		unsigned int unKeyNum = unRand % (unTopCount + unRestCount);
+
+		if (unKeyNum >= unTopCount)
+		{
+			t1ProbObj = (*m_pProbObjPool)[FindPos(m_vecRestPos, m_vecRestPrefix, unKeyNum - unTopCount)].first;
+			stState.unPullNum = (UINT_MAX == stState.unPullNum) ? UINT_MAX : stState.unPullNum + 1;
+			return true;
+		}
+
+		// Keys beyond the real top tier count belong to the ramp, they pick a top tier
+		// object with a new key.
+		if (unKeyNum >= m_unTopCount) unKeyNum = CHMProbObjSplitMix(unRand).NextBelow(m_unTopCount);
+		t1ProbObj = (*m_pProbObjPool)[FindPos(m_vecTopPos, m_vecTopPrefix, unKeyNum)].first;
+		stState.unPullNum = 0;
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the top tier count the next pull of a player is drawn with.
+	// stState:		The pity counters of the player.
+	// Return:		The ramped count, or the real top tier count before soft pity and at
+	//				hard pity, where the other objects are left out.
+	unsigned int GetTopCount(const SHMProbObjPityState& stState) const
+	{
+		if (0 == m_unTopCount || 0 == m_unRestCount) return m_unTopCount;
+
+		const unsigned long long ullPull = (unsigned long long)stState.unPullNum + 1;
+		if (0 != m_unHardPity && ullPull >= m_unHardPity) return m_unTopCount;
+		if (0 == m_unSoftPity || ullPull < m_unSoftPity) return m_unTopCount;
+
+		const unsigned long long ullTopCount = m_unTopCount + (ullPull - m_unSoftPity + 1) * m_unRampCount;
+		return (unsigned int)std::min<unsigned long long>(ullTopCount, UINT_MAX - m_unRestCount);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the probability that the next pull of a player draws the top tier.
+	// stState:		The pity counters of the player.
+	// Return:		The probability.
+	double GetTopProbability(const SHMProbObjPityState& stState) const
+	{
+		if (0 == m_unTopCount) return 0;
+		if (IsHardPity(stState)) return 1;
+		return (double)GetTopCount(stState) / ((double)GetTopCount(stState) + m_unRestCount);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the real count of the top tier and of the other objects.
+	unsigned int GetTopCount() const { return m_unTopCount; }
+	unsigned int GetRestCount() const { return m_unRestCount; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the real counts of the objects a predicate accepts, in the top tier
+	//				and in the rest.
+	// fnPred:		A callable bool(const T1&).
+	// unTopCount:	The count of the accepted top tier objects is put into it.
+	// unRestCount:	The count of the other accepted objects is put into it.
+	// Return:		None.
+	template <typename TPred>
+	void GetCountIf(const TPred& fnPred, unsigned int& unTopCount, unsigned int& unRestCount) const
+	{
+		unTopCount = 0;
+		unRestCount = 0;
+		if (NULL == m_pProbObjPool) return;
+
+		for (auto it = m_vecTopPos.cbegin(); it != m_vecTopPos.cend(); it++)
+		{
+			if (fnPred((*m_pProbObjPool)[*it].first)) unTopCount += (*m_pProbObjPool)[*it].second;
+		}
+		for (auto it = m_vecRestPos.cbegin(); it != m_vecRestPos.cend(); it++)
+		{
+			if (fnPred((*m_pProbObjPool)[*it].first)) unRestCount += (*m_pProbObjPool)[*it].second;
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the version of CHMProbObjPityBox.
+	// Return:		A unsigned int stands for the version.
+	unsigned int Version() const { return m_scunCHMProbObjPityBoxVersion; }
+
+private:
+	const std::vector<std::pair<T1, TWeight>>* m_pProbObjPool;
+	std::vector<unsigned int> m_vecTopPos;
+	std::vector<unsigned int> m_vecTopPrefix;
+	std::vector<unsigned int> m_vecRestPos;
+	std::vector<unsigned int> m_vecRestPrefix;
+	unsigned int m_unTopCount;
+	unsigned int m_unRestCount;
+	unsigned int m_unSoftPity;
+	unsigned int m_unRampCount;
+	unsigned int m_unHardPity;
+	static const unsigned int m_scunCHMProbObjPityBoxVersion = 1;
+
+	bool IsHardPity(const SHMProbObjPityState& stState) const
+	{
+		return 0 != m_unHardPity && (unsigned long long)stState.unPullNum + 1 >= m_unHardPity;
+	}
+
+	static void AppendPos(std::vector<unsigned int>& vecPos, std::vector<unsigned int>& vecPrefix, unsigned int& unCount,
+		const unsigned int unPos, const unsigned int unPosCount)
+	{
+		vecPos.push_back(unPos);
+		vecPrefix.push_back(unCount + unPosCount);
+		unCount += unPosCount;
+	}
+
+	static unsigned int FindPos(const std::vector<unsigned int>& vecPos, const std::vector<unsigned int>& vecPrefix, const unsigned int unKeyNum)
+	{
+		return vecPos[std::upper_bound(vecPrefix.cbegin(), vecPrefix.cend(), unKeyNum) - vecPrefix.cbegin()];
+	}
+};
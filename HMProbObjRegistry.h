@@ -0,0 +1,238 @@
+#pragma once
+#include <algorithm>
+#include <climits>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+#include "HMProbObjBox.h"
+
+//////////////////////////////////////////////////////////////////////////////////////
+// CHMProbObjRegistry holds many boxes over a common catalogue of objects. Every object
+// is interned once and gets a 32-bit id, and the boxes are CHMProbObjBox<unsigned int>
+// of ids, so a box entry costs 8 bytes whatever T1 is. An inverted index lists the
+// boxes holding every id, for FindBoxes and for updating an object in all its boxes.
+//
+// Boxes are changed through the registry only, so the inverted index stays right.
+template <typename T1, typename THash = std::hash<T1>>
+class CHMProbObjRegistry
+{
+public:
+	CHMProbObjRegistry() {};
+	~CHMProbObjRegistry() {};
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Intern a probability object.
+	// t1ProbObj:	The probability object.
+	// Return:		Its id, or UINT_MAX if failed.
+	unsigned int Intern(const T1& t1ProbObj)
+	{
+		auto it = m_mapProbObjId.find(t1ProbObj);
+		if (m_mapProbObjId.end() != it) return it->second;
+		if (m_vecProbObj.size() >= UINT_MAX) return UINT_MAX;
+
+		const unsigned int unId = (unsigned int)m_vecProbObj.size();
+		try
+		{
+			m_vecProbObj.push_back(t1ProbObj);
+			m_vecIdBox.push_back(std::vector<unsigned int>());
+			m_mapProbObjId.emplace(t1ProbObj, unId);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			if (m_vecIdBox.size() > unId) m_vecIdBox.pop_back();
+			if (m_vecProbObj.size() > unId) m_vecProbObj.pop_back();
+			return UINT_MAX;
+		}
+		return unId;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Find the id of a probability object.
+	// t1ProbObj:	The probability object.
+	// Return:		Its id, or UINT_MAX if it was never interned.
+	unsigned int FindId(const T1& t1ProbObj) const
+	{
+		auto it = m_mapProbObjId.find(t1ProbObj);
+		return (m_mapProbObjId.end() == it) ? UINT_MAX : it->second;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the probability object of an id.
+	// unId:		The id, it must be less than GetProbObjNum().
+	// Return:		The probability object.
+	const T1& GetProbObj(const unsigned int unId) const { return m_vecProbObj[unId]; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Add an empty box.
+	// Return:		The handle of the box, or UINT_MAX if failed.
+	unsigned int AddBox()
+	{
+		if (m_dqBox.size() >= UINT_MAX) return UINT_MAX;
+
+		try
+		{
+			m_dqBox.emplace_back();
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			return UINT_MAX;
+		}
+		return (unsigned int)m_dqBox.size() - 1;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get a box, to draw from it by id or to set its sampling strategy. Its
+	//				probability objects must not be modified directly.
+	// unBox:		The handle of the box, it must be less than GetBoxNum().
+	// Return:		The box.
+	CHMProbObjBox<unsigned int>& GetBox(const unsigned int unBox) { return m_dqBox[unBox]; }
+	const CHMProbObjBox<unsigned int>& GetBox(const unsigned int unBox) const { return m_dqBox[unBox]; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Draw a probability object from a box.
+	// unBox:		The handle of the box.
+	// t1ProbObj:	If this call succeed, the drawn probability object will be put into
+	//				t1ProbObj.
+	// nRand:		It decides which probability object will be drawn. It should be a positive
+	//				random int value(recommended), or -1.
+	// Return:		Return true if succeed, false if failed.
+	bool Draw(const unsigned int unBox, T1& t1ProbObj, const int nRand = -1)
+	{
+		unsigned int unId = 0;
+		if (unBox >= m_dqBox.size() || !m_dqBox[unBox].Draw(unId, nRand)) return false;
+
+		t1ProbObj = m_vecProbObj[unId];
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Modify probability objects of a box, interning new ones.
+	// unBox:		The handle of the box.
+	// t1ProbObj:	A pointer to the storage of object that you want to modify.
+	// pCount:		A pointer to the storage of every object's new count.
+	// unLen:		The length of storage.
+	// Return:		None.
+	void Modify(const unsigned int unBox, const T1* const t1ProbObj, const unsigned int* const pCount, const unsigned int unLen = 1)
+	{
+		if (unBox >= m_dqBox.size() || NULL == t1ProbObj || NULL == pCount || 0 == unLen) return;
+
+		for (unsigned int i = 0; i < unLen; i++)
+		{
+			const unsigned int unId = (0 == pCount[i]) ? FindId(t1ProbObj[i]) : Intern(t1ProbObj[i]);
+			if (UINT_MAX != unId) ModifyId(unBox, unId, pCount[i]);
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Set the count of a probability object in every box holding it, through
+	//				the inverted index.
+	// t1ProbObj:	The probability object.
+	// unCount:		The new count, 0 takes it out of all boxes.
+	// Return:		The number of boxes changed.
+	unsigned int ModifyInAllBoxes(const T1& t1ProbObj, const unsigned int unCount)
+	{
+		const unsigned int unId = FindId(t1ProbObj);
+		if (UINT_MAX == unId) return 0;
+
+		// ModifyId may take boxes out of the list, so it works on a copy.
+		const std::vector<unsigned int> vecBox = m_vecIdBox[unId];
+		for (auto it = vecBox.cbegin(); it != vecBox.cend(); it++) ModifyId(*it, unId, unCount);
+		return (unsigned int)vecBox.size();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Find the boxes holding a probability object.
+	// t1ProbObj:	The probability object.
+	// Return:		The handles of the boxes, in increasing order.
+	const std::vector<unsigned int>& FindBoxes(const T1& t1ProbObj) const
+	{
+		static const std::vector<unsigned int> s_vecNoBox;
+		const unsigned int unId = FindId(t1ProbObj);
+		return (UINT_MAX == unId) ? s_vecNoBox : m_vecIdBox[unId];
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Clear a box to make it empty, the objects stay interned.
+	// unBox:		The handle of the box.
+	// Return:		None.
+	void ClearBox(const unsigned int unBox)
+	{
+		if (unBox >= m_dqBox.size()) return;
+
+		const std::vector<std::pair<unsigned int, unsigned int>>& vecProbObjPool = m_dqBox[unBox].GetPool();
+		for (auto it = vecProbObjPool.cbegin(); it != vecProbObjPool.cend(); it++) RemoveIdBox(it->first, unBox);
+		m_dqBox[unBox].Clear();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get particular or total probability objects counts of a box, depend on
+	//				pProbObj.
+	// unBox:		The handle of the box.
+	// pProbObj:	A pointer of the specific probability object, if it == NULL, get the
+	//				total count.
+	// Return:		The count.
+	unsigned int GetCount(const unsigned int unBox, const T1* const pProbObj = NULL) const
+	{
+		if (unBox >= m_dqBox.size()) return 0;
+		if (NULL == pProbObj) return m_dqBox[unBox].GetCount();
+
+		const unsigned int unId = FindId(*pProbObj);
+		return (UINT_MAX == unId) ? 0 : m_dqBox[unBox].GetCount(&unId);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the number of boxes and of interned probability objects.
+	unsigned int GetBoxNum() const { return (unsigned int)m_dqBox.size(); }
+	unsigned int GetProbObjNum() const { return (unsigned int)m_vecProbObj.size(); }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the version of CHMProbObjRegistry.
+	// Return:		A unsigned int stands for the version.
+	unsigned int Version() const { return m_scunCHMProbObjRegistryVersion; }
+
+private:
+	std::vector<T1> m_vecProbObj;
+	std::unordered_map<T1, unsigned int, THash> m_mapProbObjId;
+	std::vector<std::vector<unsigned int>> m_vecIdBox;		// Sorted box handles of every id.
+	std::deque<CHMProbObjBox<unsigned int>> m_dqBox;		// A deque, so adding boxes moves none.
+	static const unsigned int m_scunCHMProbObjRegistryVersion = 1;
+
+	void ModifyId(const unsigned int unBox, const unsigned int unId, const unsigned int unCount)
+	{
+		CHMProbObjBox<unsigned int>& stBox = m_dqBox[unBox];
+		stBox.Modify(&unId, &unCount);
+
+		if (0 == stBox.GetCount(&unId))
+		{
+			RemoveIdBox(unId, unBox);
+			return;
+		}
+
+		std::vector<unsigned int>& vecBox = m_vecIdBox[unId];
+		auto it = std::lower_bound(vecBox.begin(), vecBox.end(), unBox);
+		if (vecBox.end() != it && unBox == *it) return;
+
+		try
+		{
+			vecBox.insert(it, unBox);
+		}
+		catch (const std::exception& e)
+		{
+			// The box keeps the object only if the index knows about it.
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			const unsigned int unZero = 0;
+			stBox.Modify(&unId, &unZero);
+		}
+	}
+
+	void RemoveIdBox(const unsigned int unId, const unsigned int unBox)
+	{
+		std::vector<unsigned int>& vecBox = m_vecIdBox[unId];
+		auto it = std::lower_bound(vecBox.begin(), vecBox.end(), unBox);
+		if (vecBox.end() != it && unBox == *it) vecBox.erase(it);
+	}
+};
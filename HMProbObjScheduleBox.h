@@ -0,0 +1,272 @@
+#pragma once
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "HMProbObjBox.h"
+#include "HMProbObjBoxUtil.h"
+
+//////////////////////////////////////////////////////////////////////////////////////
+// A point of a schedule: from llTime on the counts are multiplied by dMultiplier.
+struct SHMProbObjSchedulePoint
+{
+	long long llTime;		// Any time unit, such as seconds since the epoch.
+	double dMultiplier;		// Not negative.
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+// CHMProbObjScheduleBox draws with counts that change over time. Every entry follows a
+// schedule, a piecewise-linear multiplier of time, and the entries of a schedule share
+// one CHMProbObjBox. Draw(now) weighs every schedule by the total count of its entries
+// times its multiplier at now, picks one, and draws from its box, so a draw costs
+// O(number of schedules) more than a draw from one box and no Modify is needed as
+// time passes. Before its first point a schedule keeps the first multiplier, after
+// its last point the last one.
+//
+// If T1 is hashable the schedule of every object is kept in a hash map, so a Modify
+// changes only the box the object leaves and the box it joins; otherwise the boxes of
+// all schedules are searched for it.
+//
+// Schedule 0 always exists and has the constant multiplier 1.
+template <typename T1>
+class CHMProbObjScheduleBox
+{
+public:
+	CHMProbObjScheduleBox() : m_eSampling(eHMProbObjBoxSamplingLinear) { Clear(); }
+	~CHMProbObjScheduleBox() {};
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Draw a probability object with the counts at a time.
+	// t1ProbObj:	If this call succeed, the drawn probability object will be put into
+	//				t1ProbObj.
+	// llNow:		The time.
+	// nRand:		It decides which probability object will be drawn. It should be a positive
+	//				random int value(recommended), or -1.
+	// Return:		Return true if succeed, false if failed or every count is 0 at llNow.
+	bool Draw(T1& t1ProbObj, const long long llNow, const int nRand = -1)
+	{
+		if (nRand < 0 && -1 != nRand) return false;
+
+		const double dTotal = GetTotal(llNow);
+		if (dTotal <= 0) return false;
+
+		unsigned int unRand = (0 > nRand) ? rand() : nRand;
+		CHMProbObjSplitMix stRand(unRand);
+		double dKey = stRand.NextOpen() * dTotal;
+
+		// Falls back to the last weighed schedule if rounding leaves the key past the end.
+		unsigned int unSchedule = UINT_MAX;
+		for (unsigned int i = 0; i < m_dqSchedule.size(); i++)
+		{
+			const double dMass = GetMass(m_dqSchedule[i], llNow);
+			if (dMass <= 0) continue;
+
+			unSchedule = i;
+			if (dKey < dMass) break;
+			dKey -= dMass;
+		}
+		return m_dqSchedule[unSchedule].stBox.Draw(t1ProbObj, (int)(stRand.Next() >> 33));
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Add a schedule.
+	// pPoint:		A pointer to the points, sorted by time.
+	// unLen:		The number of points, at least 1.
+	// Return:		The handle of the schedule, or UINT_MAX if the points are not sorted or
+	//				a multiplier is negative.
+	unsigned int AddSchedule(const SHMProbObjSchedulePoint* const pPoint, const unsigned int unLen)
+	{
+		if (NULL == pPoint || 0 == unLen || m_dqSchedule.size() >= UINT_MAX - 1) return UINT_MAX;
+		for (unsigned int i = 0; i < unLen; i++)
+		{
+			if (!(pPoint[i].dMultiplier >= 0) || (0 < i && pPoint[i].llTime < pPoint[i - 1].llTime)) return UINT_MAX;
+		}
+
+		try
+		{
+			m_dqSchedule.push_back(SHMProbObjSchedule());
+			m_dqSchedule.back().vecPoint.assign(pPoint, pPoint + unLen);
+			m_dqSchedule.back().stBox.SetSampling(m_eSampling);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			if (!m_dqSchedule.empty() && m_dqSchedule.back().vecPoint.empty()) m_dqSchedule.pop_back();
+			return UINT_MAX;
+		}
+		return (unsigned int)m_dqSchedule.size() - 1;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Modify probability objects of this box and the schedule they follow.
+	//				An object is moved out of the schedule it followed before.
+	// t1ProbObj:	A pointer to the storage of object that you want to modify.
+	// pCount:		A pointer to the storage of every object's new count, unscaled.
+	// unLen:		The length of storage.
+	// unSchedule:	The schedule, default the constant one.
+	// Return:		None.
+	void Modify(const T1* const t1ProbObj, const unsigned int* const pCount, const unsigned int unLen = 1, const unsigned int unSchedule = 0)
+	{
+		if (NULL == t1ProbObj || NULL == pCount || 0 == unLen || unSchedule >= m_dqSchedule.size()) return;
+
+		const unsigned int unZero = 0;
+		for (unsigned int i = 0; i < unLen; i++)
+		{
+			const unsigned int unOldSchedule = FindSchedule(t1ProbObj[i], CHMProbObjIsHashable<T1>());
+			if (UINT_MAX != unOldSchedule && unOldSchedule != unSchedule) m_dqSchedule[unOldSchedule].stBox.Modify(&t1ProbObj[i], &unZero);
+
+			CHMProbObjBox<T1>& stBox = m_dqSchedule[unSchedule].stBox;
+			stBox.Modify(&t1ProbObj[i], &pCount[i]);
+			SetSchedule(t1ProbObj[i], (0 != stBox.GetCount(&t1ProbObj[i])) ? unSchedule : UINT_MAX, CHMProbObjIsHashable<T1>());
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Set the sampling strategy of the boxes of all schedules.
+	// eSampling:	The sampling strategy.
+	// Return:		None.
+	void SetSampling(const EHMProbObjBoxSampling eSampling)
+	{
+		m_eSampling = eSampling;
+		for (auto it = m_dqSchedule.begin(); it != m_dqSchedule.end(); it++) it->stBox.SetSampling(eSampling);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Rebuild the sampling indexes of the boxes of all schedules, see
+	//				CHMProbObjBox::Commit.
+	// Return:		None.
+	void Commit()
+	{
+		for (auto it = m_dqSchedule.begin(); it != m_dqSchedule.end(); it++) it->stBox.Commit();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Clear this box, only the constant schedule is left, empty. The sampling
+	//				strategy is kept.
+	// Return:		None.
+	void Clear()
+	{
+		const SHMProbObjSchedulePoint stConstant = { 0, 1.0 };
+		std::deque<SHMProbObjSchedule>(1).swap(m_dqSchedule);
+		m_dqSchedule[0].vecPoint.push_back(stConstant);
+		m_dqSchedule[0].stBox.SetSampling(m_eSampling);
+		m_mapSchedule = TScheduleMap();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the total count at a time, the unscaled counts times the multipliers.
+	// llNow:		The time.
+	// Return:		The count.
+	double GetTotal(const long long llNow) const
+	{
+		double dTotal = 0;
+		for (auto it = m_dqSchedule.cbegin(); it != m_dqSchedule.cend(); it++) dTotal += GetMass(*it, llNow);
+		return dTotal;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the unscaled count of a probability object.
+	// pProbObj:	A pointer of the probability object.
+	// pSchedule:	If not NULL, the schedule the object follows is put into it, UINT_MAX
+	//				if the object is not in this box.
+	// Return:		The count.
+	unsigned int GetCount(const T1* const pProbObj, unsigned int* const pSchedule = NULL) const
+	{
+		if (NULL != pSchedule) *pSchedule = UINT_MAX;
+		if (NULL == pProbObj) return 0;
+
+		const unsigned int unSchedule = FindSchedule(*pProbObj, CHMProbObjIsHashable<T1>());
+		if (UINT_MAX == unSchedule) return 0;
+
+		if (NULL != pSchedule) *pSchedule = unSchedule;
+		return m_dqSchedule[unSchedule].stBox.GetCount(pProbObj);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the multiplier of a schedule at a time.
+	// unSchedule:	The schedule.
+	// llNow:		The time.
+	// Return:		The multiplier, 0 if the schedule is unknown.
+	double GetMultiplier(const unsigned int unSchedule, const long long llNow) const
+	{
+		return (unSchedule < m_dqSchedule.size()) ? GetMultiplier(m_dqSchedule[unSchedule].vecPoint, llNow) : 0;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the number of schedules, including the constant one.
+	unsigned int GetScheduleNum() const { return (unsigned int)m_dqSchedule.size(); }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the version of CHMProbObjScheduleBox.
+	// Return:		A unsigned int stands for the version.
+	unsigned int Version() const { return m_scunCHMProbObjScheduleBoxVersion; }
+
+private:
+	struct SHMProbObjSchedule
+	{
+		std::vector<SHMProbObjSchedulePoint> vecPoint;
+		CHMProbObjBox<T1> stBox;
+	};
+
+	// The schedule of every object in this box, if T1 is hashable.
+	typedef typename std::conditional<CHMProbObjIsHashable<T1>::value, std::unordered_map<T1, unsigned int>, char>::type TScheduleMap;
+
+	// A deque, so adding a schedule never moves the boxes of the others.
+	std::deque<SHMProbObjSchedule> m_dqSchedule;
+	TScheduleMap m_mapSchedule;
+	EHMProbObjBoxSampling m_eSampling;
+	static const unsigned int m_scunCHMProbObjScheduleBoxVersion = 1;
+
+	unsigned int FindSchedule(const T1& t1ProbObj, std::true_type) const
+	{
+		auto it = m_mapSchedule.find(t1ProbObj);
+		return (m_mapSchedule.end() == it) ? UINT_MAX : it->second;
+	}
+
+	unsigned int FindSchedule(const T1& t1ProbObj, std::false_type) const
+	{
+		for (unsigned int i = 0; i < m_dqSchedule.size(); i++)
+		{
+			if (0 != m_dqSchedule[i].stBox.GetCount(&t1ProbObj)) return i;
+		}
+		return UINT_MAX;
+	}
+
+	// Records the schedule of an object, UINT_MAX if it has left this box.
+	void SetSchedule(const T1& t1ProbObj, const unsigned int unSchedule, std::true_type)
+	{
+		try
+		{
+			if (UINT_MAX == unSchedule) m_mapSchedule.erase(t1ProbObj);
+			else m_mapSchedule[t1ProbObj] = unSchedule;
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+		}
+	}
+
+	void SetSchedule(const T1&, const unsigned int, std::false_type) {}
+
+	static double GetMultiplier(const std::vector<SHMProbObjSchedulePoint>& vecPoint, const long long llNow)
+	{
+		if (llNow < vecPoint.front().llTime) return vecPoint.front().dMultiplier;
+		if (llNow >= vecPoint.back().llTime) return vecPoint.back().dMultiplier;
+
+		auto it = std::upper_bound(vecPoint.cbegin(), vecPoint.cend(), llNow,
+			[](const long long llTime, const SHMProbObjSchedulePoint& stPoint) { return llTime < stPoint.llTime; });
+		const SHMProbObjSchedulePoint& stLeft = *(it - 1);
+		const double dRatio = (double)(llNow - stLeft.llTime) / (double)(it->llTime - stLeft.llTime);
+		return stLeft.dMultiplier + (it->dMultiplier - stLeft.dMultiplier) * dRatio;
+	}
+
+	static double GetMass(const SHMProbObjSchedule& stSchedule, const long long llNow)
+	{
+		const unsigned int unCount = stSchedule.stBox.GetCount();
+		return (0 == unCount) ? 0 : unCount * GetMultiplier(stSchedule.vecPoint, llNow);
+	}
+};
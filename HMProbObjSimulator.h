@@ -0,0 +1,316 @@
+#pragma once
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "HMProbObjBox.h"
+#include "HMProbObjBoxIndex.h"
+#include "HMProbObjBoxUtil.h"
+#include "HMProbObjPityBox.h"
+
+//////////////////////////////////////////////////////////////////////////////////////
+// The outcome of a simulation, or of its exact solution, of players pulling from a box
+// until they get a target object.
+struct SHMProbObjSimResult
+{
+	unsigned int unPlayerNum;			// Simulated players, 0 for an exact result.
+	std::vector<double> vecFirstHit;	// [m]: the share of players first drawing a target at pull m + 1.
+	double dHitMean;					// The mean number of targets a player draws in all the pulls.
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+// CHMProbObjSimulator answers questions such as "how many pulls until 95% of players get
+// the object X" for a CHMProbObjBox, or a CHMProbObjPityBox whose pity depends on the
+// history of every player.
+//
+// Simulate runs the players on all cores. Player p draws from its own stream, a
+// CHMProbObjSplitMix of the seed moved p * unPullMax values ahead, and every thread
+// counts into its own histogram, merged once at the end, so the result does not depend
+// on the number of threads and no lock is taken. A plain box is drawn through an alias
+// table built by Bind.
+//
+// Solve computes the same result exactly from the counts: pulls from a plain box are
+// independent, and with pity the chance of a pull depends only on the pulls since the
+// last top tier object, so the players are followed as a distribution over that counter
+// in O(unPullMax * number of counter values).
+//
+// The box must outlive the simulator and must not be modified while bound.
+template <typename T1, typename TWeight = unsigned int>
+class CHMProbObjSimulator
+{
+public:
+	CHMProbObjSimulator() : m_pProbObjPool(NULL), m_unTotal(0), m_pPityBox(NULL) {};
+	~CHMProbObjSimulator() {};
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Bind this to a box.
+	// t1ProbObjBox:The box to simulate pulls from.
+	// Return:		Return true if succeed. If failed, this is left unbound.
+	bool Bind(const CHMProbObjBox<T1, TWeight>& t1ProbObjBox)
+	{
+		Unbind();
+		if (0 == t1ProbObjBox.GetCount()) return false;
+		if (!m_stIndex.Build(t1ProbObjBox.GetPool(), t1ProbObjBox.GetCount(), eHMProbObjBoxSamplingAlias, 0)) return false;
+
+		m_pProbObjPool = &t1ProbObjBox.GetPool();
+		m_unTotal = t1ProbObjBox.GetCount();
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Bind this to a pity box, every simulated player keeps its pity counters.
+	// t1PityBox:	The bound pity box to simulate pulls from.
+	// Return:		Return true if succeed. If failed, this is left unbound.
+	bool Bind(const CHMProbObjPityBox<T1, TWeight>& t1PityBox)
+	{
+		Unbind();
+		if (0 == t1PityBox.GetTopCount() + t1PityBox.GetRestCount()) return false;
+
+		m_pPityBox = &t1PityBox;
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Unbind this from its box.
+	// Return:		None.
+	void Unbind()
+	{
+		m_pProbObjPool = NULL;
+		m_unTotal = 0;
+		m_pPityBox = NULL;
+		m_stIndex.Clear();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Simulate players pulling from the bound box.
+	// fnIsTarget:	A callable bool(const T1&), true for a target object.
+	// unPlayerNum:	The number of players.
+	// unPullMax:	The number of pulls of every player.
+	// stResult:	If this call succeed, the result will be put into it.
+	// nSeed:		The seed, the same seed gives the same result. It should be a positive
+	//				random int value(recommended), or -1.
+	// unThreadNum:	The most threads to use, 0 means one per hardware thread, default 0.
+	// Return:		Return true if succeed, false if failed.
+	template <typename TPred>
+	bool Simulate(const TPred& fnIsTarget, const unsigned int unPlayerNum, const unsigned int unPullMax, SHMProbObjSimResult& stResult,
+		const int nSeed = -1, const unsigned int unThreadNum = 0) const
+	{
+		if (!IsBound() || 0 == unPlayerNum || 0 == unPullMax) return false;
+		if (nSeed < 0 && -1 != nSeed) return false;
+
+		const unsigned int unSeed = (0 > nSeed) ? rand() : nSeed;
+		const unsigned int unBlockNum = CHMProbObjParallel::GetBlockNum(unThreadNum, unPlayerNum, m_scunPlayerBlockMin);
+		std::vector<std::vector<unsigned long long>> vecBlockFirstHit;
+		std::vector<unsigned long long> vecBlockHitNum(unBlockNum, 0);
+		std::vector<char> vecTarget;
+		try
+		{
+			vecBlockFirstHit.assign(unBlockNum, std::vector<unsigned long long>(unPullMax, 0));
+			if (NULL == m_pPityBox)
+			{
+				vecTarget.resize(m_pProbObjPool->size());
+				for (size_t i = 0; i < vecTarget.size(); i++) vecTarget[i] = fnIsTarget((*m_pProbObjPool)[i].first) ? 1 : 0;
+			}
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			return false;
+		}
+
+		// An exception of fnIsTarget on any thread fails the simulation.
+		try
+		{
+			CHMProbObjParallel::Run(unBlockNum, [&](const unsigned int unBlock)
+				{
+					std::vector<unsigned long long>& vecFirstHit = vecBlockFirstHit[unBlock];
+					unsigned long long ullHitNum = 0;
+					for (unsigned int p = CHMProbObjParallel::GetBlockBegin(unPlayerNum, unBlockNum, unBlock); p < CHMProbObjParallel::GetBlockBegin(unPlayerNum, unBlockNum, unBlock + 1); p++)
+					{
+						CHMProbObjSplitMix stRand(unSeed);
+						stRand.Discard((unsigned long long)p * unPullMax);
+						SHMProbObjPityState stState = { 0 };
+						bool bHit = false;
+						for (unsigned int m = 0; m < unPullMax; m++)
+						{
+							bool bTarget = false;
+							if (NULL == m_pPityBox) bTarget = (0 != vecTarget[m_stIndex.Find(stRand.NextBelow(m_unTotal))]);
+							else
+							{
+								T1 t1ProbObj;
+								bTarget = m_pPityBox->Draw(stState, t1ProbObj, (int)(stRand.Next() >> 33)) && fnIsTarget(t1ProbObj);
+							}
+							if (!bTarget) continue;
+
+							ullHitNum++;
+							if (!bHit) vecFirstHit[m]++;
+							bHit = true;
+						}
+					}
+					vecBlockHitNum[unBlock] = ullHitNum;
+				});
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			return false;
+		}
+
+		// Every block counted its own players, merged here.
+		stResult.unPlayerNum = unPlayerNum;
+		stResult.vecFirstHit.assign(unPullMax, 0);
+		unsigned long long ullHitNum = 0;
+		for (unsigned int b = 0; b < unBlockNum; b++)
+		{
+			for (unsigned int m = 0; m < unPullMax; m++) stResult.vecFirstHit[m] += (double)vecBlockFirstHit[b][m];
+			ullHitNum += vecBlockHitNum[b];
+		}
+		for (auto it = stResult.vecFirstHit.begin(); it != stResult.vecFirstHit.end(); it++) *it /= unPlayerNum;
+		stResult.dHitMean = (double)ullHitNum / unPlayerNum;
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Compute the result of Simulate exactly, as for infinitely many players.
+	// fnIsTarget:	A callable bool(const T1&), true for a target object.
+	// unPullMax:	The number of pulls of every player.
+	// stResult:	If this call succeed, the result will be put into it.
+	// Return:		Return true if succeed, false if failed.
+	template <typename TPred>
+	bool Solve(const TPred& fnIsTarget, const unsigned int unPullMax, SHMProbObjSimResult& stResult) const
+	{
+		if (!IsBound() || 0 == unPullMax) return false;
+
+		try
+		{
+			stResult.unPlayerNum = 0;
+			stResult.vecFirstHit.assign(unPullMax, 0);
+			if (NULL == m_pPityBox) SolveBox(fnIsTarget, unPullMax, stResult);
+			else SolvePity(fnIsTarget, unPullMax, stResult);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the drop curve of a result.
+	// stResult:	The result.
+	// vecCurve:	[m] is put the share of players with a target after pull m + 1.
+	// Return:		None.
+	static void GetDropCurve(const SHMProbObjSimResult& stResult, std::vector<double>& vecCurve)
+	{
+		vecCurve.resize(stResult.vecFirstHit.size());
+		double dShare = 0;
+		for (size_t m = 0; m < vecCurve.size(); m++) vecCurve[m] = (dShare += stResult.vecFirstHit[m]);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the number of pulls after which a share of players have a target.
+	// stResult:	The result.
+	// dShare:		The share of players, such as 0.95.
+	// Return:		The number of pulls, or UINT_MAX if fewer players have one after all
+	//				the pulls.
+	static unsigned int GetPercentile(const SHMProbObjSimResult& stResult, const double dShare)
+	{
+		// A tolerance for the rounding of the sums, far below the share of one player.
+		const double dEpsilon = 1e-12;
+		double dSum = 0;
+		for (size_t m = 0; m < stResult.vecFirstHit.size(); m++)
+		{
+			dSum += stResult.vecFirstHit[m];
+			if (dSum + dEpsilon >= dShare) return (unsigned int)m + 1;
+		}
+		return UINT_MAX;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the version of CHMProbObjSimulator.
+	// Return:		A unsigned int stands for the version.
+	unsigned int Version() const { return m_scunCHMProbObjSimulatorVersion; }
+
+private:
+	const std::vector<std::pair<T1, TWeight>>* m_pProbObjPool;
+	unsigned int m_unTotal;
+	CHMProbObjBoxIndex m_stIndex;
+	const CHMProbObjPityBox<T1, TWeight>* m_pPityBox;
+	static const unsigned int m_scunPlayerBlockMin = 1024;
+	static const unsigned int m_scunCHMProbObjSimulatorVersion = 1;
+
+	bool IsBound() const { return NULL != m_pProbObjPool || NULL != m_pPityBox; }
+
+	// Independent pulls: the first target is geometric.
+	template <typename TPred>
+	void SolveBox(const TPred& fnIsTarget, const unsigned int unPullMax, SHMProbObjSimResult& stResult) const
+	{
+		unsigned int unTargetCount = 0;
+		for (auto it = m_pProbObjPool->cbegin(); it != m_pProbObjPool->cend(); it++)
+		{
+			if (fnIsTarget(it->first)) unTargetCount += it->second;
+		}
+
+		const double dProb = (double)unTargetCount / m_unTotal;
+		double dMiss = 1;
+		for (unsigned int m = 0; m < unPullMax; m++)
+		{
+			stResult.vecFirstHit[m] = dMiss * dProb;
+			dMiss *= 1 - dProb;
+		}
+		stResult.dHitMean = unPullMax * dProb;
+	}
+
+	// Follows the players as a distribution over their pull counter, those without a
+	// target yet and all of them. The counter values past the last one whose top tier
+	// probability differs from the one before are merged into it.
+	template <typename TPred>
+	void SolvePity(const TPred& fnIsTarget, const unsigned int unPullMax, SHMProbObjSimResult& stResult) const
+	{
+		unsigned int unTopTarget = 0, unRestTarget = 0;
+		m_pPityBox->GetCountIf(fnIsTarget, unTopTarget, unRestTarget);
+		const double dTopShare = (0 == m_pPityBox->GetTopCount()) ? 0 : (double)unTopTarget / m_pPityBox->GetTopCount();
+		const double dRestShare = (0 == m_pPityBox->GetRestCount()) ? 0 : (double)unRestTarget / m_pPityBox->GetRestCount();
+
+		std::vector<double> vecTopProb(unPullMax);
+		unsigned int unStateNum = 1;
+		for (unsigned int c = 0; c < unPullMax; c++)
+		{
+			const SHMProbObjPityState stState = { c };
+			vecTopProb[c] = m_pPityBox->GetTopProbability(stState);
+			if (0 < c && vecTopProb[c] != vecTopProb[c - 1]) unStateNum = c + 1;
+		}
+		vecTopProb.resize(unStateNum);
+
+		std::vector<double> vecMiss(unStateNum, 0), vecAll(unStateNum, 0), vecNextMiss(unStateNum), vecNextAll(unStateNum);
+		vecMiss[0] = 1;
+		vecAll[0] = 1;
+		stResult.dHitMean = 0;
+		for (unsigned int m = 0; m < unPullMax; m++)
+		{
+			std::fill(vecNextMiss.begin(), vecNextMiss.end(), 0);
+			std::fill(vecNextAll.begin(), vecNextAll.end(), 0);
+			double dFirstHit = 0;
+			for (unsigned int c = 0; c < unStateNum && c <= m; c++)
+			{
+				const double dTop = vecTopProb[c], dRest = 1 - dTop;
+				const double dHit = dTop * dTopShare + dRest * dRestShare;
+				const unsigned int unNext = std::min(c + 1, unStateNum - 1);
+
+				dFirstHit += vecMiss[c] * dHit;
+				vecNextMiss[0] += vecMiss[c] * dTop * (1 - dTopShare);
+				vecNextMiss[unNext] += vecMiss[c] * dRest * (1 - dRestShare);
+
+				stResult.dHitMean += vecAll[c] * dHit;
+				vecNextAll[0] += vecAll[c] * dTop;
+				vecNextAll[unNext] += vecAll[c] * dRest;
+			}
+			stResult.vecFirstHit[m] = dFirstHit;
+			vecMiss.swap(vecNextMiss);
+			vecAll.swap(vecNextAll);
+		}
+	}
+};
@@ -0,0 +1,361 @@
+#pragma once
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "HMProbObjBoxUtil.h"
+
+//////////////////////////////////////////////////////////////////////////////////////
+// CHMProbObjTreeBox is a box whose entries are probability objects (leaves) or other
+// boxes, for draws in stages such as a rarity tier first and an item of the tier next.
+// Box 0 is the root. Every box keeps the counts of its entries in a Fenwick tree, so a
+// draw walks down in O(depth * log(entries)), and changing a leaf count updates the
+// totals of its boxes up to the root in the same time, without flattening the tree.
+//
+// An update is O(depth * log(entries)) rather than O(depth): keeping only the total of
+// each box would make an update O(depth), but a draw would then scan the entries of
+// every box on its way down, O(entries) per level, which is what a box of a million
+// items cannot afford. The Fenwick tree of a box keeps its total and finds the drawn
+// entry in O(log(entries)), for a log factor on updates.
+//
+// A box added with count 0 weighs as much as all its entries, and drawing through a
+// tree of such boxes keeps the key: an nRand draws the leaf a CHMProbObjBox holding the
+// leaves in depth-first order would. A box added with a fixed count weighs that count
+// while it has any entry, like a tier rate, and a draw picks a new key inside it.
+//
+// Entries are never erased: a count of 0 leaves the entry out of draws but keeps its
+// handle, so it can be set again later.
+template <typename T1>
+class CHMProbObjTreeBox
+{
+public:
+	CHMProbObjTreeBox() { Clear(); }
+	~CHMProbObjTreeBox() {};
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Draw a probability object from a box of this tree.
+	// t1ProbObj:	If this call succeed, the drawn probability object will be put into
+	//				t1ProbObj.
+	// nRand:		It decides which probability object will be drawn. It should be a positive
+	//				random int value(recommended), or -1.
+	// unBox:		The box to draw from, default the root.
+	// Return:		Return true if succeed, false if failed.
+	bool Draw(T1& t1ProbObj, const int nRand = -1, const unsigned int unBox = 0) const
+	{
+		unsigned int unLeaf = 0;
+		if (!DrawLeaf(unLeaf, nRand, unBox)) return false;
+
+		t1ProbObj = m_vecLeaf[unLeaf].t1ProbObj;
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Draw the handle of a leaf from a box of this tree.
+	// unLeaf:		If this call succeed, the handle of the drawn leaf will be put into it.
+	// nRand:		The same as Draw.
+	// unBox:		The box to draw from, default the root.
+	// Return:		Return true if succeed, false if failed.
+	bool DrawLeaf(unsigned int& unLeaf, const int nRand = -1, const unsigned int unBox = 0) const
+	{
+		if (unBox >= m_vecBox.size() || 0 == m_vecBox[unBox].stFenwick.GetTotal()) return false;
+		if (nRand < 0 && -1 != nRand) return false;
+
+		unsigned int unRand = (0 > nRand) ? rand() : nRand;
+		unsigned int unKeyNum = unRand % m_vecBox[unBox].stFenwick.GetTotal();
+		CHMProbObjSplitMix stRand(unRand);
+
+		const SHMProbObjTreeNode* pNode = &m_vecBox[unBox];
+		for (;;)
+		{
+			const SHMProbObjTreeSlot& stSlot = pNode->vecSlot[pNode->stFenwick.Find(unKeyNum)];
+			if (!stSlot.bBox)
+			{
+				unLeaf = stSlot.unId;
+				return true;
+			}
+
+			pNode = &m_vecBox[stSlot.unId];
+			if (0 != pNode->unFixedCount) unKeyNum = stRand.NextBelow(pNode->stFenwick.GetTotal());
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Add an empty box to a box of this tree.
+	// unParent:	The box to add it to.
+	// unCount:		The count of the new box, 0 means the total count of its entries.
+	// Return:		The handle of the new box, or UINT_MAX if failed.
+	unsigned int AddBox(const unsigned int unParent, const unsigned int unCount = 0)
+	{
+		if (unParent >= m_vecBox.size() || m_vecBox.size() >= m_scunProbObjBoxCapacity) return UINT_MAX;
+
+		const unsigned int unBox = (unsigned int)m_vecBox.size();
+		const SHMProbObjTreeSlot stSlot = { unBox, true };
+		try
+		{
+			m_vecBox.push_back(SHMProbObjTreeNode(unParent, m_vecBox[unParent].stFenwick.GetSize(), unCount));
+			AppendSlot(unParent, stSlot);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			if (m_vecBox.size() > unBox) m_vecBox.pop_back();
+			return UINT_MAX;
+		}
+		return unBox;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Change the count of a box added with a fixed count, or switch it to or
+	//				from counting as the total count of its entries.
+	// unBox:		The box, it must not be the root.
+	// unCount:		The new count, 0 means the total count of its entries.
+	// Return:		Return true if succeed, false if failed.
+	bool SetBoxCount(const unsigned int unBox, const unsigned int unCount)
+	{
+		if (0 == unBox || unBox >= m_vecBox.size()) return false;
+
+		const SHMProbObjTreeNode& stNode = m_vecBox[unBox];
+		const unsigned int unWeight = (0 == stNode.stFenwick.GetTotal()) ? 0 : ((0 == unCount) ? stNode.stFenwick.GetTotal() : unCount);
+		if (!SetSlotCount(stNode.unParent, stNode.unSlot, unWeight, false)) return false;
+
+		m_vecBox[unBox].unFixedCount = unCount;
+		SetSlotCount(stNode.unParent, stNode.unSlot, unWeight, true);
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Append a probability object to a box of this tree, without looking for
+	//				it in the box first.
+	// unBox:		The box to append to.
+	// t1ProbObj:	The probability object.
+	// unCount:		Its count.
+	// Return:		The handle of the new leaf, or UINT_MAX if failed.
+	unsigned int Append(const unsigned int unBox, const T1& t1ProbObj, const unsigned int unCount)
+	{
+		if (unBox >= m_vecBox.size() || m_vecLeaf.size() >= m_scunProbObjBoxCapacity) return UINT_MAX;
+
+		const unsigned int unLeaf = (unsigned int)m_vecLeaf.size();
+		const SHMProbObjTreeSlot stSlot = { unLeaf, false };
+		try
+		{
+			m_vecLeaf.push_back(SHMProbObjTreeLeaf(t1ProbObj, unBox, m_vecBox[unBox].stFenwick.GetSize()));
+			AppendSlot(unBox, stSlot);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+			if (m_vecLeaf.size() > unLeaf) m_vecLeaf.pop_back();
+			return UINT_MAX;
+		}
+
+		if (0 != unCount && !ModifyLeaf(unLeaf, unCount))
+		{
+			m_vecBox[unBox].vecSlot.pop_back();
+			m_vecBox[unBox].stFenwick.PopBack();
+			m_vecLeaf.pop_back();
+			return UINT_MAX;
+		}
+		return unLeaf;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Modify the count of a leaf.
+	// unLeaf:		The handle of the leaf.
+	// unCount:		The new count, 0 leaves it out of draws.
+	// Return:		Return true if succeed, false if the handle is unknown or a total count
+	//				would overflow.
+	bool ModifyLeaf(const unsigned int unLeaf, const unsigned int unCount)
+	{
+		if (unLeaf >= m_vecLeaf.size()) return false;
+
+		const SHMProbObjTreeLeaf& stLeaf = m_vecLeaf[unLeaf];
+		if (!SetSlotCount(stLeaf.unBox, stLeaf.unSlot, unCount, false)) return false;
+
+		SetSlotCount(stLeaf.unBox, stLeaf.unSlot, unCount, true);
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Modify a probability object of a box, it is appended if not found.
+	//				The box is scanned for the object, prefer ModifyLeaf for big boxes.
+	// unBox:		The box.
+	// t1ProbObj:	The probability object.
+	// unCount:		The new count.
+	// Return:		Return true if succeed, false if failed.
+	bool Modify(const unsigned int unBox, const T1& t1ProbObj, const unsigned int unCount)
+	{
+		if (unBox >= m_vecBox.size()) return false;
+
+		const std::vector<SHMProbObjTreeSlot>& vecSlot = m_vecBox[unBox].vecSlot;
+		for (auto it = vecSlot.cbegin(); it != vecSlot.cend(); it++)
+		{
+			if (!it->bBox && t1ProbObj == m_vecLeaf[it->unId].t1ProbObj) return ModifyLeaf(it->unId, unCount);
+		}
+		return 0 == unCount || UINT_MAX != Append(unBox, t1ProbObj, unCount);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Clear this tree, only an empty root box is left.
+	// Return:		None.
+	void Clear()
+	{
+		std::vector<SHMProbObjTreeNode>(1, SHMProbObjTreeNode(0, 0, 0)).swap(m_vecBox);
+		std::vector<SHMProbObjTreeLeaf>().swap(m_vecLeaf);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the total count of a box, the sum of the counts of its entries.
+	// unBox:		The box, default the root.
+	// Return:		The count, 0 if the box is unknown.
+	unsigned int GetCount(const unsigned int unBox = 0) const
+	{
+		return (unBox < m_vecBox.size()) ? m_vecBox[unBox].stFenwick.GetTotal() : 0;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the count of a leaf.
+	// unLeaf:		The handle of the leaf.
+	// Return:		The count, 0 if the leaf is unknown.
+	unsigned int GetLeafCount(const unsigned int unLeaf) const
+	{
+		if (unLeaf >= m_vecLeaf.size()) return 0;
+		return m_vecBox[m_vecLeaf[unLeaf].unBox].stFenwick.GetCount(m_vecLeaf[unLeaf].unSlot);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the probability object of a leaf.
+	// unLeaf:		The handle of the leaf, it must be less than GetLeafNum().
+	// Return:		The probability object.
+	const T1& GetLeaf(const unsigned int unLeaf) const { return m_vecLeaf[unLeaf].t1ProbObj; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the number of boxes, including the root, and of leaves.
+	unsigned int GetBoxNum() const { return (unsigned int)m_vecBox.size(); }
+	unsigned int GetLeafNum() const { return (unsigned int)m_vecLeaf.size(); }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Dump the details of this tree to std::cout.
+	// Return:		None.
+	void Dump() const
+	{
+		Dump(std::cout);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Dump the details of this tree to a stream, which is flushed once at
+	//				the end.
+	// os:			The output stream.
+	// Return:		None.
+	void Dump(std::ostream& os) const
+	{
+		os << "Current total probability object count " << GetCount() << ".\n";
+		os << "Probability object tree box, " << m_vecBox.size() << " boxes, " << m_vecLeaf.size() << " leaves.\n";
+		DumpBox(os, 0, 0);
+		os.flush();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the version of CHMProbObjTreeBox.
+	// Return:		A unsigned int stands for the version.
+	unsigned int Version() const { return m_scunCHMProbObjTreeBoxVersion; }
+
+private:
+	struct SHMProbObjTreeSlot
+	{
+		unsigned int unId;		// A box or a leaf handle.
+		bool bBox;
+	};
+
+	struct SHMProbObjTreeNode
+	{
+		SHMProbObjTreeNode(const unsigned int unParentBox, const unsigned int unParentSlot, const unsigned int unCount)
+			: unParent(unParentBox), unSlot(unParentSlot), unFixedCount(unCount) {};
+
+		unsigned int unParent;
+		unsigned int unSlot;		// The slot of this box in its parent.
+		unsigned int unFixedCount;	// 0 if this box counts as the total of its entries.
+		std::vector<SHMProbObjTreeSlot> vecSlot;
+		CHMProbObjFenwick stFenwick;
+	};
+
+	struct SHMProbObjTreeLeaf
+	{
+		SHMProbObjTreeLeaf(const T1& t1Obj, const unsigned int unParentBox, const unsigned int unParentSlot)
+			: t1ProbObj(t1Obj), unBox(unParentBox), unSlot(unParentSlot) {};
+
+		T1 t1ProbObj;
+		unsigned int unBox;
+		unsigned int unSlot;
+	};
+
+	std::vector<SHMProbObjTreeNode> m_vecBox;
+	std::vector<SHMProbObjTreeLeaf> m_vecLeaf;
+	static const unsigned int m_scunProbObjBoxCapacity = UINT_MAX;
+	static const unsigned int m_scunCHMProbObjTreeBoxVersion = 1;
+
+	// The count a box weighs in its parent for a given total.
+	static unsigned int GetBoxWeight(const SHMProbObjTreeNode& stNode, const unsigned long long ullTotal)
+	{
+		if (0 == ullTotal || 0 == stNode.unFixedCount) return (unsigned int)ullTotal;
+		return stNode.unFixedCount;
+	}
+
+	// Sets the count of a slot and carries the change of the box weight up to the root,
+	// stopping at the first box whose weight stays the same. With bApply false it only
+	// checks that no total would overflow.
+	bool SetSlotCount(unsigned int unBox, unsigned int unSlot, unsigned int unCount, const bool bApply)
+	{
+		for (;;)
+		{
+			SHMProbObjTreeNode& stNode = m_vecBox[unBox];
+			const unsigned int unOldWeight = GetBoxWeight(stNode, stNode.stFenwick.GetTotal());
+			const unsigned long long ullTotal = (unsigned long long)stNode.stFenwick.GetTotal() - stNode.stFenwick.GetCount(unSlot) + unCount;
+			if (ullTotal > m_scunProbObjBoxCapacity) return false;
+
+			const unsigned int unNewWeight = GetBoxWeight(stNode, ullTotal);
+			if (bApply) stNode.stFenwick.Set(unSlot, unCount);
+			if (0 == unBox || unNewWeight == unOldWeight) return true;
+
+			unCount = unNewWeight;
+			unSlot = stNode.unSlot;
+			unBox = stNode.unParent;
+		}
+	}
+
+	// Appends a slot of count 0 to a box, leaving the box as it was if it throws.
+	void AppendSlot(const unsigned int unBox, const SHMProbObjTreeSlot& stSlot)
+	{
+		SHMProbObjTreeNode& stNode = m_vecBox[unBox];
+		stNode.vecSlot.push_back(stSlot);
+		try
+		{
+			stNode.stFenwick.Append(0);
+		}
+		catch (...)
+		{
+			stNode.vecSlot.pop_back();
+			throw;
+		}
+	}
+
+	void DumpBox(std::ostream& os, const unsigned int unBox, const unsigned int unDepth) const
+	{
+		const SHMProbObjTreeNode& stNode = m_vecBox[unBox];
+		const std::string strIndent(unDepth * 2, ' ');
+		for (unsigned int i = 0; i < stNode.vecSlot.size(); i++)
+		{
+			const SHMProbObjTreeSlot& stSlot = stNode.vecSlot[i];
+			if (stSlot.bBox)
+			{
+				os << strIndent << "Box " << stSlot.unId << ", count " << stNode.stFenwick.GetCount(i)
+					<< ", total " << m_vecBox[stSlot.unId].stFenwick.GetTotal() << ".\n";
+				DumpBox(os, stSlot.unId, unDepth + 1);
+			}
+			else
+			{
+				os << strIndent << "Probability object leaf " << stSlot.unId << ", count " << stNode.stFenwick.GetCount(i) << ".\n";
+			}
+		}
+	}
+};
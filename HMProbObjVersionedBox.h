@@ -0,0 +1,285 @@
+#pragma once
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////////////
+// CHMProbObjVersionedBox is a box whose versions share their storage. The pool is
+// split into chunks of up to 1024 entries held by reference counted pointers, and a
+// directory of the chunks is shared the same way, so Snapshot (or a copy) is O(1). A
+// Modify copies the directory and the chunk it touches only if another version still
+// shares them, so hundreds of versions of a big box cost little more than one.
+//
+// Entries keep their order as in CHMProbObjBox, and a given nRand draws the same object
+// as from a CHMProbObjBox with linear sampling holding the same entries. A draw scans
+// the chunk totals and then one chunk. Different versions may be used on different
+// threads, one version is not thread-safe to modify.
+template <typename T1>
+class CHMProbObjVersionedBox
+{
+public:
+	CHMProbObjVersionedBox() : m_unCurrentProbObjCount(0) {};
+	~CHMProbObjVersionedBox() {};
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Draw a probability object from this box.
+	// t1ProbObj:	If this call succeed, the drawn probability object will be put into
+	//				t1ProbObj.
+	// nRand:		It decides which probability object will be drawn. It should be a positive
+	//				random int value(recommended), or -1.
+	// Return:		Return true if succeed, false if failed.
+	bool Draw(T1& t1ProbObj, const int nRand = -1) const
+	{
+		if (0 == m_unCurrentProbObjCount) return false;
+		if (nRand < 0 && -1 != nRand) return false;
+
+		unsigned int unRand = (0 > nRand) ? rand() : nRand;
+		unsigned int unKeyNum = unRand % m_unCurrentProbObjCount;
+
+		for (auto itChunk = m_spChunkDir->cbegin(); itChunk != m_spChunkDir->cend(); itChunk++)
+		{
+			if (unKeyNum >= (*itChunk)->unTotal)
+			{
+				unKeyNum -= (*itChunk)->unTotal;
+				continue;
+			}
+
+			for (auto it = (*itChunk)->vecProbObjPool.cbegin(); it != (*itChunk)->vecProbObjPool.cend(); it++)
+			{
+				if (unKeyNum < it->second)
+				{
+					t1ProbObj = it->first;
+					return true;
+				}
+				unKeyNum -= it->second;
+			}
+		}
+		return false;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Modify probability objects of this version, other versions keep theirs.
+	// t1ProbObj:	A pointer to the storage of object that you want to modify.
+	// pCount:		A pointer to the storage of every object's new count.
+	// unLen:		The length of storage.
+	// Return:		None.
+	void Modify(const T1* const t1ProbObj, const unsigned int* const pCount, const unsigned int unLen = 1)
+	{
+		if (NULL == t1ProbObj || NULL == pCount || 0 == unLen) return;
+
+		for (unsigned int i = 0; i < unLen; i++)
+		{
+			ModifyProbObjPool(t1ProbObj[i], pCount[i]);
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Modify probability objects of this version, other versions keep theirs.
+	// t2ProbObj:	A user-defined container which contains the probability objects and
+	//				their counts we want.
+	// Return:		None.
+	template <typename T2>
+	void Modify(const T2& t2ProbObj)
+	{
+		for (auto it = t2ProbObj.cbegin(); it != t2ProbObj.cend(); it++)
+		{
+			ModifyProbObjPool(it->first, it->second);
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Take a snapshot of this version in O(1). The snapshot and this box share
+	//				all storage until one of them is modified.
+	// Return:		The snapshot.
+	CHMProbObjVersionedBox Snapshot() const { return *this; }
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Clear this version to make it empty.
+	// Return:		None.
+	void Clear()
+	{
+		m_spChunkDir.reset();
+		m_unCurrentProbObjCount = 0;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get particular or total probability objects counts, depend on pProbObj.
+	// pProbObj:	A pointer of the specific probability object, if it == NULL, get the
+	//				total count.
+	// Return:		The count.
+	unsigned int GetCount(const T1* const pProbObj = NULL) const
+	{
+		if (NULL == pProbObj) return m_unCurrentProbObjCount;
+
+		unsigned int unChunk = 0, unPos = 0;
+		return FindProbObj(*pProbObj, unChunk, unPos) ? (*m_spChunkDir)[unChunk]->vecProbObjPool[unPos].second : 0;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the number of probability objects in this version.
+	unsigned int GetSize() const
+	{
+		unsigned int unSize = 0;
+		if (m_spChunkDir)
+		{
+			for (auto it = m_spChunkDir->cbegin(); it != m_spChunkDir->cend(); it++) unSize += (unsigned int)(*it)->vecProbObjPool.size();
+		}
+		return unSize;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the number of chunks of this version, and how many of them are
+	//				shared with other versions.
+	// pSharedNum:	If not NULL, the number of shared chunks is put into it.
+	// Return:		The number of chunks.
+	unsigned int GetChunkNum(unsigned int* const pSharedNum = NULL) const
+	{
+		if (NULL != pSharedNum) *pSharedNum = 0;
+		if (!m_spChunkDir) return 0;
+
+		// A shared directory shares all its chunks, whose own counts are then 1.
+		if (NULL != pSharedNum && 1 < m_spChunkDir.use_count()) *pSharedNum = (unsigned int)m_spChunkDir->size();
+		else if (NULL != pSharedNum)
+		{
+			for (auto it = m_spChunkDir->cbegin(); it != m_spChunkDir->cend(); it++) *pSharedNum += (1 < it->use_count()) ? 1 : 0;
+		}
+		return (unsigned int)m_spChunkDir->size();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Call a function for every entry in order, such as to fill a CHMProbObjBox.
+	// fnVisit:		A callable void(const T1&, unsigned int count).
+	// Return:		None.
+	template <typename TFunc>
+	void ForEach(const TFunc& fnVisit) const
+	{
+		if (!m_spChunkDir) return;
+
+		for (auto itChunk = m_spChunkDir->cbegin(); itChunk != m_spChunkDir->cend(); itChunk++)
+		{
+			for (auto it = (*itChunk)->vecProbObjPool.cbegin(); it != (*itChunk)->vecProbObjPool.cend(); it++) fnVisit(it->first, it->second);
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Dump the details of this version to std::cout.
+	// Return:		None.
+	void Dump() const
+	{
+		Dump(std::cout);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Dump the details of this version to a stream, which is flushed once at
+	//				the end.
+	// os:			The output stream.
+	// Return:		None.
+	void Dump(std::ostream& os) const
+	{
+		unsigned int unSharedNum = 0;
+		const unsigned int unChunkNum = GetChunkNum(&unSharedNum);
+		os << "Current total probability object count " << m_unCurrentProbObjCount << ".\n";
+		os << "Versioned probability object box, " << GetSize() << " objects in " << unChunkNum << " chunks, "
+			<< unSharedNum << " shared.\n";
+		os.flush();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////
+	// Describe:	Get the version of CHMProbObjVersionedBox.
+	// Return:		A unsigned int stands for the version.
+	unsigned int Version() const { return m_scunCHMProbObjVersionedBoxVersion; }
+
+private:
+	struct SHMProbObjChunk
+	{
+		std::vector<std::pair<T1, unsigned int>> vecProbObjPool;
+		unsigned int unTotal;
+	};
+	typedef std::vector<std::shared_ptr<SHMProbObjChunk>> CHMProbObjChunkDir;
+
+	std::shared_ptr<CHMProbObjChunkDir> m_spChunkDir;
+	unsigned int m_unCurrentProbObjCount;
+	static const unsigned int m_scunProbObjBoxCapacity = UINT_MAX;
+	static const unsigned int m_scunChunkSize = 1024;
+	static const unsigned int m_scunCHMProbObjVersionedBoxVersion = 1;
+
+	bool FindProbObj(const T1& t1ProbObj, unsigned int& unChunk, unsigned int& unPos) const
+	{
+		if (!m_spChunkDir) return false;
+
+		for (unChunk = 0; unChunk < m_spChunkDir->size(); unChunk++)
+		{
+			const std::vector<std::pair<T1, unsigned int>>& vecProbObjPool = (*m_spChunkDir)[unChunk]->vecProbObjPool;
+			for (unPos = 0; unPos < vecProbObjPool.size(); unPos++)
+			{
+				if (t1ProbObj == vecProbObjPool[unPos].first) return true;
+			}
+		}
+		return false;
+	}
+
+	// The directory, copied first if another version shares it.
+	CHMProbObjChunkDir& GetOwnChunkDir()
+	{
+		if (!m_spChunkDir) m_spChunkDir = std::make_shared<CHMProbObjChunkDir>();
+		else if (1 < m_spChunkDir.use_count()) m_spChunkDir = std::make_shared<CHMProbObjChunkDir>(*m_spChunkDir);
+		return *m_spChunkDir;
+	}
+
+	// A chunk, copied first if another version shares it.
+	SHMProbObjChunk& GetOwnChunk(const unsigned int unChunk)
+	{
+		CHMProbObjChunkDir& vecChunkDir = GetOwnChunkDir();
+		if (1 < vecChunkDir[unChunk].use_count()) vecChunkDir[unChunk] = std::make_shared<SHMProbObjChunk>(*vecChunkDir[unChunk]);
+		return *vecChunkDir[unChunk];
+	}
+
+	void ModifyProbObjPool(const T1& t1ProbObj, const unsigned int unCount)
+	{
+		try
+		{
+			unsigned int unChunk = 0, unPos = 0;
+			if (FindProbObj(t1ProbObj, unChunk, unPos))
+			{
+				const unsigned int unOldCount = (*m_spChunkDir)[unChunk]->vecProbObjPool[unPos].second;
+				if (0 != unCount && m_scunProbObjBoxCapacity - unCount < m_unCurrentProbObjCount - unOldCount) return;
+
+				SHMProbObjChunk& stChunk = GetOwnChunk(unChunk);
+				stChunk.unTotal = stChunk.unTotal - unOldCount + unCount;
+				m_unCurrentProbObjCount = m_unCurrentProbObjCount - unOldCount + unCount;
+				if (0 != unCount)
+				{
+					stChunk.vecProbObjPool[unPos].second = unCount;
+					return;
+				}
+
+				stChunk.vecProbObjPool.erase(stChunk.vecProbObjPool.begin() + unPos);
+				if (stChunk.vecProbObjPool.empty()) m_spChunkDir->erase(m_spChunkDir->begin() + unChunk);
+				return;
+			}
+
+			if (0 == unCount || m_scunProbObjBoxCapacity - unCount <= m_unCurrentProbObjCount) return;
+
+			CHMProbObjChunkDir& vecChunkDir = GetOwnChunkDir();
+			if (vecChunkDir.empty() || vecChunkDir.back()->vecProbObjPool.size() >= m_scunChunkSize)
+			{
+				std::shared_ptr<SHMProbObjChunk> spChunk = std::make_shared<SHMProbObjChunk>();
+				spChunk->vecProbObjPool.reserve(m_scunChunkSize);
+				spChunk->unTotal = 0;
+				vecChunkDir.push_back(spChunk);
+			}
+
+			SHMProbObjChunk& stChunk = GetOwnChunk((unsigned int)vecChunkDir.size() - 1);
+			stChunk.vecProbObjPool.push_back(std::make_pair(t1ProbObj, unCount));
+			stChunk.unTotal += unCount;
+			m_unCurrentProbObjCount += unCount;
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << __FILE__ << "(" << __LINE__ << "), exception: " << e.what() << std::endl;
+		}
+	}
+};